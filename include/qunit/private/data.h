@@ -0,0 +1,182 @@
+#ifndef __QUNIT_PRIVATE_DATA__
+#define __QUNIT_PRIVATE_DATA__
+
+#include "mmap.h"
+
+// ----------------------------------------------------------------------------
+// Corpora for qtest_data: a file of records, each a 4 byte little-endian
+// length followed by that many bytes. The file is mapped, never read
+// into the heap; the test body sees each record in place.
+
+namespace QUnit
+{
+	struct QRecord
+	{
+		const unsigned char* data;
+		size_t size;
+		QInt64 offset;		// of the record's length prefix in the corpus
+	};
+}
+
+namespace QUnit { namespace PrivateHelper
+{
+	// The record a worker process is in, kept in memory the runner
+	// shares with the worker, so a worker that dies in a record can still
+	// be reported by its offset. NULL outside workers.
+	struct QRecordSite
+	{
+		volatile QInt64 offset;		// -1 when no record is running
+		char path[256];
+	};
+
+	inline
+	QRecordSite*& record_site()
+	{
+		static QRecordSite* site = NULL;
+		return site;
+	}
+
+	// The records are split into chunks of about chunk_bytes (and at most
+	// chunk_records records); each chunk is one case, run with a single
+	// fixture instance. Only the chunk boundaries are kept in memory.
+	template<class Test>
+	class QDataRun : public QRun
+	{
+		enum {chunk_bytes = 4 << 20, chunk_records = 4096};
+
+		std::string m_path;
+		QMappedFile* m_file;
+		std::vector<size_t> m_chunks;
+		std::string m_error;
+
+		static size_t length_at(const unsigned char* p)
+		{
+			return p[0] | (p[1] << 8) | (p[2] << 16) | ((size_t)p[3] << 24);
+		}
+
+		std::string where(size_t pos) const
+		{
+			return m_path + "@" + to_s((QInt64)pos) + ": ";
+		}
+
+		// walks the length prefixes once, on first use
+		void index()
+		{
+			if (m_file != NULL)
+				return;
+
+			m_chunks.push_back(0);
+			m_file = new QMappedFile(m_path.c_str());
+			if (!m_file->is_open())
+			{
+				m_error = "can't open corpus " + m_path;
+				return;
+			}
+
+			const unsigned char* data = (const unsigned char*)m_file->data();
+			size_t size = m_file->size();
+			size_t pos = 0, chunk_start = 0;
+			int records = 0;
+			while (pos < size)
+			{
+				if (size - pos < 4 || size - pos - 4 < length_at(data + pos))
+				{
+					m_error = where(pos) + "truncated record";
+					break;
+				}
+				pos += 4 + length_at(data + pos);
+				if (++records == chunk_records || pos - chunk_start >= chunk_bytes)
+				{
+					m_chunks.push_back(pos);
+					chunk_start = pos;
+					records = 0;
+				}
+			}
+			if (records > 0)
+				m_chunks.push_back(pos);
+		}
+
+	public:
+		QDataRun(const char* path)
+		{
+			m_path = path;
+			m_file = NULL;
+		}
+		~QDataRun()
+		{
+			delete m_file;
+		}
+
+		// one more case reports a missing or damaged corpus
+		int cases()
+		{
+			index();
+			return (int)m_chunks.size() - 1 + (m_error.empty() ? 0 : 1);
+		}
+
+		void run(QRunCookie* cookie)
+		{
+			index();
+			size_t chunk = (size_t)cookie->__param;
+			if (chunk + 1 >= m_chunks.size())
+				throw m_error;
+
+			QRecordSite* site = record_site();
+			if (site != NULL)
+			{
+				strncpy(site->path, m_path.c_str(), sizeof(site->path) - 1);
+				site->path[sizeof(site->path) - 1] = 0;
+			}
+
+			const unsigned char* data = (const unsigned char*)m_file->data();
+			Test inst;
+			QRecord record;
+			for (size_t pos = m_chunks[chunk]; pos < m_chunks[chunk + 1]; pos += 4 + record.size)
+			{
+				record.offset = pos;
+				record.size = length_at(data + pos);
+				record.data = data + pos + 4;
+				if (site != NULL)
+					site->offset = pos;
+				try
+				{
+					inst.run(cookie, record);
+				}
+				catch (QFailure& e)
+				{
+					e.condition = where(pos) + e.condition;
+					throw;
+				}
+				catch (const std::exception& e)
+				{
+					throw where(pos) + e.what();
+				}
+				catch (const char* e)
+				{
+					throw where(pos) + e;
+				}
+				catch (const std::string& e)
+				{
+					throw where(pos) + e;
+				}
+				catch (...)
+				{
+					throw where(pos) + "Unknown exception";
+				}
+			}
+			if (site != NULL)
+				site->offset = -1;
+		}
+	};
+
+	template<class Test> inline
+	QRun* add_data_test(const char* testcase, const char* name, const char* path)
+	{
+		static QDataRun<Test> run(path);
+		QModule::inst().add_test(testcase, name, &run);
+		return &run;
+	}
+}}
+
+// ----------------------------------------------------------------------------
+#endif // __QUNIT_PRIVATE_DATA__
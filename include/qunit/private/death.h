@@ -0,0 +1,172 @@
+#ifndef __QUNIT_PRIVATE_DEATH__
+#define __QUNIT_PRIVATE_DEATH__
+
+#ifdef X_OS_UNIX
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// ----------------------------------------------------------------------------
+// Death tests for qassert_death.
+//
+// The statement runs in a fork() of the test, with no exec, so a death
+// test costs a fork and nothing more. The child has its stderr on a
+// pipe and tells the parent over a second pipe if the statement
+// returned or threw instead of ending the process. The statement dies
+// if the child is killed by a signal or exits with a non-zero status.
+//
+// Only the forking thread exists in the child; a statement that needs
+// a lock another test thread held at the fork may hang, so run death
+// tests without --jobs or with --isolate. Without fork() (Windows)
+// qassert_death always fails.
+
+namespace QUnit { namespace PrivateHelper
+{
+#ifdef X_OS_UNIX
+
+	class QDeathTest
+	{
+		pid_t m_pid;
+		int m_stderr;
+		int m_outcome;
+
+		static void read_all(int fd, std::string& s)
+		{
+			char buf[4096];
+			for (;;)
+			{
+				ssize_t n = read(fd, buf, sizeof(buf));
+				if (n > 0)
+					s.append(buf, n);
+				else if (n == 0 || errno != EINTR)
+					break;
+			}
+		}
+
+	public:
+		QDeathTest()
+		{
+			int err[2], outcome[2];
+			m_pid = -1;
+			m_stderr = m_outcome = -1;
+			if (pipe(err) != 0)
+				return;
+			if (pipe(outcome) != 0)
+			{
+				close(err[0]);
+				close(err[1]);
+				return;
+			}
+
+			fflush(stdout);
+			fflush(stderr);
+			m_pid = fork();
+			if (m_pid == 0)
+			{
+				close(err[0]);
+				close(outcome[0]);
+				dup2(err[1], 2);
+				close(err[1]);
+				m_outcome = outcome[1];
+				return;
+			}
+
+			close(err[1]);
+			close(outcome[1]);
+			if (m_pid < 0)
+			{
+				close(err[0]);
+				close(outcome[0]);
+				return;
+			}
+			m_stderr = err[0];
+			m_outcome = outcome[0];
+		}
+		~QDeathTest()
+		{
+			if (m_stderr >= 0)
+				close(m_stderr);
+			if (m_outcome >= 0)
+				close(m_outcome);
+		}
+
+		bool in_child() const
+		{
+			return m_pid == 0;
+		}
+
+		// the statement came back; never returns
+		void survived(bool threw)
+		{
+			char c = threw ? 'T' : 'R';
+			write(m_outcome, &c, 1);
+			_exit(0);
+		}
+
+		// whether the child died with stderr matching regex; if not, why
+		bool died(const char* regex, std::string& why)
+		{
+			if (m_pid < 0)
+			{
+				why = "can't fork";
+				return false;
+			}
+
+			std::string output, outcome;
+			read_all(m_stderr, output);
+			read_all(m_outcome, outcome);
+			int status = 0;
+			while (waitpid(m_pid, &status, 0) < 0 && errno == EINTR)
+				;
+
+			char how[64];
+			if (!outcome.empty())
+				strcpy(how, outcome[0] == 'T' ? "it threw an exception" : "it returned");
+			else if (WIFSIGNALED(status))
+				sprintf(how, "killed by signal %d", WTERMSIG(status));
+			else
+				sprintf(how, "exited with status %d", WEXITSTATUS(status));
+
+			if (!outcome.empty() || (WIFEXITED(status) && WEXITSTATUS(status) == 0))
+			{
+				why = how;
+				return false;
+			}
+
+			CRegexpT<char> rx(regex);
+			if (!rx.Match(output.c_str()).IsMatched())
+			{
+				why = std::string(how) + ", stderr was " + to_s(output);
+				return false;
+			}
+			return true;
+		}
+	};
+
+#else
+
+	class QDeathTest
+	{
+	public:
+		bool in_child() const
+		{
+			return false;
+		}
+		void survived(bool)
+		{
+		}
+		bool died(const char*, std::string& why)
+		{
+			why = "death tests need fork()";
+			return false;
+		}
+	};
+
+#endif
+}}
+
+// ----------------------------------------------------------------------------
+#endif // __QUNIT_PRIVATE_DEATH__
@@ -372,6 +372,21 @@ public:
 	CBufferT <int> m_stack;
 	CBufferT <int> m_capturestack, m_captureindex;
 
+	// choices the elx tree may still try, -1 for no limit; once spent,
+	// every choice fails and m_bOverBudget is set
+	int m_nStepsLeft;
+	int m_bOverBudget;
+
+	// the automaton's, kept to be reused by the next match
+	CBufferT <int> m_threads, m_threadcaps, m_slots, m_best;
+	CBufferT <unsigned int> m_visited;
+
+	// with MEMOIZE, the (repeat, pos) pairs known to fail: a row of
+	// m_nFailedRow bits per memoized repeat, set up by the first search
+	// of a text; -1 until then, 0 when off
+	CBufferT <unsigned int> m_failed;
+	int m_nFailedRow;
+
 public:
 	int    m_nCurrentPos;
 	int    m_nBeginPos;
@@ -380,8 +395,55 @@ public:
 
 	void * m_pMatchString;
 	int    m_pMatchStringLength;
+
+public:
+	CContext() : m_nStepsLeft(-1), m_bOverBudget(0), m_nFailedRow(-1) {}
+
+	int Step()
+	{
+		if(m_nStepsLeft < 0) return 1;
+		if(m_nStepsLeft > 0) { m_nStepsLeft --; return 1; }
+
+		m_bOverBudget = 1;
+		return 0;
+	}
+
+	int IsFailed(int nmemo, int npos) const
+	{
+		if(nmemo < 0 || m_nFailedRow <= 0) return 0;
+
+		int i = nmemo * m_nFailedRow + npos;
+		return (m_failed[i >> 5] >> (i & 31)) & 1;
+	}
+
+	void SetFailed(int nmemo, int npos)
+	{
+		if(nmemo < 0 || m_nFailedRow <= 0) return;
+
+		int i = nmemo * m_nFailedRow + npos;
+		m_failed[i >> 5] |= 1u << (i & 31);
+	}
+};
+
+//
+// Step budget
+//
+// Steps one match may take in the elx tree, 0 for no limit: a step is
+// an alternative tried or a repeat entered once more. Each CRegexpT
+// takes the default when compiled and may set its own m_nMaxSteps. A
+// match over budget fails with the context's m_bOverBudget set. The
+// automaton is linear in the text and isn't counted.
+//
+template <int x> class CStepBudgetT
+{
+public:
+	static int m_nDefaultMaxSteps;
 };
 
+template <int x> int CStepBudgetT <x> :: m_nDefaultMaxSteps = 0;
+
+typedef CStepBudgetT <0> CStepBudget;
+
 //
 // Interface
 //
@@ -870,6 +932,7 @@ protected:
 public:
 	ElxInterface * m_pelx;
 	int m_nfixed;
+	int m_nmemo; // row in CContext::m_failed, -1 if not memoized
 };
 
 typedef CRepeatElxT <0> CRepeatElx;
@@ -888,6 +951,7 @@ public:
 
 protected:
 	int MatchVart    (CContext * pContext) const;
+	int MatchVartFrom(CContext * pContext, int n) const;
 	int MatchNextVart(CContext * pContext) const;
 
 public:
@@ -1035,6 +1099,9 @@ public:
 
 public:
 	CPossessiveElxT(ElxInterface * pelx, int nmin = 0, int nmax = INT_MAX);
+
+public:
+	int m_bimplied; // by the optimizer, from a greedy one with nothing useful to give back
 };
 
 typedef CPossessiveElxT <0> CPossessiveElx;
@@ -1053,12 +1120,18 @@ public:
 
 public:
 	int IsContainChar(CHART ch) const;
+	void Compile();
 
 public:
 	CBufferT <CHART> m_ranges;
 	CBufferT <CHART> m_chars;
 	CBufferT <ElxInterface *> m_embeds;
 
+	// by Compile: chars below 256, embeds included, and sorted ranges for the others
+	unsigned char    m_bitmap[32];
+	CBufferT <CHART> m_sorted;
+	int              m_bcompiled;
+
 public:
 	int m_brightleft;
 	int m_byes;
@@ -1071,6 +1144,92 @@ template <class CHART> CRangeElxT <CHART> :: CRangeElxT(int brightleft, int byes
 {
 	m_brightleft = brightleft;
 	m_byes       = byes;
+	m_bcompiled  = 0;
+}
+
+template <class CHART> void CRangeElxT <CHART> :: Compile()
+{
+	int i, j;
+
+	// membership below 256
+	CContext probe;
+	CHART ch;
+
+	probe.m_pMatchString       = &ch;
+	probe.m_pMatchStringLength = 1;
+
+	memset(m_bitmap, 0, sizeof(m_bitmap));
+
+	for(i=0; i<256; i++)
+	{
+		ch = (CHART)i;
+		int bsucc = IsContainChar(ch);
+
+		for(j=0; !bsucc && j<m_embeds.GetSize(); j++)
+		{
+			probe.m_nCurrentPos = m_brightleft ? 1 : 0;
+			bsucc = m_embeds[j]->Match(&probe);
+		}
+
+		if(bsucc)
+			m_bitmap[i >> 3] |= 1 << (i & 7);
+	}
+
+	// ranges and chars as sorted, disjoint ranges
+	m_sorted.Restore(0);
+
+	if(sizeof(CHART) > 1)
+	{
+		CBufferT <CHART> pairs;
+
+		for(i=0; i<m_ranges.GetSize(); i+=2)
+		{
+			if(m_ranges[i] <= m_ranges[i+1])
+			{
+				pairs.Push(m_ranges[i]);
+				pairs.Push(m_ranges[i+1]);
+			}
+		}
+
+		for(i=0; i<m_chars.GetSize(); i++)
+		{
+			pairs.Push(m_chars[i]);
+			pairs.Push(m_chars[i]);
+		}
+
+		// insertion sort, classes are short
+		for(i=2; i<pairs.GetSize(); i+=2)
+		{
+			CHART lo = pairs[i], hi = pairs[i+1];
+
+			for(j=i; j>0 && pairs[j-2] > lo; j-=2)
+			{
+				pairs[j  ] = pairs[j-2];
+				pairs[j+1] = pairs[j-1];
+			}
+
+			pairs[j  ] = lo;
+			pairs[j+1] = hi;
+		}
+
+		for(i=0; i<pairs.GetSize(); i+=2)
+		{
+			int n = m_sorted.GetSize();
+
+			if(n > 0 && (pairs[i] <= m_sorted[n-1] || pairs[i] - m_sorted[n-1] == 1))
+			{
+				if(pairs[i+1] > m_sorted[n-1])
+					m_sorted[n-1] = pairs[i+1];
+			}
+			else
+			{
+				m_sorted.Push(pairs[i]);
+				m_sorted.Push(pairs[i+1]);
+			}
+		}
+	}
+
+	m_bcompiled = 1;
 }
 
 template <class CHART> int CRangeElxT <CHART> :: Match(CContext * pContext) const
@@ -1084,20 +1243,37 @@ template <class CHART> int CRangeElxT <CHART> :: Match(CContext * pContext) cons
 		return 0;
 
 	CHART ch = ((const CHART *)pContext->m_pMatchString)[at];
-	int bsucc = 0, i;
+	int bsucc = 0, i, bembeds = 1;
 
-	// compare
-	for(i=0; !bsucc && i<m_ranges.GetSize(); i+=2)
+	if( ! m_bcompiled )
 	{
-		if(m_ranges[i] <= ch && ch <= m_ranges[i+1]) bsucc = 1;
+		bsucc = IsContainChar(ch);
 	}
-
-	for(i=0; !bsucc && i<m_chars.GetSize(); i++)
+	else if(sizeof(CHART) == 1 || (ch & ~(CHART)0xff) == 0)
 	{
-		if(m_chars[i] == ch) bsucc = 1;
+		// embeds are in the bitmap
+		bsucc   = (m_bitmap[(unsigned char)ch >> 3] >> (ch & 7)) & 1;
+		bembeds = 0;
+	}
+	else
+	{
+		// last range starting at or below ch
+		int lo = 0, hi = m_sorted.GetSize() / 2;
+
+		while(lo < hi)
+		{
+			int mid = (lo + hi) / 2;
+
+			if(m_sorted[mid*2] <= ch)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		bsucc = lo > 0 && ch <= m_sorted[lo*2 - 1];
 	}
 
-	for(i=0; !bsucc && i<m_embeds.GetSize(); i++)
+	for(i=0; bembeds && !bsucc && i<m_embeds.GetSize(); i++)
 	{
 		if(m_embeds[i]->Match(pContext))
 		{
@@ -1429,6 +1605,7 @@ enum STOCKELX_ID_DEFINES
 		IGNORECASE     = 0x08,
 		RIGHTTOLEFT    = 0x10,
 		EXTENDED       = 0x20,
+		MEMOIZE        = 0x40,
 	};
 	#define _REGEX_FLAGS_DEFINED
 #endif
@@ -1448,6 +1625,7 @@ public:
 public:
 	ElxInterface * Build(const CBufferRefT <CHART> & pattern, int flags);
 	int GetNamedNumber(const CBufferRefT <CHART> & named) const;
+	int FindCandidate(const CHART * tstring, int length, int start) const;
 	void Clear();
 
 public:
@@ -1461,6 +1639,7 @@ public:
 	int            m_nMaxNumber;
 	int            m_nNextNamed;
 	int            m_nGroupCount;
+	int            m_nMemoCount;
 
 	CBufferT <ElxInterface  *> m_objlist;
 	CBufferT <ElxInterface  *> m_grouplist;
@@ -1469,6 +1648,17 @@ public:
 	CBufferT <CBackrefElx   *> m_namedbackreflist;
 	CBufferT <CConditionElx *> m_namedconditionlist;
 
+	// where a match may start
+	CBufferT <CHART> m_prefix;
+	unsigned char    m_firstchars[32];
+	int              m_bFirstWide;
+	int              m_bFirstAny;
+
+	// how a match is placed, INT_MAX if unbounded
+	int              m_bAnchored;
+	int              m_nMinLength;
+	int              m_nMaxLength;
+
 // CHART_INFO
 protected:
 	struct CHART_INFO
@@ -1503,6 +1693,23 @@ protected:
 	ElxInterface * GetStockElx     (int nStockId);
 	ElxInterface * Keep(ElxInterface * pElx);
 
+	int  FirstChars   (ElxInterface * pelx);
+	void AddFirstChar (CHART ch);
+	int  LiteralPrefix(ElxInterface * pelx);
+	void Memoize      (ElxInterface * pelx, int bstate, int bcounted);
+	int  ReadsState   (ElxInterface * pelx);
+	int  Anchored     (ElxInterface * pelx);
+	void Lengths      (ElxInterface * pelx, int & nmin, int & nmax);
+
+	ElxInterface * Optimize      (ElxInterface * pelx);
+	void           FactorPrefixes(CAlternativeElx * pAlternative);
+	void           MergeClasses  (CAlternativeElx * pAlternative);
+	ElxInterface * StripPrefix   (ElxInterface * pelx, int nprefix);
+	static CStringElxT <CHART> * LeadingString(ElxInterface * pelx);
+	static int IsOneChar  (ElxInterface * pelx);
+	static int Overlaps   (ElxInterface * pbody, ElxInterface * pnext);
+	static int MatchesChar(ElxInterface * pelx, CHART ch);
+
 // Private Attributes
 protected:
 	CBufferRefT <CHART> m_pattern;
@@ -1547,6 +1754,7 @@ template <class CHART> ElxInterface * CBuilderT <CHART> :: Build(const CBufferRe
 	m_nCharsetDepth = 0;
 	m_nMaxNumber    = 0;
 	m_nNextNamed    = 0;
+	m_nMemoCount    = 0;
 	m_nFlags        = flags;
 	m_bQuoted       = 0;
 	m_quote_fun     = 0;
@@ -1561,7 +1769,7 @@ template <class CHART> ElxInterface * CBuilderT <CHART> :: Build(const CBufferRe
 	for(i=0; i<3; i++) MoveNext();
 
 	// build
-	m_pTopElx = BuildAlternative(flags);
+	m_pTopElx = Optimize(BuildAlternative(flags));
 
 	// group 0
 	m_grouplist.Prepare(0);
@@ -1645,1484 +1853,3244 @@ template <class CHART> ElxInterface * CBuilderT <CHART> :: Build(const CBufferRe
 		}
 	}
 
-	return m_pTopElx;
-}
+	// candidates
+	m_prefix.Restore(0);
+	memset(m_firstchars, 0, sizeof(m_firstchars));
+	m_bFirstWide = 0;
+	m_bFirstAny  = (flags & RIGHTTOLEFT) != 0;
 
-template <class CHART> void CBuilderT <CHART> :: Clear()
-{
-	for(int i=0; i<m_objlist.GetSize(); i++)
+	if( ! m_bFirstAny )
 	{
-		delete m_objlist[i];
+		if( FirstChars(m_pTopElx) )
+			m_bFirstAny = 1;
+
+		LiteralPrefix(m_pTopElx);
 	}
 
-	m_objlist.Restore(0);
-	m_pTopElx = 0;
-	m_nMaxNumber = 0;
+	// a single first char is a prefix too
+	if( ! m_bFirstAny && ! m_bFirstWide && m_prefix.GetSize() == 0 )
+	{
+		int nfirst = 0, nchar = 0;
 
-	memset(m_pStockElxs, 0, sizeof(m_pStockElxs));
+		for(i=0; i<256; i++)
+		{
+			if(m_firstchars[i >> 3] & (1 << (i & 7)))
+			{
+				nfirst ++;
+				nchar = i;
+			}
+		}
+
+		if(nfirst == 1)
+			m_prefix.Append((CHART)nchar);
+	}
+
+	// a recursion reenters a group from elsewhere, so nothing is memoized
+	if( (flags & MEMOIZE) && m_recursivelist.GetSize() == 0 )
+		Memoize(m_pTopElx, 0, 0);
+
+	// right to left matches end at the start pos, so nothing is pruned
+	m_bAnchored  = 0;
+	m_nMinLength = 0;
+	m_nMaxLength = INT_MAX;
+
+	if( ! (flags & RIGHTTOLEFT) )
+	{
+		m_bAnchored = Anchored(m_pTopElx);
+		Lengths(m_pTopElx, m_nMinLength, m_nMaxLength);
+	}
+
+	return m_pTopElx;
 }
 
 //
-// hex to int
+// Adds the chars pelx may start with, returns 1 if it may match empty
 //
-template <class CHART> unsigned int CBuilderT <CHART> :: Hex2Int(const CHART * pcsz, int length, int & used)
+template <class CHART> int CBuilderT <CHART> :: FirstChars(ElxInterface * pelx)
 {
-	unsigned int result = 0;
-	int & i = used;
+	int i;
 
-	for(i=0; i<length; i++)
+	if(CListElx * pList = dynamic_cast <CListElx *> (pelx))
 	{
-		if(pcsz[i] >= RCHART('0') && pcsz[i] <= RCHART('9'))
-			result = (result << 4) + (pcsz[i] - RCHART('0'));
-		else if(pcsz[i] >= RCHART('A') && pcsz[i] <= RCHART('F'))
-			result = (result << 4) + (0x0A + (pcsz[i] - RCHART('A')));
-		else if(pcsz[i] >= RCHART('a') && pcsz[i] <= RCHART('f'))
-			result = (result << 4) + (0x0A + (pcsz[i] - RCHART('a')));
-		else
-			break;
+		if(pList->m_brightleft)
+		{
+			m_bFirstAny = 1;
+			return 1;
+		}
+
+		for(i=0; i<pList->m_elxlist.GetSize(); i++)
+		{
+			if( ! FirstChars(pList->m_elxlist[i]) )
+				return 0;
+		}
+
+		return 1;
 	}
 
-	return result;
-}
+	if(CAlternativeElx * pAlternative = dynamic_cast <CAlternativeElx *> (pelx))
+	{
+		int bempty = pAlternative->m_elxlist.GetSize() == 0;
 
-template <class CHART> inline ElxInterface * CBuilderT <CHART> :: Keep(ElxInterface * pelx)
-{
-	m_objlist.Push(pelx);
-	return pelx;
-}
+		for(i=0; i<pAlternative->m_elxlist.GetSize(); i++)
+		{
+			if( FirstChars(pAlternative->m_elxlist[i]) )
+				bempty = 1;
+		}
 
-template <class CHART> void CBuilderT <CHART> :: MoveNext()
-{
-	// forwards
-	prev = curr;
-	curr = next;
-	next = nex2;
+		return bempty;
+	}
 
-	// get nex2
-	while( ! GetNext2() ) {};
-}
+	// greedy, reluctant and possessive too
+	if(CRepeatElx * pRepeat = dynamic_cast <CRepeatElx *> (pelx))
+	{
+		return FirstChars(pRepeat->m_pelx) || pRepeat->m_nfixed == 0;
+	}
 
-template <class CHART> int CBuilderT <CHART> :: GetNext2()
-{
-	// check length
-	if(m_nNextPos >= m_pattern.GetSize())
+	if(CIndependentElx * pIndependent = dynamic_cast <CIndependentElx *> (pelx))
+	{
+		return FirstChars(pIndependent->m_pelx);
+	}
+
+	if(CStringElxT <CHART> * pString = dynamic_cast <CStringElxT <CHART> *> (pelx))
+	{
+		if(pString->m_szPattern.GetSize() == 0)
+			return 1;
+
+		CHART ch = pString->m_szPattern[0];
+		AddFirstChar(ch);
+
+		if(pString->m_bignorecase)
+		{
+			AddFirstChar((CHART)toupper(ch));
+			AddFirstChar((CHART)tolower(ch));
+		}
+
+		return 0;
+	}
+
+	if(dynamic_cast <CRangeElxT <CHART> *> (pelx) != 0 || dynamic_cast <CPosixElxT <CHART> *> (pelx) != 0)
+	{
+		CContext probe;
+		CHART ch;
+
+		probe.m_pMatchString       = &ch;
+		probe.m_pMatchStringLength = 1;
+		probe.m_nBeginPos          = 0;
+
+		for(i=0; i<256; i++)
+		{
+			ch = (CHART)i;
+			probe.m_nCurrentPos = 0;
+
+			if(pelx->Match(&probe))
+				AddFirstChar(ch);
+		}
+
+		if(sizeof(CHART) > 1)
+			m_bFirstWide = 1;
+
+		return 0;
+	}
+
+	// zero width
+	if( dynamic_cast <CBracketElx *> (pelx) != 0 || dynamic_cast <CBoundaryElxT <CHART> *> (pelx) != 0 ||
+		dynamic_cast <CGlobalElx *> (pelx) != 0 || dynamic_cast <CEmptyElx *> (pelx) != 0 || dynamic_cast <CAssertElx *> (pelx) != 0
+	)
 	{
-		nex2 = CHART_INFO(0, 1, m_nNextPos, 0);
 		return 1;
 	}
 
-	int   delta = 1;
-	CHART ch    = m_pattern[m_nNextPos];
+	// backref, condition, recursive
+	m_bFirstAny = 1;
+	return 1;
+}
 
-	// if quoted
-	if(m_bQuoted)
+template <class CHART> inline void CBuilderT <CHART> :: AddFirstChar(CHART ch)
+{
+	if(sizeof(CHART) > 1 && (ch & ~(CHART)0xff) != 0)
+		m_bFirstWide = 1;
+	else
+		m_firstchars[(unsigned char)ch >> 3] |= 1 << (ch & 7);
+}
+
+//
+// Appends the literal chars pelx starts with, returns 1 if that was all of it
+//
+template <class CHART> int CBuilderT <CHART> :: LiteralPrefix(ElxInterface * pelx)
+{
+	if(CListElx * pList = dynamic_cast <CListElx *> (pelx))
 	{
-		if(ch == RCHART('\\'))
+		if(pList->m_brightleft)
+			return 0;
+
+		for(int i=0; i<pList->m_elxlist.GetSize(); i++)
 		{
-			if(m_pattern[m_nNextPos + 1] == RCHART('E'))
-			{
-				m_quote_fun = 0;
-				m_bQuoted   = 0;
-				m_nNextPos += 2;
+			if( ! LiteralPrefix(pList->m_elxlist[i]) )
 				return 0;
-			}
 		}
 
-		if(m_quote_fun != 0)
-			nex2 = CHART_INFO((CHART)(*m_quote_fun)((int)ch), 0, m_nNextPos, delta);
-		else
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		return 1;
+	}
 
-		m_nNextPos += delta;
+	if(CStringElxT <CHART> * pString = dynamic_cast <CStringElxT <CHART> *> (pelx))
+	{
+		if(pString->m_brightleft || pString->m_bignorecase)
+			return 0;
 
+		m_prefix.Append(pString->m_szPattern.GetBuffer(), pString->m_szPattern.GetSize());
 		return 1;
 	}
 
-	// common
-	switch(ch)
+	// zero width
+	return dynamic_cast <CBracketElx *> (pelx) != 0 || dynamic_cast <CBoundaryElxT <CHART> *> (pelx) != 0 ||
+		dynamic_cast <CGlobalElx *> (pelx) != 0 || dynamic_cast <CEmptyElx *> (pelx) != 0;
+}
+
+//
+// Rewrites pelx to match the same with less backtracking, returns what
+// replaces it. Group lists keep their identity, as others point to them.
+//
+template <class CHART> ElxInterface * CBuilderT <CHART> :: Optimize(ElxInterface * pelx)
+{
+	int i, n;
+
+	if(CListElx * pList = dynamic_cast <CListElx *> (pelx))
 	{
-	case RCHART('\\'):
+		CBufferT <ElxInterface *> & list = pList->m_elxlist;
+
+		for(i=0; i<list.GetSize(); i++)
+			list[i] = Optimize(list[i]);
+
+		// adjacent literals as one
+		for(i=0, n=0; i<list.GetSize(); i++)
 		{
-			CHART ch1 = m_pattern[m_nNextPos+1];
+			CStringElxT <CHART> * pString = dynamic_cast <CStringElxT <CHART> *> (list[i]);
+			CStringElxT <CHART> * pLast   = n > 0 ? dynamic_cast <CStringElxT <CHART> *> (list[n-1]) : 0;
 
-			// backref
-			if(ch1 >= RCHART('0') && ch1 <= RCHART('9'))
+			if(pString != 0 && pLast != 0 && pString->m_brightleft == pLast->m_brightleft && pString->m_bignorecase == pLast->m_bignorecase)
 			{
-				nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
-				break;
+				CStringElxT <CHART> * pJoined = (CStringElxT <CHART> *)Keep(new CStringElxT <CHART> (pLast->m_szPattern.GetBuffer(), pLast->m_szPattern.GetSize(), pLast->m_brightleft, pLast->m_bignorecase));
+
+				pJoined->m_szPattern.Append(pString->m_szPattern.GetBuffer(), pString->m_szPattern.GetSize());
+				list[n-1] = pJoined;
+			}
+			else
+			{
+				list[n++] = list[i];
 			}
+		}
 
-			// escape
-			delta     = 2;
+		list.Restore(n);
 
-			switch(ch1)
-			{
-			case RCHART('A'):
-			case RCHART('Z'):
-			case RCHART('z'):
-			case RCHART('w'):
-			case RCHART('W'):
-			case RCHART('s'):
-			case RCHART('S'):
-			case RCHART('B'):
-			case RCHART('d'):
-			case RCHART('D'):
-			case RCHART('k'):
-			case RCHART('g'):
-				nex2 = CHART_INFO(ch1, 1, m_nNextPos, delta);
-				break;
-
-			case RCHART('b'):
-				if(m_nCharsetDepth > 0)
-					nex2 = CHART_INFO('\b', 0, m_nNextPos, delta);
-				else
-					nex2 = CHART_INFO(ch1, 1, m_nNextPos, delta);
-				break;
+		// a greedy repeat of one char the next can't start with has
+		// nothing useful to give back
+		for(i=0; ! pList->m_brightleft && i+1<list.GetSize(); i++)
+		{
+			CGreedyElx * pGreedy = dynamic_cast <CGreedyElx *> (list[i]);
 
-			/*
-			case RCHART('<'):
-			case RCHART('>'):
-				if(m_nCharsetDepth > 0)
-					nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta);
-				else
-					nex2 = CHART_INFO(ch1, 1, m_nNextPos, delta);
-				break;
-			*/
+			if(pGreedy == 0 || dynamic_cast <CPossessiveElx *> (list[i]) != 0)
+				continue;
 
-			case RCHART('x'):
-				if(m_pattern[m_nNextPos+2] != '{')
-				{
-					int red = 0;
-					unsigned int ch2 = Hex2Int(m_pattern.GetBuffer() + m_nNextPos + 2, 2, red);
+			if( ! IsOneChar(pGreedy->m_pelx) || (LeadingString(list[i+1]) != list[i+1] && ! IsOneChar(list[i+1])) )
+				continue;
 
-					delta += red;
+			if( Overlaps(pGreedy->m_pelx, list[i+1]) )
+				continue;
 
-					if(red > 0)
-						nex2 = CHART_INFO(RCHART(ch2), 0, m_nNextPos, delta);
-					else
-						nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta);
+			CPossessiveElx * pPossessive = (CPossessiveElx *)Keep(new CPossessiveElx(pGreedy->m_pelx, pGreedy->m_nfixed, pGreedy->m_nfixed + pGreedy->m_nvart));
 
-					break;
-				}
+			pPossessive->m_bimplied = 1;
+			list[i] = pPossessive;
+		}
 
-			case RCHART('u'):
-				if(m_pattern[m_nNextPos+2] != '{')
-				{
-					int red = 0;
-					unsigned int ch2 = Hex2Int(m_pattern.GetBuffer() + m_nNextPos + 2, 4, red);
+		return list.GetSize() == 1 ? list[0] : pList;
+	}
 
-					delta += red;
+	if(CAlternativeElx * pAlternative = dynamic_cast <CAlternativeElx *> (pelx))
+	{
+		CBufferT <ElxInterface *> & list = pAlternative->m_elxlist;
 
-					if(red > 0)
-						nex2 = CHART_INFO(RCHART(ch2), 0, m_nNextPos, delta);
-					else
-						nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta);
-				}
-				else
-				{
-					int red = 0;
-					unsigned int ch2 = Hex2Int(m_pattern.GetBuffer() + m_nNextPos + 3, sizeof(int) * 2, red);
+		for(i=0; i<list.GetSize(); i++)
+			list[i] = Optimize(list[i]);
 
-					delta += red;
+		FactorPrefixes(pAlternative);
+		MergeClasses  (pAlternative);
 
-					while(m_nNextPos + delta < m_pattern.GetSize() && m_pattern.At(m_nNextPos + delta) != RCHART('}'))
-						delta ++;
+		return list.GetSize() == 1 ? list[0] : pAlternative;
+	}
 
-					delta ++; // skip '}'
+	// greedy, reluctant and possessive too
+	if(CRepeatElx * pRepeat = dynamic_cast <CRepeatElx *> (pelx))
+	{
+		pRepeat->m_pelx = Optimize(pRepeat->m_pelx);
+		return pRepeat;
+	}
 
-					nex2 = CHART_INFO(RCHART(ch2), 0, m_nNextPos, delta);
-				}
-				break;
+	if(CIndependentElx * pIndependent = dynamic_cast <CIndependentElx *> (pelx))
+	{
+		pIndependent->m_pelx = Optimize(pIndependent->m_pelx);
+		return pIndependent;
+	}
 
-			case RCHART('a'): nex2 = CHART_INFO(RCHART('\a'), 0, m_nNextPos, delta); break;
-			case RCHART('f'): nex2 = CHART_INFO(RCHART('\f'), 0, m_nNextPos, delta); break;
-			case RCHART('n'): nex2 = CHART_INFO(RCHART('\n'), 0, m_nNextPos, delta); break;
-			case RCHART('r'): nex2 = CHART_INFO(RCHART('\r'), 0, m_nNextPos, delta); break;
-			case RCHART('t'): nex2 = CHART_INFO(RCHART('\t'), 0, m_nNextPos, delta); break;
-			case RCHART('v'): nex2 = CHART_INFO(RCHART('\v'), 0, m_nNextPos, delta); break;
-			case RCHART('e'): nex2 = CHART_INFO(RCHART( 27 ), 0, m_nNextPos, delta); break;
+	if(CAssertElx * pAssert = dynamic_cast <CAssertElx *> (pelx))
+	{
+		pAssert->m_pelx = Optimize(pAssert->m_pelx);
+		return pAssert;
+	}
 
-			case RCHART('G'):  // skip '\G'
-				if(m_nCharsetDepth > 0)
-				{
-					m_nNextPos += 2;
-					return 0;
-				}
-				else
-				{
-					nex2 = CHART_INFO(ch1, 1, m_nNextPos, delta);
-					break;
-				}
+	if(CConditionElx * pCondition = dynamic_cast <CConditionElx *> (pelx))
+	{
+		if(pCondition->m_pelxask != 0) pCondition->m_pelxask = Optimize(pCondition->m_pelxask);
+		if(pCondition->m_pelxyes != 0) pCondition->m_pelxyes = Optimize(pCondition->m_pelxyes);
+		if(pCondition->m_pelxno  != 0) pCondition->m_pelxno  = Optimize(pCondition->m_pelxno );
+	}
 
-			case RCHART('L'):
-				if( ! m_quote_fun ) m_quote_fun = ::tolower;
+	return pelx;
+}
 
-			case RCHART('U'):
-				if( ! m_quote_fun ) m_quote_fun = ::toupper;
+//
+// Branches in a row starting with the same literal share it, in the same
+// order: abc|abd|x becomes ab(?:c|d)|x, and on down as a trie
+//
+template <class CHART> void CBuilderT <CHART> :: FactorPrefixes(CAlternativeElx * pAlternative)
+{
+	CBufferT <ElxInterface *> & list = pAlternative->m_elxlist;
+	CBufferT <ElxInterface *> factored;
+	int i = 0, j, k;
 
-			case RCHART('Q'):
-				{
-					m_bQuoted   = 1;
-					m_nNextPos += 2;
-					return 0;
-				}
+	while(i < list.GetSize())
+	{
+		CStringElxT <CHART> * pFirst = LeadingString(list[i]);
+		int nprefix = pFirst != 0 ? pFirst->m_szPattern.GetSize() : 0;
 
-			case RCHART('E'):
-				{
-					m_quote_fun = 0;
-					m_bQuoted   = 0;
-					m_nNextPos += 2;
-					return 0;
-				}
+		// the branches sharing a first char, and what all of them share
+		for(j=i+1; nprefix > 0 && j<list.GetSize(); j++)
+		{
+			CStringElxT <CHART> * pString = LeadingString(list[j]);
 
-			case 0:
-				if(m_nNextPos+1 >= m_pattern.GetSize())
-				{
-					delta = 1;
-					nex2 = CHART_INFO(ch , 0, m_nNextPos, delta);
-				}
-				else
-					nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta); // common '\0' char
+			if(pString == 0 || pString->m_bignorecase != pFirst->m_bignorecase)
 				break;
 
-			default:
-				nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta);
+			for(k=0; k<nprefix && k<pString->m_szPattern.GetSize() && pString->m_szPattern[k] == pFirst->m_szPattern[k]; k++);
+
+			if(k == 0)
 				break;
-			}
+
+			nprefix = k;
 		}
-		break;
 
-	case RCHART('*'):
-	case RCHART('+'):
-	case RCHART('?'):
-	case RCHART('.'):
-	case RCHART('{'):
-	case RCHART('}'):
-	case RCHART(')'):
-	case RCHART('|'):
-	case RCHART('$'):
-		if(m_nCharsetDepth > 0)
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
-		else
-			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
-		break;
+		if(nprefix == 0 || j - i < 2)
+		{
+			factored.Push(list[i ++]);
+			continue;
+		}
 
-	case RCHART('-'):
-		if(m_nCharsetDepth > 0)
-			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
-		else
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
-		break;
+		CAlternativeElx * pRests  = (CAlternativeElx *)Keep(new CAlternativeElx());
+		CListElx        * pShared = (CListElx        *)Keep(new CListElx(0));
 
-	case RCHART('('):
-		{
-			CHART ch1 = m_pattern[m_nNextPos+1];
-			CHART ch2 = m_pattern[m_nNextPos+2];
+		for(; i<j; i++)
+			pRests->m_elxlist.Push(StripPrefix(list[i], nprefix));
 
-			// skip remark
-			if(ch1 == RCHART('?') && ch2 == RCHART('#'))
-			{
-				m_nNextPos += 2;
-				while(m_nNextPos < m_pattern.GetSize())
-				{
-					if(m_pattern[m_nNextPos] == RCHART(')'))
-						break;
+		pShared->m_elxlist.Push(Keep(new CStringElxT <CHART> (pFirst->m_szPattern.GetBuffer(), nprefix, 0, pFirst->m_bignorecase)));
+		pShared->m_elxlist.Push(Optimize(pRests));
 
-					m_nNextPos ++;
-				}
+		factored.Push(pShared);
+	}
 
-				if(m_pattern[m_nNextPos] == RCHART(')'))
-				{
-					m_nNextPos ++;
+	list.Restore(0);
+	list.Append(factored.GetBuffer(), factored.GetSize());
+}
 
-					// get next nex2
-					return 0;
-				}
+//
+// Branches in a row matching one char each become one class: a|[bc]|\d
+// matches the same as [abc\d], without trying the others on failure
+//
+template <class CHART> void CBuilderT <CHART> :: MergeClasses(CAlternativeElx * pAlternative)
+{
+	CBufferT <ElxInterface *> & list = pAlternative->m_elxlist;
+	int i = 0, j, n = 0;
+
+	while(i < list.GetSize())
+	{
+		for(j=i; j<list.GetSize() && IsOneChar(list[j]); j++);
+
+		if(j - i < 2)
+		{
+			list[n++] = list[i++];
+			continue;
+		}
+
+		CRangeElxT <CHART> * pMerged = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 1));
+
+		for(; i<j; i++)
+		{
+			CStringElxT <CHART> * pString = dynamic_cast <CStringElxT <CHART> *> (list[i]);
+			CRangeElxT  <CHART> * pRange  = dynamic_cast <CRangeElxT  <CHART> *> (list[i]);
+
+			if(pString != 0 && ! pString->m_bignorecase)
+			{
+				pMerged->m_chars.Push(pString->m_szPattern[0]);
+			}
+			else if(pRange != 0 && pRange->m_byes)
+			{
+				pMerged->m_ranges.Append(pRange->m_ranges.GetBuffer(), pRange->m_ranges.GetSize());
+				pMerged->m_chars .Append(pRange->m_chars .GetBuffer(), pRange->m_chars .GetSize());
+				pMerged->m_embeds.Append(pRange->m_embeds.GetBuffer(), pRange->m_embeds.GetSize());
 			}
 			else
 			{
-				if(m_nCharsetDepth > 0)
-					nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
-				else
-					nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+				pMerged->m_embeds.Push(list[i]);
 			}
 		}
-		break;
 
-	case RCHART('#'):
-		if(m_nFlags & EXTENDED)
-		{
-			// skip remark
-			m_nNextPos ++;
+		pMerged->Compile();
+		list[n++] = pMerged;
+	}
 
-			while(m_nNextPos < m_pattern.GetSize())
-			{
-				if(m_pattern[m_nNextPos] == RCHART('\n') || m_pattern[m_nNextPos] == RCHART('\r'))
-					break;
+	list.Restore(n);
+}
 
-				m_nNextPos ++;
-			}
+//
+// A branch LeadingString starts, without its first nprefix chars
+//
+template <class CHART> ElxInterface * CBuilderT <CHART> :: StripPrefix(ElxInterface * pelx, int nprefix)
+{
+	CStringElxT <CHART> * pString = LeadingString(pelx);
+	CListElx * pList = dynamic_cast <CListElx *> (pelx);
+	CListElx * pRest = (CListElx *)Keep(new CListElx(0));
 
-			// get next nex2
-			return 0;
-		}
-		else
-		{
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
-		}
-		break;
+	if(pString->m_szPattern.GetSize() > nprefix)
+		pRest->m_elxlist.Push(Keep(new CStringElxT <CHART> (pString->m_szPattern.GetBuffer() + nprefix, pString->m_szPattern.GetSize() - nprefix, 0, pString->m_bignorecase)));
 
-	case RCHART(' '):
-	case RCHART('\f'):
-	case RCHART('\n'):
-	case RCHART('\r'):
-	case RCHART('\t'):
-	case RCHART('\v'):
-		if(m_nFlags & EXTENDED)
-		{
-			m_nNextPos ++;
+	for(int i=1; pList != 0 && i<pList->m_elxlist.GetSize(); i++)
+		pRest->m_elxlist.Push(pList->m_elxlist[i]);
 
-			// get next nex2
+	if(pRest->m_elxlist.GetSize() == 0)
+		return GetStockElx(STOCKELX_EMPTY);
+
+	return pRest->m_elxlist.GetSize() == 1 ? pRest->m_elxlist[0] : pRest;
+}
+
+//
+// The literal pelx starts with, left to right, or 0
+//
+template <class CHART> CStringElxT <CHART> * CBuilderT <CHART> :: LeadingString(ElxInterface * pelx)
+{
+	if(CListElx * pList = dynamic_cast <CListElx *> (pelx))
+	{
+		if(pList->m_brightleft || pList->m_elxlist.GetSize() == 0)
 			return 0;
-		}
-		else
-		{
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
-		}
-		break;
 
-	case RCHART('['):
-		if( m_nCharsetDepth == 0 || m_pattern.At(m_nNextPos + 1, 0) == RCHART(':') )
-		{
-			m_nCharsetDepth ++;
-			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
-		}
-		else
-		{
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
-		}
-		break;
+		pelx = pList->m_elxlist[0];
+	}
 
-	case RCHART(']'):
-		if(m_nCharsetDepth > 0)
-		{
-			m_nCharsetDepth --;
-			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+	CStringElxT <CHART> * pString = dynamic_cast <CStringElxT <CHART> *> (pelx);
+
+	if(pString == 0 || pString->m_brightleft || pString->m_szPattern.GetSize() == 0)
+		return 0;
+
+	return pString;
+}
+
+//
+// Returns 1 if pelx matches exactly one char, left to right
+//
+template <class CHART> int CBuilderT <CHART> :: IsOneChar(ElxInterface * pelx)
+{
+	if(CStringElxT <CHART> * pString = dynamic_cast <CStringElxT <CHART> *> (pelx))
+		return ! pString->m_brightleft && pString->m_szPattern.GetSize() == 1;
+
+	if(CRangeElxT <CHART> * pRange = dynamic_cast <CRangeElxT <CHART> *> (pelx))
+		return ! pRange->m_brightleft;
+
+	if(CPosixElxT <CHART> * pPosix = dynamic_cast <CPosixElxT <CHART> *> (pelx))
+		return ! pPosix->m_brightleft;
+
+	return 0;
+}
+
+//
+// Returns 1 if a char the one-char pbody matches may start pnext
+//
+template <class CHART> int CBuilderT <CHART> :: Overlaps(ElxInterface * pbody, ElxInterface * pnext)
+{
+	CStringElxT <CHART> * pString = LeadingString(pnext);
+	ElxInterface * pother = pbody;
+
+	// a literal on either side has the chars to try
+	if(pString == 0 && (pString = LeadingString(pbody)) != 0)
+		pother = pnext;
+
+	if(pString != 0)
+	{
+		CHART ch = pString->m_szPattern[0];
+
+		if( MatchesChar(pother, ch) )
+			return 1;
+
+		return pString->m_bignorecase && (MatchesChar(pother, (CHART)toupper(ch)) || MatchesChar(pother, (CHART)tolower(ch)));
+	}
+
+	// two classes; wide chars aren't tried
+	if(sizeof(CHART) > 1)
+		return 1;
+
+	for(int i=0; i<256; i++)
+	{
+		if( MatchesChar(pbody, (CHART)i) && MatchesChar(pnext, (CHART)i) )
+			return 1;
+	}
+
+	return 0;
+}
+
+template <class CHART> int CBuilderT <CHART> :: MatchesChar(ElxInterface * pelx, CHART ch)
+{
+	CContext probe;
+
+	probe.m_pMatchString       = &ch;
+	probe.m_pMatchStringLength = 1;
+	probe.m_nBeginPos          = 0;
+	probe.m_nCurrentPos        = 0;
+
+	return pelx->Match(&probe);
+}
+
+//
+// Numbers the repeats whose failures a match may remember. Once a repeat
+// has failed after an iteration ending at some pos, another way to the
+// same pos fails too, provided nothing that may follow reads more than
+// the pos (bstate) and no repeat around it counts or may end on an empty
+// iteration (bcounted).
+//
+template <class CHART> void CBuilderT <CHART> :: Memoize(ElxInterface * pelx, int bstate, int bcounted)
+{
+	int i;
+
+	if(CListElx * pList = dynamic_cast <CListElx *> (pelx))
+	{
+		for(i=pList->m_elxlist.GetSize()-1; i>=0; i--)
+		{
+			Memoize(pList->m_elxlist[i], bstate, bcounted || pList->m_brightleft);
+
+			if( ReadsState(pList->m_elxlist[i]) )
+				bstate = 1;
 		}
-		else
+
+		return;
+	}
+
+	if(CAlternativeElx * pAlternative = dynamic_cast <CAlternativeElx *> (pelx))
+	{
+		for(i=0; i<pAlternative->m_elxlist.GetSize(); i++)
+			Memoize(pAlternative->m_elxlist[i], bstate, bcounted);
+
+		return;
+	}
+
+	// greedy, reluctant and possessive too
+	if(CRepeatElx * pRepeat = dynamic_cast <CRepeatElx *> (pelx))
+	{
+		int nvart = 0;
+
+		if(CGreedyElx * pGreedy = dynamic_cast <CGreedyElx *> (pelx))
+			nvart = pGreedy->m_nvart;
+		else if(CReluctantElx * pReluctant = dynamic_cast <CReluctantElx *> (pelx))
+			nvart = pReluctant->m_nvart;
+
+		int bunbounded = nvart >= INT_MAX - pRepeat->m_nfixed;
+
+		// the body may follow itself
+		if( ReadsState(pRepeat->m_pelx) )
+			bstate = 1;
+
+		// a possessive one never returns to an iteration
+		if( ! bstate && ! bcounted && bunbounded && dynamic_cast <CPossessiveElx *> (pelx) == 0 )
+			pRepeat->m_nmemo = m_nMemoCount ++;
+
+		// a greedy one takes an empty last iteration only after a longer
+		// one failed, so what its body skips would change its result
+		int nmin = 1, nmax = 0;
+
+		if( dynamic_cast <CGreedyElx *> (pelx) != 0 )
+			Lengths(pRepeat->m_pelx, nmin, nmax);
+
+		Memoize(pRepeat->m_pelx, bstate, bcounted || ! bunbounded || pRepeat->m_nfixed > 1 || nmin == 0);
+		return;
+	}
+
+	if(CIndependentElx * pIndependent = dynamic_cast <CIndependentElx *> (pelx))
+	{
+		Memoize(pIndependent->m_pelx, bstate, bcounted);
+		return;
+	}
+
+	if(CAssertElx * pAssert = dynamic_cast <CAssertElx *> (pelx))
+	{
+		Memoize(pAssert->m_pelx, bstate, bcounted);
+		return;
+	}
+
+	if(CConditionElx * pCondition = dynamic_cast <CConditionElx *> (pelx))
+	{
+		if(pCondition->m_pelxask != 0) Memoize(pCondition->m_pelxask, bstate, bcounted);
+		if(pCondition->m_pelxyes != 0) Memoize(pCondition->m_pelxyes, bstate, bcounted);
+		if(pCondition->m_pelxno  != 0) Memoize(pCondition->m_pelxno , bstate, bcounted);
+	}
+}
+
+//
+// Returns 1 if pelx may depend on more than the pos: a backref, a
+// condition, \G or a recursion
+//
+template <class CHART> int CBuilderT <CHART> :: ReadsState(ElxInterface * pelx)
+{
+	int i;
+
+	if(CListElx * pList = dynamic_cast <CListElx *> (pelx))
+	{
+		for(i=0; i<pList->m_elxlist.GetSize(); i++)
 		{
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+			if( ReadsState(pList->m_elxlist[i]) )
+				return 1;
 		}
-		break;
 
-	case RCHART(':'):
-		if(next == CHART_INFO(RCHART('['), 1))
-			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
-		else
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
-		break;
+		return 0;
+	}
 
-	case RCHART('^'):
-		if(m_nCharsetDepth == 0 || next == CHART_INFO(RCHART('['), 1) || (curr == CHART_INFO(RCHART('['), 1) && next == CHART_INFO(RCHART(':'), 1)))
-			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
-		else
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
-		break;
+	if(CAlternativeElx * pAlternative = dynamic_cast <CAlternativeElx *> (pelx))
+	{
+		for(i=0; i<pAlternative->m_elxlist.GetSize(); i++)
+		{
+			if( ReadsState(pAlternative->m_elxlist[i]) )
+				return 1;
+		}
 
-	case 0:
-		if(m_nNextPos >= m_pattern.GetSize())
-			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta); // end of string
-		else
-			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta); // common '\0' char
-		break;
+		return 0;
+	}
 
-	default:
-		nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
-		break;
+	if(CRepeatElx * pRepeat = dynamic_cast <CRepeatElx *> (pelx))
+		return ReadsState(pRepeat->m_pelx);
+
+	if(CIndependentElx * pIndependent = dynamic_cast <CIndependentElx *> (pelx))
+		return ReadsState(pIndependent->m_pelx);
+
+	if(CAssertElx * pAssert = dynamic_cast <CAssertElx *> (pelx))
+		return ReadsState(pAssert->m_pelx);
+
+	return dynamic_cast <CBackrefElx *> (pelx) != 0 || dynamic_cast <CConditionElx *> (pelx) != 0 ||
+		dynamic_cast <CGlobalElx *> (pelx) != 0 || dynamic_cast <CDelegateElx *> (pelx) != 0;
+}
+
+//
+// Returns 1 if every match of pelx begins with \A
+//
+template <class CHART> int CBuilderT <CHART> :: Anchored(ElxInterface * pelx)
+{
+	int i;
+
+	if(CListElx * pList = dynamic_cast <CListElx *> (pelx))
+	{
+		if(pList->m_brightleft)
+			return 0;
+
+		// a group opens with its bracket
+		for(i=0; i<pList->m_elxlist.GetSize(); i++)
+		{
+			if(dynamic_cast <CBracketElx *> (pList->m_elxlist[i]) == 0)
+				return Anchored(pList->m_elxlist[i]);
+		}
+
+		return 0;
 	}
 
-	m_nNextPos += delta;
+	if(CAlternativeElx * pAlternative = dynamic_cast <CAlternativeElx *> (pelx))
+	{
+		for(i=0; i<pAlternative->m_elxlist.GetSize(); i++)
+		{
+			if( ! Anchored(pAlternative->m_elxlist[i]) )
+				return 0;
+		}
 
-	return 1;
+		return pAlternative->m_elxlist.GetSize() > 0;
+	}
+
+	if(CRepeatElx * pRepeat = dynamic_cast <CRepeatElx *> (pelx))
+	{
+		return pRepeat->m_nfixed > 0 && Anchored(pRepeat->m_pelx);
+	}
+
+	if(CIndependentElx * pIndependent = dynamic_cast <CIndependentElx *> (pelx))
+	{
+		return Anchored(pIndependent->m_pelx);
+	}
+
+	if(CBoundaryElxT <CHART> * pBoundary = dynamic_cast <CBoundaryElxT <CHART> *> (pelx))
+	{
+		return pBoundary->m_ntype == BOUNDARY_FILE_BEGIN && pBoundary->m_byes;
+	}
+
+	return 0;
 }
 
-template <class CHART> ElxInterface * CBuilderT <CHART> :: GetStockElx(int nStockId)
+//
+// The fewest and most chars a match of pelx consumes
+//
+template <class CHART> void CBuilderT <CHART> :: Lengths(ElxInterface * pelx, int & nmin, int & nmax)
 {
-	ElxInterface ** pStockElxs = m_pStockElxs;
+	int i, cmin, cmax;
 
-	// check
-	if(nStockId < 0 || nStockId >= STOCKELX_COUNT)
-		return GetStockElx(0);
+	nmin = 0;
+	nmax = 0;
 
-	// create if no
-	if(pStockElxs[nStockId] == 0)
+	if(CListElx * pList = dynamic_cast <CListElx *> (pelx))
 	{
-		switch(nStockId)
+		if(pList->m_brightleft)
 		{
-		case STOCKELX_EMPTY:
-			pStockElxs[nStockId] = Keep(new CEmptyElx());
-			break;
+			nmax = INT_MAX;
+			return;
+		}
+
+		for(i=0; i<pList->m_elxlist.GetSize(); i++)
+		{
+			Lengths(pList->m_elxlist[i], cmin, cmax);
+
+			nmin = cmin < INT_MAX - nmin ? nmin + cmin : INT_MAX;
+			nmax = cmax < INT_MAX - nmax ? nmax + cmax : INT_MAX;
+		}
+
+		return;
+	}
+
+	if(CAlternativeElx * pAlternative = dynamic_cast <CAlternativeElx *> (pelx))
+	{
+		for(i=0; i<pAlternative->m_elxlist.GetSize(); i++)
+		{
+			Lengths(pAlternative->m_elxlist[i], cmin, cmax);
+
+			if(i == 0 || cmin < nmin) nmin = cmin;
+			if(cmax > nmax) nmax = cmax;
+		}
+
+		return;
+	}
+
+	// greedy, reluctant and possessive too
+	if(CRepeatElx * pRepeat = dynamic_cast <CRepeatElx *> (pelx))
+	{
+		int nvart = 0;
+
+		if(CGreedyElx * pGreedy = dynamic_cast <CGreedyElx *> (pelx))
+			nvart = pGreedy->m_nvart;
+		else if(CReluctantElx * pReluctant = dynamic_cast <CReluctantElx *> (pelx))
+			nvart = pReluctant->m_nvart;
+
+		int ntimes = nvart < INT_MAX - pRepeat->m_nfixed ? pRepeat->m_nfixed + nvart : INT_MAX;
+
+		Lengths(pRepeat->m_pelx, cmin, cmax);
+
+		nmin = cmin == 0 || pRepeat->m_nfixed <= INT_MAX / cmin ? pRepeat->m_nfixed * cmin : INT_MAX;
+		nmax = cmax == 0 || ntimes == 0 ? 0 : ntimes < INT_MAX && cmax <= INT_MAX / ntimes ? ntimes * cmax : INT_MAX;
+		return;
+	}
+
+	if(CIndependentElx * pIndependent = dynamic_cast <CIndependentElx *> (pelx))
+	{
+		Lengths(pIndependent->m_pelx, nmin, nmax);
+		return;
+	}
+
+	if(CConditionElx * pCondition = dynamic_cast <CConditionElx *> (pelx))
+	{
+		if(pCondition->m_pelxyes != 0) Lengths(pCondition->m_pelxyes, nmin, nmax);
+		if(pCondition->m_pelxno  != 0) Lengths(pCondition->m_pelxno , cmin, cmax);
+		else cmin = cmax = 0;
+
+		if(cmin < nmin) nmin = cmin;
+		if(cmax > nmax) nmax = cmax;
+		return;
+	}
+
+	if(CStringElxT <CHART> * pString = dynamic_cast <CStringElxT <CHART> *> (pelx))
+	{
+		nmin = nmax = pString->m_szPattern.GetSize();
+		return;
+	}
+
+	if(dynamic_cast <CRangeElxT <CHART> *> (pelx) != 0 || dynamic_cast <CPosixElxT <CHART> *> (pelx) != 0)
+	{
+		nmin = nmax = 1;
+		return;
+	}
+
+	// zero width
+	if( dynamic_cast <CBracketElx *> (pelx) != 0 || dynamic_cast <CBoundaryElxT <CHART> *> (pelx) != 0 ||
+		dynamic_cast <CGlobalElx *> (pelx) != 0 || dynamic_cast <CEmptyElx *> (pelx) != 0 || dynamic_cast <CAssertElx *> (pelx) != 0
+	)
+	{
+		return;
+	}
+
+	// backref, recursive
+	nmax = INT_MAX;
+}
+
+//
+// The first pos from start where a match may begin, -1 if none
+//
+template <class CHART> int CBuilderT <CHART> :: FindCandidate(const CHART * tstring, int length, int start) const
+{
+	int nprefix = m_prefix.GetSize();
+
+	// only pos 0, or too near the end for the shortest match
+	if( (m_bAnchored && start > 0) || length - start < m_nMinLength )
+		return -1;
+
+	if(nprefix > 0)
+	{
+		CHART first = m_prefix[0];
+		const CHART * p = tstring + start, * last = tstring + length - (nprefix > m_nMinLength ? nprefix : m_nMinLength);
+
+		while(p <= last)
+		{
+			// memchr is vectorized by the C library
+			if(sizeof(CHART) == 1)
+			{
+				p = (const CHART *)memchr(p, (unsigned char)first, last - p + 1);
+				if(p == 0) break;
+			}
+			else if(*p != first)
+			{
+				p ++;
+				continue;
+			}
+
+			if( ! m_prefix.nCompare(p) )
+				return (int)(p - tstring);
+
+			p ++;
+		}
+
+		return -1;
+	}
+
+	if(m_bFirstAny)
+		return start;
+
+	int nlast = length - (m_nMinLength > 1 ? m_nMinLength : 1);
+
+	for(int i=start; i<=nlast; i++)
+	{
+		CHART ch = tstring[i];
+
+		if(sizeof(CHART) > 1 && (ch & ~(CHART)0xff) != 0)
+		{
+			if(m_bFirstWide) return i;
+		}
+		else if(m_firstchars[(unsigned char)ch >> 3] & (1 << (ch & 7)))
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+template <class CHART> void CBuilderT <CHART> :: Clear()
+{
+	for(int i=0; i<m_objlist.GetSize(); i++)
+	{
+		delete m_objlist[i];
+	}
+
+	m_objlist.Restore(0);
+	m_pTopElx = 0;
+	m_nMaxNumber = 0;
+	m_nMemoCount = 0;
+
+	m_prefix.Restore(0);
+	m_bFirstAny = 1;
+
+	m_bAnchored  = 0;
+	m_nMinLength = 0;
+	m_nMaxLength = INT_MAX;
+
+	memset(m_pStockElxs, 0, sizeof(m_pStockElxs));
+}
+
+//
+// hex to int
+//
+template <class CHART> unsigned int CBuilderT <CHART> :: Hex2Int(const CHART * pcsz, int length, int & used)
+{
+	unsigned int result = 0;
+	int & i = used;
+
+	for(i=0; i<length; i++)
+	{
+		if(pcsz[i] >= RCHART('0') && pcsz[i] <= RCHART('9'))
+			result = (result << 4) + (pcsz[i] - RCHART('0'));
+		else if(pcsz[i] >= RCHART('A') && pcsz[i] <= RCHART('F'))
+			result = (result << 4) + (0x0A + (pcsz[i] - RCHART('A')));
+		else if(pcsz[i] >= RCHART('a') && pcsz[i] <= RCHART('f'))
+			result = (result << 4) + (0x0A + (pcsz[i] - RCHART('a')));
+		else
+			break;
+	}
+
+	return result;
+}
+
+template <class CHART> inline ElxInterface * CBuilderT <CHART> :: Keep(ElxInterface * pelx)
+{
+	m_objlist.Push(pelx);
+	return pelx;
+}
+
+template <class CHART> void CBuilderT <CHART> :: MoveNext()
+{
+	// forwards
+	prev = curr;
+	curr = next;
+	next = nex2;
+
+	// get nex2
+	while( ! GetNext2() ) {};
+}
+
+template <class CHART> int CBuilderT <CHART> :: GetNext2()
+{
+	// check length
+	if(m_nNextPos >= m_pattern.GetSize())
+	{
+		nex2 = CHART_INFO(0, 1, m_nNextPos, 0);
+		return 1;
+	}
+
+	int   delta = 1;
+	CHART ch    = m_pattern[m_nNextPos];
+
+	// if quoted
+	if(m_bQuoted)
+	{
+		if(ch == RCHART('\\'))
+		{
+			if(m_pattern[m_nNextPos + 1] == RCHART('E'))
+			{
+				m_quote_fun = 0;
+				m_bQuoted   = 0;
+				m_nNextPos += 2;
+				return 0;
+			}
+		}
+
+		if(m_quote_fun != 0)
+			nex2 = CHART_INFO((CHART)(*m_quote_fun)((int)ch), 0, m_nNextPos, delta);
+		else
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+
+		m_nNextPos += delta;
+
+		return 1;
+	}
+
+	// common
+	switch(ch)
+	{
+	case RCHART('\\'):
+		{
+			CHART ch1 = m_pattern[m_nNextPos+1];
+
+			// backref
+			if(ch1 >= RCHART('0') && ch1 <= RCHART('9'))
+			{
+				nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+				break;
+			}
+
+			// escape
+			delta     = 2;
+
+			switch(ch1)
+			{
+			case RCHART('A'):
+			case RCHART('Z'):
+			case RCHART('z'):
+			case RCHART('w'):
+			case RCHART('W'):
+			case RCHART('s'):
+			case RCHART('S'):
+			case RCHART('B'):
+			case RCHART('d'):
+			case RCHART('D'):
+			case RCHART('k'):
+			case RCHART('g'):
+				nex2 = CHART_INFO(ch1, 1, m_nNextPos, delta);
+				break;
+
+			case RCHART('b'):
+				if(m_nCharsetDepth > 0)
+					nex2 = CHART_INFO('\b', 0, m_nNextPos, delta);
+				else
+					nex2 = CHART_INFO(ch1, 1, m_nNextPos, delta);
+				break;
+
+			/*
+			case RCHART('<'):
+			case RCHART('>'):
+				if(m_nCharsetDepth > 0)
+					nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta);
+				else
+					nex2 = CHART_INFO(ch1, 1, m_nNextPos, delta);
+				break;
+			*/
+
+			case RCHART('x'):
+				if(m_pattern[m_nNextPos+2] != '{')
+				{
+					int red = 0;
+					unsigned int ch2 = Hex2Int(m_pattern.GetBuffer() + m_nNextPos + 2, 2, red);
+
+					delta += red;
+
+					if(red > 0)
+						nex2 = CHART_INFO(RCHART(ch2), 0, m_nNextPos, delta);
+					else
+						nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta);
+
+					break;
+				}
+
+			case RCHART('u'):
+				if(m_pattern[m_nNextPos+2] != '{')
+				{
+					int red = 0;
+					unsigned int ch2 = Hex2Int(m_pattern.GetBuffer() + m_nNextPos + 2, 4, red);
+
+					delta += red;
+
+					if(red > 0)
+						nex2 = CHART_INFO(RCHART(ch2), 0, m_nNextPos, delta);
+					else
+						nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta);
+				}
+				else
+				{
+					int red = 0;
+					unsigned int ch2 = Hex2Int(m_pattern.GetBuffer() + m_nNextPos + 3, sizeof(int) * 2, red);
+
+					delta += red;
+
+					while(m_nNextPos + delta < m_pattern.GetSize() && m_pattern.At(m_nNextPos + delta) != RCHART('}'))
+						delta ++;
+
+					delta ++; // skip '}'
+
+					nex2 = CHART_INFO(RCHART(ch2), 0, m_nNextPos, delta);
+				}
+				break;
+
+			case RCHART('a'): nex2 = CHART_INFO(RCHART('\a'), 0, m_nNextPos, delta); break;
+			case RCHART('f'): nex2 = CHART_INFO(RCHART('\f'), 0, m_nNextPos, delta); break;
+			case RCHART('n'): nex2 = CHART_INFO(RCHART('\n'), 0, m_nNextPos, delta); break;
+			case RCHART('r'): nex2 = CHART_INFO(RCHART('\r'), 0, m_nNextPos, delta); break;
+			case RCHART('t'): nex2 = CHART_INFO(RCHART('\t'), 0, m_nNextPos, delta); break;
+			case RCHART('v'): nex2 = CHART_INFO(RCHART('\v'), 0, m_nNextPos, delta); break;
+			case RCHART('e'): nex2 = CHART_INFO(RCHART( 27 ), 0, m_nNextPos, delta); break;
+
+			case RCHART('G'):  // skip '\G'
+				if(m_nCharsetDepth > 0)
+				{
+					m_nNextPos += 2;
+					return 0;
+				}
+				else
+				{
+					nex2 = CHART_INFO(ch1, 1, m_nNextPos, delta);
+					break;
+				}
+
+			case RCHART('L'):
+				if( ! m_quote_fun ) m_quote_fun = ::tolower;
+
+			case RCHART('U'):
+				if( ! m_quote_fun ) m_quote_fun = ::toupper;
+
+			case RCHART('Q'):
+				{
+					m_bQuoted   = 1;
+					m_nNextPos += 2;
+					return 0;
+				}
+
+			case RCHART('E'):
+				{
+					m_quote_fun = 0;
+					m_bQuoted   = 0;
+					m_nNextPos += 2;
+					return 0;
+				}
+
+			case 0:
+				if(m_nNextPos+1 >= m_pattern.GetSize())
+				{
+					delta = 1;
+					nex2 = CHART_INFO(ch , 0, m_nNextPos, delta);
+				}
+				else
+					nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta); // common '\0' char
+				break;
+
+			default:
+				nex2 = CHART_INFO(ch1, 0, m_nNextPos, delta);
+				break;
+			}
+		}
+		break;
+
+	case RCHART('*'):
+	case RCHART('+'):
+	case RCHART('?'):
+	case RCHART('.'):
+	case RCHART('{'):
+	case RCHART('}'):
+	case RCHART(')'):
+	case RCHART('|'):
+	case RCHART('$'):
+		if(m_nCharsetDepth > 0)
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		else
+			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+		break;
+
+	case RCHART('-'):
+		if(m_nCharsetDepth > 0)
+			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+		else
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		break;
+
+	case RCHART('('):
+		{
+			CHART ch1 = m_pattern[m_nNextPos+1];
+			CHART ch2 = m_pattern[m_nNextPos+2];
+
+			// skip remark
+			if(ch1 == RCHART('?') && ch2 == RCHART('#'))
+			{
+				m_nNextPos += 2;
+				while(m_nNextPos < m_pattern.GetSize())
+				{
+					if(m_pattern[m_nNextPos] == RCHART(')'))
+						break;
+
+					m_nNextPos ++;
+				}
+
+				if(m_pattern[m_nNextPos] == RCHART(')'))
+				{
+					m_nNextPos ++;
+
+					// get next nex2
+					return 0;
+				}
+			}
+			else
+			{
+				if(m_nCharsetDepth > 0)
+					nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+				else
+					nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+			}
+		}
+		break;
+
+	case RCHART('#'):
+		if(m_nFlags & EXTENDED)
+		{
+			// skip remark
+			m_nNextPos ++;
+
+			while(m_nNextPos < m_pattern.GetSize())
+			{
+				if(m_pattern[m_nNextPos] == RCHART('\n') || m_pattern[m_nNextPos] == RCHART('\r'))
+					break;
+
+				m_nNextPos ++;
+			}
+
+			// get next nex2
+			return 0;
+		}
+		else
+		{
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		}
+		break;
+
+	case RCHART(' '):
+	case RCHART('\f'):
+	case RCHART('\n'):
+	case RCHART('\r'):
+	case RCHART('\t'):
+	case RCHART('\v'):
+		if(m_nFlags & EXTENDED)
+		{
+			m_nNextPos ++;
+
+			// get next nex2
+			return 0;
+		}
+		else
+		{
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		}
+		break;
+
+	case RCHART('['):
+		if( m_nCharsetDepth == 0 || m_pattern.At(m_nNextPos + 1, 0) == RCHART(':') )
+		{
+			m_nCharsetDepth ++;
+			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+		}
+		else
+		{
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		}
+		break;
+
+	case RCHART(']'):
+		if(m_nCharsetDepth > 0)
+		{
+			m_nCharsetDepth --;
+			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+		}
+		else
+		{
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		}
+		break;
+
+	case RCHART(':'):
+		if(next == CHART_INFO(RCHART('['), 1))
+			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+		else
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		break;
+
+	case RCHART('^'):
+		if(m_nCharsetDepth == 0 || next == CHART_INFO(RCHART('['), 1) || (curr == CHART_INFO(RCHART('['), 1) && next == CHART_INFO(RCHART(':'), 1)))
+			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta);
+		else
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		break;
+
+	case 0:
+		if(m_nNextPos >= m_pattern.GetSize())
+			nex2 = CHART_INFO(ch, 1, m_nNextPos, delta); // end of string
+		else
+			nex2 = CHART_INFO(ch, 0, m_nNextPos, delta); // common '\0' char
+		break;
+
+	default:
+		nex2 = CHART_INFO(ch, 0, m_nNextPos, delta);
+		break;
+	}
+
+	m_nNextPos += delta;
+
+	return 1;
+}
+
+template <class CHART> ElxInterface * CBuilderT <CHART> :: GetStockElx(int nStockId)
+{
+	ElxInterface ** pStockElxs = m_pStockElxs;
+
+	// check
+	if(nStockId < 0 || nStockId >= STOCKELX_COUNT)
+		return GetStockElx(0);
+
+	// create if no
+	if(pStockElxs[nStockId] == 0)
+	{
+		switch(nStockId)
+		{
+		case STOCKELX_EMPTY:
+			pStockElxs[nStockId] = Keep(new CEmptyElx());
+			break;
+
+		case STOCKELX_WORD:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 1));
+
+				pRange->m_ranges.Push(RCHART('A')); pRange->m_ranges.Push(RCHART('Z'));
+				pRange->m_ranges.Push(RCHART('a')); pRange->m_ranges.Push(RCHART('z'));
+				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+				pRange->m_chars .Push(RCHART('_'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_WORD_NOT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 0));
+
+				pRange->m_ranges.Push(RCHART('A')); pRange->m_ranges.Push(RCHART('Z'));
+				pRange->m_ranges.Push(RCHART('a')); pRange->m_ranges.Push(RCHART('z'));
+				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+				pRange->m_chars .Push(RCHART('_'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_DOT_ALL:
+			pStockElxs[nStockId] = Keep(new CRangeElxT <CHART> (0, 0));
+			break;
+
+		case STOCKELX_DOT_NOT_ALL:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 0));
+
+				pRange->m_chars .Push(RCHART('\n'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_SPACE:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 1));
+
+				pRange->m_chars .Push(RCHART(' '));
+				pRange->m_chars .Push(RCHART('\t'));
+				pRange->m_chars .Push(RCHART('\r'));
+				pRange->m_chars .Push(RCHART('\n'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_SPACE_NOT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 0));
+
+				pRange->m_chars .Push(RCHART(' '));
+				pRange->m_chars .Push(RCHART('\t'));
+				pRange->m_chars .Push(RCHART('\r'));
+				pRange->m_chars .Push(RCHART('\n'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_DIGITAL:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 1));
+
+				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_DIGITAL_NOT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 0));
+
+				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_WORD_RIGHTLEFT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 1));
+
+				pRange->m_ranges.Push(RCHART('A')); pRange->m_ranges.Push(RCHART('Z'));
+				pRange->m_ranges.Push(RCHART('a')); pRange->m_ranges.Push(RCHART('z'));
+				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+				pRange->m_chars .Push(RCHART('_'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_WORD_RIGHTLEFT_NOT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 0));
+
+				pRange->m_ranges.Push(RCHART('A')); pRange->m_ranges.Push(RCHART('Z'));
+				pRange->m_ranges.Push(RCHART('a')); pRange->m_ranges.Push(RCHART('z'));
+				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+				pRange->m_chars .Push(RCHART('_'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_DOT_ALL_RIGHTLEFT:
+			pStockElxs[nStockId] = Keep(new CRangeElxT <CHART> (1, 0));
+			break;
+
+		case STOCKELX_DOT_NOT_ALL_RIGHTLEFT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 0));
+
+				pRange->m_chars .Push(RCHART('\n'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_SPACE_RIGHTLEFT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 1));
+
+				pRange->m_chars .Push(RCHART(' '));
+				pRange->m_chars .Push(RCHART('\t'));
+				pRange->m_chars .Push(RCHART('\r'));
+				pRange->m_chars .Push(RCHART('\n'));
+				pRange->m_chars .Push(RCHART('\f'));
+				pRange->m_chars .Push(RCHART('\v'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_SPACE_RIGHTLEFT_NOT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 0));
+
+				pRange->m_chars .Push(RCHART(' '));
+				pRange->m_chars .Push(RCHART('\t'));
+				pRange->m_chars .Push(RCHART('\r'));
+				pRange->m_chars .Push(RCHART('\n'));
+				pRange->m_chars .Push(RCHART('\f'));
+				pRange->m_chars .Push(RCHART('\v'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_DIGITAL_RIGHTLEFT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 1));
+
+				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+
+		case STOCKELX_DIGITAL_RIGHTLEFT_NOT:
+			{
+				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 0));
+
+				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+
+				pStockElxs[nStockId] = pRange;
+			}
+			break;
+		}
+
+		if(nStockId != STOCKELX_EMPTY)
+			((CRangeElxT <CHART> *)pStockElxs[nStockId])->Compile();
+	}
+
+	// return
+	return pStockElxs[nStockId];
+}
+
+template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildAlternative(int vaflags)
+{
+	if(curr == CHART_INFO(0, 1))
+		return GetStockElx(STOCKELX_EMPTY);
+
+	// flag instance
+	int flags = vaflags;
+
+	// first part
+	ElxInterface * pAlternativeOne = BuildList(flags);
+
+	// check alternative
+	if(curr == CHART_INFO(RCHART('|'), 1))
+	{
+		CAlternativeElx * pAlternative = (CAlternativeElx *)Keep(new CAlternativeElx());
+		pAlternative->m_elxlist.Push(pAlternativeOne);
+
+		// loop
+		while(curr == CHART_INFO(RCHART('|'), 1))
+		{
+			// skip '|' itself
+			MoveNext();
+
+			pAlternativeOne = BuildList(flags);
+			pAlternative->m_elxlist.Push(pAlternativeOne);
+		}
+
+		return pAlternative;
+	}
+
+	return pAlternativeOne;
+}
+
+template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildList(int & flags)
+{
+	if(curr == CHART_INFO(0, 1) || curr == CHART_INFO(RCHART('|'), 1) || curr == CHART_INFO(RCHART(')'), 1))
+		return GetStockElx(STOCKELX_EMPTY);
+
+	// first
+	ElxInterface * pListOne = BuildRepeat(flags);
+
+	if(curr != CHART_INFO(0, 1) && curr != CHART_INFO(RCHART('|'), 1) && curr != CHART_INFO(RCHART(')'), 1))
+	{
+		CListElx * pList = (CListElx *)Keep(new CListElx(flags & RIGHTTOLEFT));
+		pList->m_elxlist.Push(pListOne);
+
+		while(curr != CHART_INFO(0, 1) && curr != CHART_INFO(RCHART('|'), 1) && curr != CHART_INFO(RCHART(')'), 1))
+		{
+			pListOne = BuildRepeat(flags);
+
+			// add
+			pList->m_elxlist.Push(pListOne);
+		}
+
+		return pList;
+	}
+
+	return pListOne;
+}
+
+template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildRepeat(int & flags)
+{
+	// simple
+	ElxInterface * pSimple = BuildSimple(flags);
+
+	if(curr.type == 0) return pSimple;
+
+	// is quantifier or not
+	int bIsQuantifier = 1;
+
+	// quantifier range
+	unsigned int nMin = 0, nMax = 0;
+
+	switch(curr.ch)
+	{
+	case RCHART('{'):
+		{
+			CBufferT <char> re;
+
+			// skip '{'
+			MoveNext();
+
+			// copy
+			while(curr != CHART_INFO(0, 1) && curr != CHART_INFO(RCHART('}'), 1))
+			{
+				re.Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
+				MoveNext();
+			}
+
+			// skip '}'
+			MoveNext();
+
+			// read
+			int red;
+			char * str = re.GetBuffer();
+
+			if( ! ReadDec(str, nMin) )
+				red = 0;
+			else if( *str != ',' )
+				red = 1;
+			else
+			{
+				str ++;
+
+				if( ! ReadDec(str, nMax) )
+					red = 2;
+				else
+					red = 3;
+			}
+
+			// check
+			if(red  <=  1 ) nMax = nMin;
+			if(red  ==  2 ) nMax = INT_MAX;
+			if(nMax < nMin) nMax = nMin;
+		}
+		break;
+
+	case RCHART('?'):
+		nMin = 0;
+		nMax = 1;
+
+		// skip '?'
+		MoveNext();
+		break;
+
+	case RCHART('*'):
+		nMin = 0;
+		nMax = INT_MAX;
+
+		// skip '*'
+		MoveNext();
+		break;
+
+	case RCHART('+'):
+		nMin = 1;
+		nMax = INT_MAX;
+
+		// skip '+'
+		MoveNext();
+		break;
+
+	default:
+		bIsQuantifier = 0;
+		break;
+	}
+
+	// do quantify
+	if(bIsQuantifier)
+	{
+		// 0 times
+		if(nMax == 0)
+			return GetStockElx(STOCKELX_EMPTY);
+
+		// fixed times
+		if(nMin == nMax)
+		{
+			if(curr == CHART_INFO(RCHART('?'), 1) || curr == CHART_INFO(RCHART('+'), 1))
+				MoveNext();
+
+			return Keep(new CRepeatElx(pSimple, nMin));
+		}
+
+		// range times
+		if(curr == CHART_INFO(RCHART('?'), 1))
+		{
+			MoveNext();
+			return Keep(new CReluctantElx(pSimple, nMin, nMax));
+		}
+		else if(curr == CHART_INFO(RCHART('+'), 1))
+		{
+			MoveNext();
+			return Keep(new CPossessiveElx(pSimple, nMin, nMax));
+		}
+		else
+		{
+			return Keep(new CGreedyElx(pSimple, nMin, nMax));
+		}
+	}
+
+	return pSimple;
+}
+
+template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildSimple(int & flags)
+{
+	CBufferT <CHART> fixed;
+
+	while(curr != CHART_INFO(0, 1))
+	{
+		if(curr.type == 0)
+		{
+			if(next == CHART_INFO(RCHART('{'), 1) || next == CHART_INFO(RCHART('?'), 1) || next == CHART_INFO(RCHART('*'), 1) || next == CHART_INFO(RCHART('+'), 1))
+			{
+				if(fixed.GetSize() == 0)
+				{
+					fixed.Append(curr.ch, 1);
+					MoveNext();
+				}
+
+				break;
+			}
+			else
+			{
+				fixed.Append(curr.ch, 1);
+				MoveNext();
+			}
+		}
+		else if(curr.type == 1)
+		{
+			CHART vch = curr.ch;
+
+			// end of simple
+			if(vch == RCHART(')') || vch == RCHART('|'))
+				break;
+
+			// has fixed already
+			if(fixed.GetSize() > 0)
+				break;
+
+			// left parentheses
+			if(vch == RCHART('('))
+			{
+				return BuildRecursive(flags);
+			}
+
+			// char set
+			if( vch == RCHART('[') || vch == RCHART('.') || vch == RCHART('w') || vch == RCHART('W') ||
+				vch == RCHART('s') || vch == RCHART('S') || vch == RCHART('d') || vch == RCHART('D')
+			)
+			{
+				return BuildCharset(flags);
+			}
+
+			// boundary
+			if( vch == RCHART('^') || vch == RCHART('$') || vch == RCHART('A') || vch == RCHART('Z') || vch == RCHART('z') ||
+				vch == RCHART('b') || vch == RCHART('B') || vch == RCHART('G') // vch == RCHART('<') || vch == RCHART('>')
+			)
+			{
+				return BuildBoundary(flags);
+			}
+
+			// backref
+			if(vch == RCHART('\\') || vch == RCHART('k') || vch == RCHART('g'))
+			{
+				return BuildBackref(flags);
+			}
+
+			// treat vchar as char
+			fixed.Append(curr.ch, 1);
+			MoveNext();
+		}
+	}
+
+	if(fixed.GetSize() > 0)
+		return Keep(new CStringElxT <CHART> (fixed.GetBuffer(), fixed.GetSize(), flags & RIGHTTOLEFT, flags & IGNORECASE));
+	else
+		return GetStockElx(STOCKELX_EMPTY);
+}
+
+#define max(a, b)  (((a) > (b)) ? (a) : (b))
+#define min(a, b)  (((a) < (b)) ? (a) : (b))
+
+template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildCharset(int & flags)
+{
+	// char
+	CHART ch = curr.ch;
+
+	// skip
+	MoveNext();
+
+	switch(ch)
+	{
+	case RCHART('.'):
+		return GetStockElx(
+			flags & RIGHTTOLEFT ?
+			((flags & SINGLELINE) ? STOCKELX_DOT_ALL_RIGHTLEFT : STOCKELX_DOT_NOT_ALL_RIGHTLEFT) :
+			((flags & SINGLELINE) ? STOCKELX_DOT_ALL : STOCKELX_DOT_NOT_ALL)
+		);
+
+	case RCHART('w'):
+		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_WORD_RIGHTLEFT : STOCKELX_WORD);
+
+	case RCHART('W'):
+		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_WORD_RIGHTLEFT_NOT : STOCKELX_WORD_NOT);
+
+	case RCHART('s'):
+		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_SPACE_RIGHTLEFT : STOCKELX_SPACE);
+
+	case RCHART('S'):
+		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_SPACE_RIGHTLEFT_NOT : STOCKELX_SPACE_NOT);
+
+	case RCHART('d'):
+		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_DIGITAL_RIGHTLEFT : STOCKELX_DIGITAL);
+
+	case RCHART('D'):
+		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_DIGITAL_RIGHTLEFT_NOT : STOCKELX_DIGITAL_NOT);
+
+	case RCHART('['):
+		{
+			CRangeElxT <CHART> * pRange;
+
+			// create
+			if(curr == CHART_INFO(RCHART(':'), 1))
+			{
+				CBufferT <char> posix;
+
+				do {
+					posix.Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
+					MoveNext();
+				}
+				while(curr.ch != RCHART(0) && curr != CHART_INFO(RCHART(']'), 1));
+
+				MoveNext(); // skip ']'
+
+				// posix
+				return Keep(new CPosixElxT <CHART> (posix.GetBuffer(), flags & RIGHTTOLEFT));
+			}
+			else if(curr == CHART_INFO(RCHART('^'), 1))
+			{
+				MoveNext(); // skip '^'
+				pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (flags & RIGHTTOLEFT, 0));
+			}
+			else
+			{
+				pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (flags & RIGHTTOLEFT, 1));
+			}
+
+			// parse
+			while(curr != CHART_INFO(0, 1) && curr != CHART_INFO(RCHART(']'), 1))
+			{
+				ch = curr.ch;
+
+				if(curr.type == 1 && (
+					ch == RCHART('.') || ch == RCHART('w') || ch == RCHART('W') || ch == RCHART('s') || ch == RCHART('S') || ch == RCHART('d') || ch == RCHART('D') ||
+					(ch == RCHART('[') && next == CHART_INFO(RCHART(':'), 1))
+				))
+				{
+					pRange->m_embeds.Push(BuildCharset(flags));
+				}
+				else if(next == CHART_INFO(RCHART('-'), 1) && nex2.type == 0)
+				{
+					pRange->m_ranges.Push(ch); pRange->m_ranges.Push(nex2.ch);
+
+					// next
+					MoveNext();
+					MoveNext();
+					MoveNext();
+				}
+				else
+				{
+					pRange->m_chars.Push(ch);
+
+					// next
+					MoveNext();
+				}
+			}
+
+			// skip ']'
+			MoveNext();
+
+			if( flags & IGNORECASE )
+			{
+				CBufferT <CHART> & ranges = pRange->m_ranges;
+				int i, oldcount = ranges.GetSize() / 2;
+
+				for(i=0; i<oldcount; i++)
+				{
+					CHART newmin, newmax;
+
+					if( ranges[i*2] <= RCHART('Z') && ranges[i*2+1] >= RCHART('A') )
+					{
+						newmin = tolower( max(RCHART('A'), ranges[i*2  ]) );
+						newmax = tolower( min(RCHART('Z'), ranges[i*2+1]) );
+
+						if( newmin < ranges[i*2] || newmax > ranges[i*2+1] )
+						{
+							ranges.Push(newmin);
+							ranges.Push(newmax);
+						}
+					}
+
+					if( ranges[i*2] <= RCHART('z') && ranges[i*2+1] >= RCHART('a') )
+					{
+						newmin = toupper( max(RCHART('a'), ranges[i*2  ]) );
+						newmax = toupper( min(RCHART('z'), ranges[i*2+1]) );
+
+						if( newmin < ranges[i*2] || newmax > ranges[i*2+1] )
+						{
+							ranges.Push(newmin);
+							ranges.Push(newmax);
+						}
+					}
+				}
+
+				CBufferT <CHART> & chars = pRange->m_chars;
+				oldcount = chars.GetSize();
+				for(i=0; i<oldcount; i++)
+				{
+					if( isupper(chars[i]) && ! pRange->IsContainChar(tolower(chars[i])) )
+						chars.Push(tolower(chars[i]));
+
+					if( islower(chars[i]) && ! pRange->IsContainChar(toupper(chars[i])) )
+						chars.Push(toupper(chars[i]));
+				}
+			}
+
+			pRange->Compile();
+
+			return pRange;
+		}
+	}
+
+	return GetStockElx(STOCKELX_EMPTY);
+}
+
+template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildRecursive(int & flags)
+{
+	// skip '('
+	MoveNext();
+
+	if(curr == CHART_INFO(RCHART('?'), 1))
+	{
+		ElxInterface * pElx = 0;
 
-		case STOCKELX_WORD:
-			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 1));
+		// skip '?'
+		MoveNext();
 
-				pRange->m_ranges.Push(RCHART('A')); pRange->m_ranges.Push(RCHART('Z'));
-				pRange->m_ranges.Push(RCHART('a')); pRange->m_ranges.Push(RCHART('z'));
-				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
-				pRange->m_chars .Push(RCHART('_'));
+		int bNegative = 0;
+		CHART named_end = RCHART('>');
 
-				pStockElxs[nStockId] = pRange;
+		switch(curr.ch)
+		{
+		case RCHART('!'):
+			bNegative = 1;
+
+		case RCHART('='):
+			{
+				MoveNext(); // skip '!' or '='
+				pElx = Keep(new CAssertElx(BuildAlternative(flags & ~RIGHTTOLEFT), !bNegative));
 			}
 			break;
 
-		case STOCKELX_WORD_NOT:
+		case RCHART('<'):
+			switch(next.ch)
 			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 0));
+			case RCHART('!'):
+				bNegative = 1;
 
-				pRange->m_ranges.Push(RCHART('A')); pRange->m_ranges.Push(RCHART('Z'));
-				pRange->m_ranges.Push(RCHART('a')); pRange->m_ranges.Push(RCHART('z'));
-				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
-				pRange->m_chars .Push(RCHART('_'));
+			case RCHART('='):
+				MoveNext(); // skip '<'
+				MoveNext(); // skip '!' or '='
+				{
+					pElx = Keep(new CAssertElx(BuildAlternative(flags | RIGHTTOLEFT), !bNegative));
+				}
+				break;
 
-				pStockElxs[nStockId] = pRange;
+			default: // named group
+				break;
 			}
-			break;
+			// break if assertion // else named
+			if(pElx != 0) break;
 
-		case STOCKELX_DOT_ALL:
-			pStockElxs[nStockId] = Keep(new CRangeElxT <CHART> (0, 0));
-			break;
+		case RCHART('P'):
+			if(curr.ch == RCHART('P')) MoveNext(); // skip 'P'
 
-		case STOCKELX_DOT_NOT_ALL:
+		case RCHART('\''):
+			if     (curr.ch == RCHART('<' )) named_end = RCHART('>' );
+			else if(curr.ch == RCHART('\'')) named_end = RCHART('\'');
+			MoveNext(); // skip '<' or '\''
 			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 0));
+				// named number
+				int nThisBackref = m_nNextNamed ++;
 
-				pRange->m_chars .Push(RCHART('\n'));
+				CListElx    * pList  = (CListElx    *)Keep(new CListElx(flags & RIGHTTOLEFT));
+				CBracketElx * pleft  = (CBracketElx *)Keep(new CBracketElx(-1, flags & RIGHTTOLEFT ? 1 : 0));
+				CBracketElx * pright = (CBracketElx *)Keep(new CBracketElx(-1, flags & RIGHTTOLEFT ? 0 : 1));
 
-				pStockElxs[nStockId] = pRange;
-			}
-			break;
+				// save name
+				CBufferT <CHART> & name = pleft->m_szNamed;
+				CBufferT <char> num;
 
-		case STOCKELX_SPACE:
-			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 1));
+				while(curr.ch != RCHART(0) && curr.ch != named_end)
+				{
+					name.Append(curr.ch, 1);
+					num .Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
+					MoveNext();
+				}
+				MoveNext(); // skip '>' or '\''
 
-				pRange->m_chars .Push(RCHART(' '));
-				pRange->m_chars .Push(RCHART('\t'));
-				pRange->m_chars .Push(RCHART('\r'));
-				pRange->m_chars .Push(RCHART('\n'));
+				// check <num>
+				unsigned int number;
+				char * str = num.GetBuffer();
 
-				pStockElxs[nStockId] = pRange;
-			}
-			break;
+				if( ReadDec(str, number) ? ( *str == '\0') : 0 )
+				{
+					pleft ->m_nnumber = number;
+					pright->m_nnumber = number;
 
-		case STOCKELX_SPACE_NOT:
-			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 0));
+					name.Release();
+				}
 
-				pRange->m_chars .Push(RCHART(' '));
-				pRange->m_chars .Push(RCHART('\t'));
-				pRange->m_chars .Push(RCHART('\r'));
-				pRange->m_chars .Push(RCHART('\n'));
+				// left, center, right
+				pList->m_elxlist.Push(pleft);
+				pList->m_elxlist.Push(BuildAlternative(flags));
+				pList->m_elxlist.Push(pright);
 
-				pStockElxs[nStockId] = pRange;
+				// for recursive
+				m_namedlist.Prepare(nThisBackref);
+				m_namedlist[nThisBackref] = pList;
+
+				pElx = pList;
 			}
 			break;
 
-		case STOCKELX_DIGITAL:
+		case RCHART('>'):
 			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 1));
-
-				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
-
-				pStockElxs[nStockId] = pRange;
+				MoveNext(); // skip '>'
+				pElx = Keep(new CIndependentElx(BuildAlternative(flags)));
 			}
 			break;
 
-		case STOCKELX_DIGITAL_NOT:
+		case RCHART('R'):
+			MoveNext(); // skip 'R'
+			while(curr.ch != RCHART(0) && isspace(curr.ch)) MoveNext(); // skip space
+
+			if(curr.ch == RCHART('<') || curr.ch == RCHART('\''))
 			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (0, 0));
+				named_end = curr.ch == RCHART('<') ? RCHART('>') : RCHART('\'');
+				CDelegateElx * pDelegate = (CDelegateElx *)Keep(new CDelegateElx(-3));
 
-				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+				MoveNext(); // skip '<' or '\\'
 
-				pStockElxs[nStockId] = pRange;
-			}
-			break;
+				// save name
+				CBufferT <CHART> & name = pDelegate->m_szNamed;
+				CBufferT <char> num;
 
-		case STOCKELX_WORD_RIGHTLEFT:
-			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 1));
+				while(curr.ch != RCHART(0) && curr.ch != named_end)
+				{
+					name.Append(curr.ch, 1);
+					num .Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
+					MoveNext();
+				}
+				MoveNext(); // skip '>' or '\''
 
-				pRange->m_ranges.Push(RCHART('A')); pRange->m_ranges.Push(RCHART('Z'));
-				pRange->m_ranges.Push(RCHART('a')); pRange->m_ranges.Push(RCHART('z'));
-				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
-				pRange->m_chars .Push(RCHART('_'));
+				// check <num>
+				unsigned int number;
+				char * str = num.GetBuffer();
 
-				pStockElxs[nStockId] = pRange;
-			}
-			break;
+				if( ReadDec(str, number) ? ( *str == '\0') : 0 )
+				{
+					pDelegate->m_ndata = number;
+					name.Release();
+				}
 
-		case STOCKELX_WORD_RIGHTLEFT_NOT:
+				m_recursivelist.Push(pDelegate);
+				pElx = pDelegate;
+			}
+			else
 			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 0));
+				CBufferT <char> rto;
+				while(curr.ch != RCHART(0) && curr.ch != RCHART(')'))
+				{
+					rto.Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
+					MoveNext();
+				}
 
-				pRange->m_ranges.Push(RCHART('A')); pRange->m_ranges.Push(RCHART('Z'));
-				pRange->m_ranges.Push(RCHART('a')); pRange->m_ranges.Push(RCHART('z'));
-				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
-				pRange->m_chars .Push(RCHART('_'));
+				unsigned int rtono = 0;
+				char * str = rto.GetBuffer();
+				ReadDec(str, rtono);
 
-				pStockElxs[nStockId] = pRange;
-			}
-			break;
+				CDelegateElx * pDelegate = (CDelegateElx *)Keep(new CDelegateElx(rtono));
 
-		case STOCKELX_DOT_ALL_RIGHTLEFT:
-			pStockElxs[nStockId] = Keep(new CRangeElxT <CHART> (1, 0));
+				m_recursivelist.Push(pDelegate);
+				pElx = pDelegate;
+			}
 			break;
 
-		case STOCKELX_DOT_NOT_ALL_RIGHTLEFT:
+		case RCHART('('):
 			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 0));
+				CConditionElx * pConditionElx = (CConditionElx *)Keep(new CConditionElx());
 
-				pRange->m_chars .Push(RCHART('\n'));
+				// condition
+				ElxInterface * & pCondition = pConditionElx->m_pelxask;
 
-				pStockElxs[nStockId] = pRange;
-			}
-			break;
+				if(next == CHART_INFO(RCHART('?'), 1))
+				{
+					pCondition = BuildRecursive(flags);
+				}
+				else // named, assert or number
+				{
+					MoveNext(); // skip '('
+					int pos0 = curr.pos;
 
-		case STOCKELX_SPACE_RIGHTLEFT:
-			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 1));
+					// save elx condition
+					pCondition = Keep(new CAssertElx(BuildAlternative(flags), 1));
 
-				pRange->m_chars .Push(RCHART(' '));
-				pRange->m_chars .Push(RCHART('\t'));
-				pRange->m_chars .Push(RCHART('\r'));
-				pRange->m_chars .Push(RCHART('\n'));
-				pRange->m_chars .Push(RCHART('\f'));
-				pRange->m_chars .Push(RCHART('\v'));
+					// save name
+					pConditionElx->m_szNamed.Append(m_pattern.GetBuffer() + pos0, curr.pos - pos0, 1);
 
-				pStockElxs[nStockId] = pRange;
-			}
-			break;
+					// save number
+					CBufferT <char> numstr;
+					while(pos0 < curr.pos)
+					{
+						CHART ch = m_pattern[pos0];
+						numstr.Append(((ch & (CHART)0xff) == ch) ? (char)ch : 0, 1);
+						pos0 ++;
+					}
 
-		case STOCKELX_SPACE_RIGHTLEFT_NOT:
-			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 0));
+					unsigned int number;
+					char * str = numstr.GetBuffer();
 
-				pRange->m_chars .Push(RCHART(' '));
-				pRange->m_chars .Push(RCHART('\t'));
-				pRange->m_chars .Push(RCHART('\r'));
-				pRange->m_chars .Push(RCHART('\n'));
-				pRange->m_chars .Push(RCHART('\f'));
-				pRange->m_chars .Push(RCHART('\v'));
+					// valid group number
+					if( ReadDec(str, number) ? ( *str == '\0') : 0 )
+					{
+						pConditionElx->m_nnumber = number;
+						pCondition = 0;
+					}
+					else // maybe elx, maybe named
+					{
+						pConditionElx->m_nnumber = -1;
+						m_namedconditionlist.Push(pConditionElx);
+					}
+
+					MoveNext(); // skip ')'
+				}
 
-				pStockElxs[nStockId] = pRange;
-			}
-			break;
+				// alternative
+				{
+					int newflags = flags;
 
-		case STOCKELX_DIGITAL_RIGHTLEFT:
-			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 1));
+					pConditionElx->m_pelxyes = BuildList(newflags);
+				}
 
-				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+				if(curr.ch == RCHART('|'))
+				{
+					MoveNext(); // skip '|'
 
-				pStockElxs[nStockId] = pRange;
+					pConditionElx->m_pelxno = BuildAlternative(flags);
+				}
+				else
+				{
+					pConditionElx->m_pelxno = 0;
+				}
+
+				pElx = pConditionElx;
 			}
 			break;
 
-		case STOCKELX_DIGITAL_RIGHTLEFT_NOT:
+		default:
+			while(curr.ch != RCHART(0) && isspace(curr.ch)) MoveNext(); // skip space
+
+			if(curr.ch >= RCHART('0') && curr.ch <= RCHART('9')) // recursive (?1) => (?R1)
 			{
-				CRangeElxT <CHART> * pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (1, 0));
+				CBufferT <char> rto;
+				while(curr.ch != RCHART(0) && curr.ch != RCHART(')'))
+				{
+					rto.Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
+					MoveNext();
+				}
 
-				pRange->m_ranges.Push(RCHART('0')); pRange->m_ranges.Push(RCHART('9'));
+				unsigned int rtono = 0;
+				char * str = rto.GetBuffer();
+				ReadDec(str, rtono);
 
-				pStockElxs[nStockId] = pRange;
+				CDelegateElx * pDelegate = (CDelegateElx *)Keep(new CDelegateElx(rtono));
+
+				m_recursivelist.Push(pDelegate);
+				pElx = pDelegate;
 			}
-			break;
-		}
-	}
+			else
+			{
+				// flag
+				int newflags = flags;
+				while(curr != CHART_INFO(0, 1) && curr.ch != RCHART(':') && curr.ch != RCHART(')') && curr != CHART_INFO(RCHART('('), 1))
+				{
+					int tochange = 0;
 
-	// return
-	return pStockElxs[nStockId];
-}
+					switch(curr.ch)
+					{
+					case RCHART('i'):
+					case RCHART('I'):
+						tochange = IGNORECASE;
+						break;
 
-template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildAlternative(int vaflags)
-{
-	if(curr == CHART_INFO(0, 1))
-		return GetStockElx(STOCKELX_EMPTY);
+					case RCHART('s'):
+					case RCHART('S'):
+						tochange = SINGLELINE;
+						break;
 
-	// flag instance
-	int flags = vaflags;
+					case RCHART('m'):
+					case RCHART('M'):
+						tochange = MULTILINE;
+						break;
 
-	// first part
-	ElxInterface * pAlternativeOne = BuildList(flags);
+					case RCHART('g'):
+					case RCHART('G'):
+						tochange = GLOBAL;
+						break;
 
-	// check alternative
-	if(curr == CHART_INFO(RCHART('|'), 1))
-	{
-		CAlternativeElx * pAlternative = (CAlternativeElx *)Keep(new CAlternativeElx());
-		pAlternative->m_elxlist.Push(pAlternativeOne);
+					case RCHART('-'):
+						bNegative = 1;
+						break;
+					}
 
-		// loop
-		while(curr == CHART_INFO(RCHART('|'), 1))
-		{
-			// skip '|' itself
-			MoveNext();
+					if(bNegative)
+						newflags &= ~tochange;
+					else
+						newflags |=  tochange;
 
-			pAlternativeOne = BuildList(flags);
-			pAlternative->m_elxlist.Push(pAlternativeOne);
-		}
+					// move to next char
+					MoveNext();
+				}
 
-		return pAlternative;
-	}
+				if(curr.ch == RCHART(':') || curr == CHART_INFO(RCHART('('), 1))
+				{
+					// skip ':'
+					if(curr.ch == RCHART(':')) MoveNext();
 
-	return pAlternativeOne;
-}
+					pElx = BuildAlternative(newflags);
+				}
+				else
+				{
+					// change parent flags
+					flags = newflags;
 
-template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildList(int & flags)
-{
-	if(curr == CHART_INFO(0, 1) || curr == CHART_INFO(RCHART('|'), 1) || curr == CHART_INFO(RCHART(')'), 1))
-		return GetStockElx(STOCKELX_EMPTY);
+					pElx = GetStockElx(STOCKELX_EMPTY);
+				}
+			}
+			break;
+		}
 
-	// first
-	ElxInterface * pListOne = BuildRepeat(flags);
+		MoveNext(); // skip ')'
 
-	if(curr != CHART_INFO(0, 1) && curr != CHART_INFO(RCHART('|'), 1) && curr != CHART_INFO(RCHART(')'), 1))
+		return pElx;
+	}
+	else
 	{
+		// group and number
 		CListElx * pList = (CListElx *)Keep(new CListElx(flags & RIGHTTOLEFT));
-		pList->m_elxlist.Push(pListOne);
+		int nThisBackref = ++ m_nMaxNumber;
 
-		while(curr != CHART_INFO(0, 1) && curr != CHART_INFO(RCHART('|'), 1) && curr != CHART_INFO(RCHART(')'), 1))
-		{
-			pListOne = BuildRepeat(flags);
+		// left, center, right
+		pList->m_elxlist.Push(Keep(new CBracketElx(nThisBackref, flags & RIGHTTOLEFT ? 1 : 0)));
+		pList->m_elxlist.Push(BuildAlternative(flags));
+		pList->m_elxlist.Push(Keep(new CBracketElx(nThisBackref, flags & RIGHTTOLEFT ? 0 : 1)));
 
-			// add
-			pList->m_elxlist.Push(pListOne);
-		}
+		// for recursive
+		m_grouplist.Prepare(nThisBackref);
+		m_grouplist[nThisBackref] = pList;
+
+		// right
+		MoveNext(); // skip ')' 
 
 		return pList;
 	}
-
-	return pListOne;
 }
 
-template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildRepeat(int & flags)
+template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildBoundary(int & flags)
 {
-	// simple
-	ElxInterface * pSimple = BuildSimple(flags);
-
-	if(curr.type == 0) return pSimple;
-
-	// is quantifier or not
-	int bIsQuantifier = 1;
+	// char
+	CHART ch = curr.ch;
 
-	// quantifier range
-	unsigned int nMin = 0, nMax = 0;
+	// skip
+	MoveNext();
 
-	switch(curr.ch)
+	switch(ch)
 	{
-	case RCHART('{'):
-		{
-			CBufferT <char> re;
-
-			// skip '{'
-			MoveNext();
-
-			// copy
-			while(curr != CHART_INFO(0, 1) && curr != CHART_INFO(RCHART('}'), 1))
-			{
-				re.Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
-				MoveNext();
-			}
-
-			// skip '}'
-			MoveNext();
-
-			// read
-			int red;
-			char * str = re.GetBuffer();
-
-			if( ! ReadDec(str, nMin) )
-				red = 0;
-			else if( *str != ',' )
-				red = 1;
-			else
-			{
-				str ++;
-
-				if( ! ReadDec(str, nMax) )
-					red = 2;
-				else
-					red = 3;
-			}
+	case RCHART('^'):
+		return Keep(new CBoundaryElxT <CHART> ((flags & MULTILINE) ? BOUNDARY_LINE_BEGIN : BOUNDARY_FILE_BEGIN));
 
-			// check
-			if(red  <=  1 ) nMax = nMin;
-			if(red  ==  2 ) nMax = INT_MAX;
-			if(nMax < nMin) nMax = nMin;
-		}
-		break;
+	case RCHART('$'):
+		return Keep(new CBoundaryElxT <CHART> ((flags & MULTILINE) ? BOUNDARY_LINE_END : BOUNDARY_FILE_END));
 
-	case RCHART('?'):
-		nMin = 0;
-		nMax = 1;
+	case RCHART('b'):
+		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_WORD_EDGE));
 
-		// skip '?'
-		MoveNext();
-		break;
+	case RCHART('B'):
+		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_WORD_EDGE, 0));
 
-	case RCHART('*'):
-		nMin = 0;
-		nMax = INT_MAX;
+	case RCHART('A'):
+		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_FILE_BEGIN));
 
-		// skip '*'
-		MoveNext();
-		break;
+	case RCHART('Z'):
+		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_FILE_END_N));
 
-	case RCHART('+'):
-		nMin = 1;
-		nMax = INT_MAX;
+	case RCHART('z'):
+		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_FILE_END));
 
-		// skip '+'
-		MoveNext();
-		break;
+	case RCHART('G'):
+		if(flags & GLOBAL)
+			return Keep(new CGlobalElx());
+		else
+			return GetStockElx(STOCKELX_EMPTY);
 
 	default:
-		bIsQuantifier = 0;
-		break;
+		return GetStockElx(STOCKELX_EMPTY);
 	}
+}
 
-	// do quantify
-	if(bIsQuantifier)
+template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildBackref(int & flags)
+{
+	// skip '\\' or '\k' or '\g'
+	MoveNext();
+
+	if(curr.ch == RCHART('<') || curr.ch == RCHART('\''))
 	{
-		// 0 times
-		if(nMax == 0)
-			return GetStockElx(STOCKELX_EMPTY);
+		CHART named_end = curr.ch == RCHART('<') ? RCHART('>') : RCHART('\'');
+		CBackrefElxT <CHART> * pbackref = (CBackrefElxT <CHART> *)Keep(new CBackrefElxT <CHART> (-1, flags & RIGHTTOLEFT, flags & IGNORECASE));
 
-		// fixed times
-		if(nMin == nMax)
-		{
-			if(curr == CHART_INFO(RCHART('?'), 1) || curr == CHART_INFO(RCHART('+'), 1))
-				MoveNext();
+		MoveNext(); // skip '<' or '\''
 
-			return Keep(new CRepeatElx(pSimple, nMin));
-		}
+		// save name
+		CBufferT <CHART> & name = pbackref->m_szNamed;
+		CBufferT <char> num;
 
-		// range times
-		if(curr == CHART_INFO(RCHART('?'), 1))
+		while(curr.ch != RCHART(0) && curr.ch != named_end)
 		{
+			name.Append(curr.ch, 1);
+			num .Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
 			MoveNext();
-			return Keep(new CReluctantElx(pSimple, nMin, nMax));
 		}
-		else if(curr == CHART_INFO(RCHART('+'), 1))
+		MoveNext(); // skip '>' or '\''
+
+		// check <num>
+		unsigned int number;
+		char * str = num.GetBuffer();
+
+		if( ReadDec(str, number) ? ( *str == '\0') : 0 )
 		{
-			MoveNext();
-			return Keep(new CPossessiveElx(pSimple, nMin, nMax));
+			pbackref->m_nnumber = number;
+			name.Release();
 		}
 		else
 		{
-			return Keep(new CGreedyElx(pSimple, nMin, nMax));
+			m_namedbackreflist.Push(pbackref);
 		}
+
+		return pbackref;
 	}
+	else
+	{
+		unsigned int nbackref = 0;
 
-	return pSimple;
+		for(int i=0; i<3; i++)
+		{
+			if(curr.ch >= RCHART('0') && curr.ch <= RCHART('9'))
+				nbackref = nbackref * 10 + (curr.ch - RCHART('0'));
+			else
+				break;
+
+			MoveNext();
+		}
+
+		return Keep(new CBackrefElxT <CHART> (nbackref, flags & RIGHTTOLEFT, flags & IGNORECASE));
+	}
 }
 
-template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildSimple(int & flags)
+template <class CHART> int CBuilderT <CHART> :: ReadDec(char * & str, unsigned int & dec)
 {
-	CBufferT <CHART> fixed;
+	int s = 0;
+	while(str[s] != 0 && isspace(str[s])) s++;
 
-	while(curr != CHART_INFO(0, 1))
+	if(str[s] < '0' || str[s] > '9') return 0;
+
+	dec = 0;
+	unsigned int i;
+
+	for(i = s; i<sizeof(CHART)*3 + s; i++)
 	{
-		if(curr.type == 0)
-		{
-			if(next == CHART_INFO(RCHART('{'), 1) || next == CHART_INFO(RCHART('?'), 1) || next == CHART_INFO(RCHART('*'), 1) || next == CHART_INFO(RCHART('+'), 1))
-			{
-				if(fixed.GetSize() == 0)
-				{
-					fixed.Append(curr.ch, 1);
-					MoveNext();
-				}
+		if(str[i] >= '0' && str[i] <= '9')
+			dec = dec * 10 + (str[i] - '0');
+		else
+			break;
+	}
 
-				break;
-			}
-			else
-			{
-				fixed.Append(curr.ch, 1);
-				MoveNext();
-			}
-		}
-		else if(curr.type == 1)
-		{
-			CHART vch = curr.ch;
+	while(str[i] != 0 && isspace(str[i])) i++;
+	str += i;
 
-			// end of simple
-			if(vch == RCHART(')') || vch == RCHART('|'))
-				break;
+	return 1;
+}
 
-			// has fixed already
-			if(fixed.GetSize() > 0)
-				break;
+//
+// Automaton
+//
+// The elx tree compiled to a Thompson NFA, a flat array of instructions
+// run by one dispatch loop. Short texts are matched by backtracking over
+// the program, trying each (pc, pos) once; longer ones by a Pike VM,
+// where all threads step over the text together. Either way matching is
+// linear in the text whatever the pattern, and alternatives are tried in
+// the priority order of the elx tree, so all find the same match. Classes
+// carry a bitmap of the chars below 256, so only wider chars call into the
+// elx. Patterns with
+// backreferences, lookaround, conditions, recursion, independent or
+// possessive groups, right-to-left parts, or repeats of what may match
+// empty don't compile and are left to the elx tree.
+//
+enum AUTOMATON_OPCODE
+{
+	AUTOMATON_CHAR       , // one char equal to m_arg
+	AUTOMATON_CHAR_NOCASE, // one char equal to m_arg, ignoring case
+	AUTOMATON_CLASS      , // one char in the bitmap at m_arg, or matched by m_pelx
+	AUTOMATON_ASSERT     , // m_pelx matches here, zero width
+	AUTOMATON_SAVE       , // slot m_arg = current pos
+	AUTOMATON_SPLIT      , // m_next, else m_arg
+	AUTOMATON_JUMP       , // m_next
+	AUTOMATON_MATCH      , // of pattern m_arg, when appended to a set
+};
 
-			// left parentheses
-			if(vch == RCHART('('))
-			{
-				return BuildRecursive(flags);
-			}
+#define AUTOMATON_MAX_PROGRAM 4096
+#define AUTOMATON_MAX_VISITED (256 * 1024)
 
-			// char set
-			if( vch == RCHART('[') || vch == RCHART('.') || vch == RCHART('w') || vch == RCHART('W') ||
-				vch == RCHART('s') || vch == RCHART('S') || vch == RCHART('d') || vch == RCHART('D')
-			)
-			{
-				return BuildCharset(flags);
-			}
+template <class CHART> class CAutomatonT
+{
+public:
+	int  Compile(const CBuilderT <CHART> & builder);
+	int  Match(CContext * pContext, int bexact) const;
+	int  IsCompiled() const;
+	void Clear();
 
-			// boundary
-			if( vch == RCHART('^') || vch == RCHART('$') || vch == RCHART('A') || vch == RCHART('Z') || vch == RCHART('z') ||
-				vch == RCHART('b') || vch == RCHART('B') || vch == RCHART('G') // vch == RCHART('<') || vch == RCHART('>')
-			)
-			{
-				return BuildBoundary(flags);
-			}
+public:
+	int  Append(const CAutomatonT <CHART> & other, int index);
+	int  MatchSet(CContext * pContext, CBufferT <int> & matched) const;
 
-			// backref
-			if(vch == RCHART('\\') || vch == RCHART('k') || vch == RCHART('g'))
-			{
-				return BuildBackref(flags);
-			}
+public:
+	CAutomatonT();
 
-			// treat vchar as char
-			fixed.Append(curr.ch, 1);
-			MoveNext();
-		}
-	}
+public:
+	struct INSTRUCTION
+	{
+		int m_opcode;
+		int m_arg;
+		int m_next;
+		ElxInterface * m_pelx;
+	};
 
-	if(fixed.GetSize() > 0)
-		return Keep(new CStringElxT <CHART> (fixed.GetBuffer(), fixed.GetSize(), flags & RIGHTTOLEFT, flags & IGNORECASE));
-	else
-		return GetStockElx(STOCKELX_EMPTY);
+protected:
+	typedef CBracketElxT <CHART> CBracketElx;
+
+	int Emit(int opcode, int arg = 0, ElxInterface * pelx = 0);
+	int EmitElx(ElxInterface * pelx);
+	int EmitRepeat(ElxInterface * pelx, int nmin, int nvart, int bgreedy);
+	int EmitClass (ElxInterface * pelx);
+
+	int IsMatchChar(const CHART * tstring, int npos, const INSTRUCTION & inst, CContext * pTest) const;
+	int Backtrack(CContext * pContext, int start, int bexact) const;
+	int Simulate (CContext * pContext, int start, int bexact) const;
+	void AddThread(int pc, int npos, CContext * pTest, int * pslots, int * plist, int * pcount, int * psparse, int * pcaps, CBufferT <int> & stack) const;
+	void AddSetThread(int pc, int npos, CContext * pTest, int * plist, int * pcount, int * psparse, int * pmatched, int * pleft, CBufferT <int> & stack) const;
+
+public:
+	CBufferT <INSTRUCTION> m_program;
+	CBufferT <unsigned char> m_classes;
+	CBufferT <int> m_open;
+	CBufferT <int> m_entries; // of a set: first pc and index of each pattern
+	CBufferT <const CBuilderT <CHART> *> m_builders;
+	int m_nMaxNumber;
+	int m_nSlots;
+
+	// backtrack while (text length + 1) * program size is at most this
+	int m_nMaxVisited;
+
+	const CBuilderT <CHART> * m_pBuilder;
+};
+
+//
+// Implementation
+//
+template <class CHART> CAutomatonT <CHART> :: CAutomatonT()
+{
+	m_nMaxVisited = AUTOMATON_MAX_VISITED;
+	Clear();
 }
 
-#define max(a, b)  (((a) > (b)) ? (a) : (b))
-#define min(a, b)  (((a) < (b)) ? (a) : (b))
+template <class CHART> void CAutomatonT <CHART> :: Clear()
+{
+	m_program.Restore(0);
+	m_classes.Restore(0);
+	m_entries.Restore(0);
+	m_builders.Restore(0);
+	m_nMaxNumber = 0;
+	m_nSlots     = 0;
+}
 
-template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildCharset(int & flags)
+template <class CHART> inline int CAutomatonT <CHART> :: IsCompiled() const
 {
-	// char
-	CHART ch = curr.ch;
+	return m_program.GetSize() > 0;
+}
 
-	// skip
-	MoveNext();
+template <class CHART> int CAutomatonT <CHART> :: Compile(const CBuilderT <CHART> & builder)
+{
+	Clear();
 
-	switch(ch)
+	if(builder.m_pTopElx == 0 || (builder.m_nFlags & RIGHTTOLEFT))
+		return 0;
+
+	m_nMaxNumber = builder.m_nMaxNumber;
+	m_nSlots     = m_nMaxNumber * 2 + 2;
+	m_pBuilder   = &builder;
+
+	m_open.Restore(0);
+	m_open.Prepare(m_nMaxNumber, 0);
+
+	Emit(AUTOMATON_SAVE, 0);
+
+	if( EmitElx(builder.m_pTopElx) < 0 )
 	{
-	case RCHART('.'):
-		return GetStockElx(
-			flags & RIGHTTOLEFT ?
-			((flags & SINGLELINE) ? STOCKELX_DOT_ALL_RIGHTLEFT : STOCKELX_DOT_NOT_ALL_RIGHTLEFT) :
-			((flags & SINGLELINE) ? STOCKELX_DOT_ALL : STOCKELX_DOT_NOT_ALL)
-		);
+		Clear();
+		return 0;
+	}
 
-	case RCHART('w'):
-		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_WORD_RIGHTLEFT : STOCKELX_WORD);
+	Emit(AUTOMATON_SAVE, 1);
+	Emit(AUTOMATON_MATCH);
 
-	case RCHART('W'):
-		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_WORD_RIGHTLEFT_NOT : STOCKELX_WORD_NOT);
+	return 1;
+}
 
-	case RCHART('s'):
-		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_SPACE_RIGHTLEFT : STOCKELX_SPACE);
+template <class CHART> int CAutomatonT <CHART> :: Emit(int opcode, int arg, ElxInterface * pelx)
+{
+	INSTRUCTION inst;
 
-	case RCHART('S'):
-		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_SPACE_RIGHTLEFT_NOT : STOCKELX_SPACE_NOT);
+	inst.m_opcode = opcode;
+	inst.m_arg    = arg;
+	inst.m_next   = m_program.GetSize() + 1;
+	inst.m_pelx   = pelx;
 
-	case RCHART('d'):
-		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_DIGITAL_RIGHTLEFT : STOCKELX_DIGITAL);
+	m_program.Push(inst);
 
-	case RCHART('D'):
-		return GetStockElx(flags & RIGHTTOLEFT ? STOCKELX_DIGITAL_RIGHTLEFT_NOT : STOCKELX_DIGITAL_NOT);
+	return m_program.GetSize() - 1;
+}
 
-	case RCHART('['):
+//
+// returns -1 if unsupported, 1 if pelx may match empty, else 0
+//
+template <class CHART> int CAutomatonT <CHART> :: EmitElx(ElxInterface * pelx)
+{
+	if(m_program.GetSize() > AUTOMATON_MAX_PROGRAM)
+		return -1;
+
+	if(CListElx * pList = dynamic_cast <CListElx *> (pelx))
+	{
+		if(pList->m_brightleft)
+			return -1;
+
+		int bempty = 1;
+
+		for(int i=0; i<pList->m_elxlist.GetSize(); i++)
 		{
-			CRangeElxT <CHART> * pRange;
+			int r = EmitElx(pList->m_elxlist[i]);
 
-			// create
-			if(curr == CHART_INFO(RCHART(':'), 1))
-			{
-				CBufferT <char> posix;
+			if(r < 0) return -1;
+			if(r == 0) bempty = 0;
+		}
 
-				do {
-					posix.Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
-					MoveNext();
-				}
-				while(curr.ch != RCHART(0) && curr != CHART_INFO(RCHART(']'), 1));
+		return bempty;
+	}
 
-				MoveNext(); // skip ']'
+	if(CAlternativeElx * pAlternative = dynamic_cast <CAlternativeElx *> (pelx))
+	{
+		int n = pAlternative->m_elxlist.GetSize(), bempty = n == 0;
+		CBufferT <int> jumps;
 
-				// posix
-				return Keep(new CPosixElxT <CHART> (posix.GetBuffer(), flags & RIGHTTOLEFT));
-			}
-			else if(curr == CHART_INFO(RCHART('^'), 1))
-			{
-				MoveNext(); // skip '^'
-				pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (flags & RIGHTTOLEFT, 0));
-			}
-			else
+		for(int i=0; i<n; i++)
+		{
+			int split = i < n - 1 ? Emit(AUTOMATON_SPLIT) : -1;
+			int r = EmitElx(pAlternative->m_elxlist[i]);
+
+			if(r < 0) return -1;
+			if(r > 0) bempty = 1;
+
+			if(split >= 0)
 			{
-				pRange = (CRangeElxT <CHART> *)Keep(new CRangeElxT <CHART> (flags & RIGHTTOLEFT, 1));
+				jumps.Push(Emit(AUTOMATON_JUMP));
+				m_program[split].m_arg = m_program.GetSize();
 			}
+		}
+
+		for(int j=0; j<jumps.GetSize(); j++)
+			m_program[jumps[j]].m_next = m_program.GetSize();
+
+		return bempty;
+	}
+
+	if(CBracketElx * pBracket = dynamic_cast <CBracketElx *> (pelx))
+	{
+		int number = pBracket->m_nnumber;
+		int bopen  = ! pBracket->m_bright;
+
+		if(number < 0 || number > m_nMaxNumber)
+			return -1;
+
+		// a group inside a group of the same name
+		if(m_open[number] == bopen)
+			return -1;
+
+		m_open[number] = bopen;
+		Emit(AUTOMATON_SAVE, number * 2 + (pBracket->m_bright ? 1 : 0));
+
+		return 1;
+	}
 
-			// parse
-			while(curr != CHART_INFO(0, 1) && curr != CHART_INFO(RCHART(']'), 1))
-			{
-				ch = curr.ch;
+	if(CPossessiveElx * pPossessive = dynamic_cast <CPossessiveElx *> (pelx))
+	{
+		// the optimizer's matches as the greedy one it was
+		if( ! pPossessive->m_bimplied )
+			return -1;
 
-				if(curr.type == 1 && (
-					ch == RCHART('.') || ch == RCHART('w') || ch == RCHART('W') || ch == RCHART('s') || ch == RCHART('S') || ch == RCHART('d') || ch == RCHART('D') ||
-					(ch == RCHART('[') && next == CHART_INFO(RCHART(':'), 1))
-				))
-				{
-					pRange->m_embeds.Push(BuildCharset(flags));
-				}
-				else if(next == CHART_INFO(RCHART('-'), 1) && nex2.type == 0)
-				{
-					pRange->m_ranges.Push(ch); pRange->m_ranges.Push(nex2.ch);
+		return EmitRepeat(pPossessive->m_pelx, pPossessive->m_nfixed, pPossessive->m_nvart, 1);
+	}
 
-					// next
-					MoveNext();
-					MoveNext();
-					MoveNext();
-				}
-				else
-				{
-					pRange->m_chars.Push(ch);
+	if(CGreedyElx * pGreedy = dynamic_cast <CGreedyElx *> (pelx))
+	{
+		return EmitRepeat(pGreedy->m_pelx, pGreedy->m_nfixed, pGreedy->m_nvart, 1);
+	}
 
-					// next
-					MoveNext();
-				}
-			}
+	if(CReluctantElx * pReluctant = dynamic_cast <CReluctantElx *> (pelx))
+	{
+		return EmitRepeat(pReluctant->m_pelx, pReluctant->m_nfixed, pReluctant->m_nvart, 0);
+	}
 
-			// skip ']'
-			MoveNext();
+	if(CRepeatElx * pRepeat = dynamic_cast <CRepeatElx *> (pelx))
+	{
+		return EmitRepeat(pRepeat->m_pelx, pRepeat->m_nfixed, 0, 1);
+	}
 
-			if( flags & IGNORECASE )
-			{
-				CBufferT <CHART> & ranges = pRange->m_ranges;
-				int i, oldcount = ranges.GetSize() / 2;
+	if(CStringElxT <CHART> * pString = dynamic_cast <CStringElxT <CHART> *> (pelx))
+	{
+		if(pString->m_brightleft)
+			return -1;
 
-				for(i=0; i<oldcount; i++)
-				{
-					CHART newmin, newmax;
+		for(int i=0; i<pString->m_szPattern.GetSize(); i++)
+			Emit(pString->m_bignorecase ? AUTOMATON_CHAR_NOCASE : AUTOMATON_CHAR, (int)pString->m_szPattern[i]);
 
-					if( ranges[i*2] <= RCHART('Z') && ranges[i*2+1] >= RCHART('A') )
-					{
-						newmin = tolower( max(RCHART('A'), ranges[i*2  ]) );
-						newmax = tolower( min(RCHART('Z'), ranges[i*2+1]) );
+		return pString->m_szPattern.GetSize() == 0;
+	}
 
-						if( newmin < ranges[i*2] || newmax > ranges[i*2+1] )
-						{
-							ranges.Push(newmin);
-							ranges.Push(newmax);
-						}
-					}
+	if(CRangeElxT <CHART> * pRange = dynamic_cast <CRangeElxT <CHART> *> (pelx))
+	{
+		if(pRange->m_brightleft)
+			return -1;
 
-					if( ranges[i*2] <= RCHART('z') && ranges[i*2+1] >= RCHART('a') )
-					{
-						newmin = toupper( max(RCHART('a'), ranges[i*2  ]) );
-						newmax = toupper( min(RCHART('z'), ranges[i*2+1]) );
+		return EmitClass(pelx);
+	}
 
-						if( newmin < ranges[i*2] || newmax > ranges[i*2+1] )
-						{
-							ranges.Push(newmin);
-							ranges.Push(newmax);
-						}
-					}
-				}
+	if(CPosixElxT <CHART> * pPosix = dynamic_cast <CPosixElxT <CHART> *> (pelx))
+	{
+		if(pPosix->m_brightleft)
+			return -1;
 
-				CBufferT <CHART> & chars = pRange->m_chars;
-				oldcount = chars.GetSize();
-				for(i=0; i<oldcount; i++)
-				{
-					if( isupper(chars[i]) && ! pRange->IsContainChar(tolower(chars[i])) )
-						chars.Push(tolower(chars[i]));
+		return EmitClass(pelx);
+	}
 
-					if( islower(chars[i]) && ! pRange->IsContainChar(toupper(chars[i])) )
-						chars.Push(toupper(chars[i]));
-				}
-			}
+	if(dynamic_cast <CBoundaryElxT <CHART> *> (pelx) != 0 || dynamic_cast <CGlobalElx *> (pelx) != 0)
+	{
+		Emit(AUTOMATON_ASSERT, 0, pelx);
+		return 1;
+	}
 
-			return pRange;
-		}
+	if(dynamic_cast <CEmptyElx *> (pelx) != 0)
+	{
+		return 1;
 	}
 
-	return GetStockElx(STOCKELX_EMPTY);
+	// backref, assert, condition, delegate, independent
+	return -1;
 }
 
-template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildRecursive(int & flags)
+template <class CHART> int CAutomatonT <CHART> :: EmitRepeat(ElxInterface * pelx, int nmin, int nvart, int bgreedy)
 {
-	// skip '('
-	MoveNext();
+	int bempty = 1, i, r;
 
-	if(curr == CHART_INFO(RCHART('?'), 1))
+	for(i=0; i<nmin; i++)
 	{
-		ElxInterface * pElx = 0;
+		if((r = EmitElx(pelx)) < 0) return -1;
+		if(r == 0) bempty = 0;
+	}
 
-		// skip '?'
-		MoveNext();
+	if(nvart <= 0)
+		return bempty;
 
-		int bNegative = 0;
-		CHART named_end = RCHART('>');
+	// repeats of empty stop early in the elx tree, unlike here
+	if(nvart >= INT_MAX - nmin)
+	{
+		int split = Emit(AUTOMATON_SPLIT);
 
-		switch(curr.ch)
+		if(EmitElx(pelx) != 0) return -1;
+
+		m_program[Emit(AUTOMATON_JUMP)].m_next = split;
+
+		if(bgreedy)
+			m_program[split].m_arg  = m_program.GetSize();
+		else
 		{
-		case RCHART('!'):
-			bNegative = 1;
+			m_program[split].m_arg  = split + 1;
+			m_program[split].m_next = m_program.GetSize();
+		}
 
-		case RCHART('='):
-			{
-				MoveNext(); // skip '!' or '='
-				pElx = Keep(new CAssertElx(BuildAlternative(flags & ~RIGHTTOLEFT), !bNegative));
-			}
-			break;
+		return bempty;
+	}
 
-		case RCHART('<'):
-			switch(next.ch)
-			{
-			case RCHART('!'):
-				bNegative = 1;
+	CBufferT <int> splits;
 
-			case RCHART('='):
-				MoveNext(); // skip '<'
-				MoveNext(); // skip '!' or '='
-				{
-					pElx = Keep(new CAssertElx(BuildAlternative(flags | RIGHTTOLEFT), !bNegative));
-				}
-				break;
+	for(i=0; i<nvart; i++)
+	{
+		splits.Push(Emit(AUTOMATON_SPLIT));
 
-			default: // named group
-				break;
-			}
-			// break if assertion // else named
-			if(pElx != 0) break;
+		if(EmitElx(pelx) != 0) return -1;
+	}
 
-		case RCHART('P'):
-			if(curr.ch == RCHART('P')) MoveNext(); // skip 'P'
+	for(i=0; i<splits.GetSize(); i++)
+	{
+		if(bgreedy)
+			m_program[splits[i]].m_arg  = m_program.GetSize();
+		else
+		{
+			m_program[splits[i]].m_arg  = splits[i] + 1;
+			m_program[splits[i]].m_next = m_program.GetSize();
+		}
+	}
 
-		case RCHART('\''):
-			if     (curr.ch == RCHART('<' )) named_end = RCHART('>' );
-			else if(curr.ch == RCHART('\'')) named_end = RCHART('\'');
-			MoveNext(); // skip '<' or '\''
-			{
-				// named number
-				int nThisBackref = m_nNextNamed ++;
+	return bempty;
+}
 
-				CListElx    * pList  = (CListElx    *)Keep(new CListElx(flags & RIGHTTOLEFT));
-				CBracketElx * pleft  = (CBracketElx *)Keep(new CBracketElx(-1, flags & RIGHTTOLEFT ? 1 : 0));
-				CBracketElx * pright = (CBracketElx *)Keep(new CBracketElx(-1, flags & RIGHTTOLEFT ? 0 : 1));
+template <class CHART> int CAutomatonT <CHART> :: EmitClass(ElxInterface * pelx)
+{
+	int offset = m_classes.GetSize(), i;
 
-				// save name
-				CBufferT <CHART> & name = pleft->m_szNamed;
-				CBufferT <char> num;
+	m_classes.Prepare(offset + 31, 0);
 
-				while(curr.ch != RCHART(0) && curr.ch != named_end)
-				{
-					name.Append(curr.ch, 1);
-					num .Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
-					MoveNext();
-				}
-				MoveNext(); // skip '>' or '\''
+	// probe the chars below 256
+	CContext probe;
+	CHART ch;
 
-				// check <num>
-				unsigned int number;
-				char * str = num.GetBuffer();
+	probe.m_pMatchString       = &ch;
+	probe.m_pMatchStringLength = 1;
+	probe.m_nBeginPos          = 0;
 
-				if( ReadDec(str, number) ? ( *str == '\0') : 0 )
-				{
-					pleft ->m_nnumber = number;
-					pright->m_nnumber = number;
+	for(i=0; i<256; i++)
+	{
+		ch = (CHART)i;
+		probe.m_nCurrentPos = 0;
 
-					name.Release();
-				}
+		if(pelx->Match(&probe))
+			m_classes[offset + (i >> 3)] |= (unsigned char)(1 << (i & 7));
+	}
 
-				// left, center, right
-				pList->m_elxlist.Push(pleft);
-				pList->m_elxlist.Push(BuildAlternative(flags));
-				pList->m_elxlist.Push(pright);
+	Emit(AUTOMATON_CLASS, offset, pelx);
+	return 0;
+}
 
-				// for recursive
-				m_namedlist.Prepare(nThisBackref);
-				m_namedlist[nThisBackref] = pList;
+//
+// whether the char at npos < length passes a CHAR or CLASS instruction
+//
+template <class CHART> inline int CAutomatonT <CHART> :: IsMatchChar(const CHART * tstring, int npos, const INSTRUCTION & inst, CContext * pTest) const
+{
+	CHART ch = tstring[npos];
 
-				pElx = pList;
-			}
-			break;
+	switch(inst.m_opcode)
+	{
+	case AUTOMATON_CHAR:
+		return ch == (CHART)inst.m_arg;
 
-		case RCHART('>'):
-			{
-				MoveNext(); // skip '>'
-				pElx = Keep(new CIndependentElx(BuildAlternative(flags)));
-			}
-			break;
+	case AUTOMATON_CHAR_NOCASE:
+		return ch == (CHART)inst.m_arg || toupper((int)ch) == toupper((int)(CHART)inst.m_arg);
 
-		case RCHART('R'):
-			MoveNext(); // skip 'R'
-			while(curr.ch != RCHART(0) && isspace(curr.ch)) MoveNext(); // skip space
+	case AUTOMATON_CLASS:
+		if(sizeof(CHART) == 1 || (ch & ~(CHART)0xff) == 0)
+			return (m_classes[inst.m_arg + ((unsigned char)ch >> 3)] >> (ch & 7)) & 1;
 
-			if(curr.ch == RCHART('<') || curr.ch == RCHART('\''))
-			{
-				named_end = curr.ch == RCHART('<') ? RCHART('>') : RCHART('\'');
-				CDelegateElx * pDelegate = (CDelegateElx *)Keep(new CDelegateElx(-3));
+		pTest->m_nCurrentPos = npos;
+		return inst.m_pelx->Match(pTest);
+	}
 
-				MoveNext(); // skip '<' or '\\'
+	return 0;
+}
 
-				// save name
-				CBufferT <CHART> & name = pDelegate->m_szNamed;
-				CBufferT <char> num;
+//
+// Depth first in priority order, the first MATCH reached is the match.
+// A (pc, pos) that was reached before led to no match then and won't now,
+// as nothing the program tests depends on the path taken, so each is run
+// at most once, also across start positions.
+//
+template <class CHART> int CAutomatonT <CHART> :: Backtrack(CContext * pContext, int start, int bexact) const
+{
+	const CHART * tstring = (const CHART *)pContext->m_pMatchString;
+	int length = pContext->m_pMatchStringLength;
+	int width  = length - start + 1;
+	int i, npos;
 
-				while(curr.ch != RCHART(0) && curr.ch != named_end)
-				{
-					name.Append(curr.ch, 1);
-					num .Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
-					MoveNext();
-				}
-				MoveNext(); // skip '>' or '\''
+	CBufferT <unsigned int> & visited = pContext->m_visited;
+	CBufferT <int> & stack = pContext->m_stack, & slots = pContext->m_slots;
 
-				// check <num>
-				unsigned int number;
-				char * str = num.GetBuffer();
+	visited.Restore(0);
+	visited.Prepare((m_program.GetSize() * width) / 32, 0);
+	slots.Prepare(m_nSlots - 1, -1);
 
-				if( ReadDec(str, number) ? ( *str == '\0') : 0 )
-				{
-					pDelegate->m_ndata = number;
-					name.Release();
-				}
+	for(npos = start; npos <= length; npos ++)
+	{
+		if( ! bexact )
+		{
+			npos = m_pBuilder->FindCandidate(tstring, length, npos);
+			if(npos < 0) break;
+		}
+		else if(npos > start)
+			break;
 
-				m_recursivelist.Push(pDelegate);
-				pElx = pDelegate;
-			}
-			else
-			{
-				CBufferT <char> rto;
-				while(curr.ch != RCHART(0) && curr.ch != RCHART(')'))
-				{
-					rto.Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
-					MoveNext();
-				}
+		for(i=0; i<m_nSlots; i++) slots[i] = -1;
 
-				unsigned int rtono = 0;
-				char * str = rto.GetBuffer();
-				ReadDec(str, rtono);
+		stack.Restore(0);
+		stack.Push(0);
+		stack.Push(npos);
 
-				CDelegateElx * pDelegate = (CDelegateElx *)Keep(new CDelegateElx(rtono));
+		while(stack.GetSize() > 0)
+		{
+			int pc = 0, pos = 0;
 
-				m_recursivelist.Push(pDelegate);
-				pElx = pDelegate;
+			stack.Pop(pos);
+			stack.Pop(pc);
+
+			// restore a slot
+			if(pc < 0)
+			{
+				slots[-1 - pc] = pos;
+				continue;
 			}
-			break;
 
-		case RCHART('('):
+			for(;;)
 			{
-				CConditionElx * pConditionElx = (CConditionElx *)Keep(new CConditionElx());
+				unsigned int bit = (unsigned int)(pc * width + pos - start);
+
+				if(visited[bit >> 5] & (1u << (bit & 31)))
+					break;
 
-				// condition
-				ElxInterface * & pCondition = pConditionElx->m_pelxask;
+				visited[bit >> 5] |= 1u << (bit & 31);
 
-				if(next == CHART_INFO(RCHART('?'), 1))
-				{
-					pCondition = BuildRecursive(flags);
-				}
-				else // named, assert or number
+				const INSTRUCTION & inst = m_program[pc];
+
+				switch(inst.m_opcode)
 				{
-					MoveNext(); // skip '('
-					int pos0 = curr.pos;
+				case AUTOMATON_CHAR:
+				case AUTOMATON_CHAR_NOCASE:
+				case AUTOMATON_CLASS:
+					if(pos >= length || ! IsMatchChar(tstring, pos, inst, pContext))
+						break;
 
-					// save elx condition
-					pCondition = Keep(new CAssertElx(BuildAlternative(flags), 1));
+					pc = inst.m_next;
+					pos ++;
+					continue;
 
-					// save name
-					pConditionElx->m_szNamed.Append(m_pattern.GetBuffer() + pos0, curr.pos - pos0, 1);
+				case AUTOMATON_ASSERT:
+					pContext->m_nCurrentPos = pos;
 
-					// save number
-					CBufferT <char> numstr;
-					while(pos0 < curr.pos)
-					{
-						CHART ch = m_pattern[pos0];
-						numstr.Append(((ch & (CHART)0xff) == ch) ? (char)ch : 0, 1);
-						pos0 ++;
-					}
+					if( ! inst.m_pelx->Match(pContext) )
+						break;
 
-					unsigned int number;
-					char * str = numstr.GetBuffer();
+					pc = inst.m_next;
+					continue;
 
-					// valid group number
-					if( ReadDec(str, number) ? ( *str == '\0') : 0 )
-					{
-						pConditionElx->m_nnumber = number;
-						pCondition = 0;
-					}
-					else // maybe elx, maybe named
-					{
-						pConditionElx->m_nnumber = -1;
-						m_namedconditionlist.Push(pConditionElx);
-					}
+				case AUTOMATON_SAVE:
+					stack.Push(-1 - inst.m_arg);
+					stack.Push(slots[inst.m_arg]);
 
-					MoveNext(); // skip ')'
-				}
+					slots[inst.m_arg] = pos;
+					pc = inst.m_next;
+					continue;
 
-				// alternative
-				{
-					int newflags = flags;
+				case AUTOMATON_SPLIT:
+					stack.Push(inst.m_arg);
+					stack.Push(pos);
 
-					pConditionElx->m_pelxyes = BuildList(newflags);
-				}
+					pc = inst.m_next;
+					continue;
 
-				if(curr.ch == RCHART('|'))
-				{
-					MoveNext(); // skip '|'
+				case AUTOMATON_JUMP:
+					pc = inst.m_next;
+					continue;
 
-					pConditionElx->m_pelxno = BuildAlternative(flags);
-				}
-				else
-				{
-					pConditionElx->m_pelxno = 0;
+				case AUTOMATON_MATCH:
+					if(bexact && pos != length)
+						break;
+
+					pContext->m_best.Restore(0);
+					pContext->m_best.Append(slots.GetBuffer(), m_nSlots);
+					return 1;
 				}
 
-				pElx = pConditionElx;
+				break;
 			}
-			break;
+		}
+	}
 
-		default:
-			while(curr.ch != RCHART(0) && isspace(curr.ch)) MoveNext(); // skip space
+	return 0;
+}
 
-			if(curr.ch >= RCHART('0') && curr.ch <= RCHART('9')) // recursive (?1) => (?R1)
-			{
-				CBufferT <char> rto;
-				while(curr.ch != RCHART(0) && curr.ch != RCHART(')'))
-				{
-					rto.Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
-					MoveNext();
-				}
+//
+// Adds pc and what it leads to without consuming a char, in priority
+// order. pslots holds the thread's captures and is restored on return.
+//
+template <class CHART> void CAutomatonT <CHART> :: AddThread(int pc, int npos, CContext * pTest, int * pslots, int * plist, int * pcount, int * psparse, int * pcaps, CBufferT <int> & stack) const
+{
+	int base = stack.GetSize();
 
-				unsigned int rtono = 0;
-				char * str = rto.GetBuffer();
-				ReadDec(str, rtono);
+	stack.Push(pc);
+	stack.Push(0);
 
-				CDelegateElx * pDelegate = (CDelegateElx *)Keep(new CDelegateElx(rtono));
+	while(stack.GetSize() > base)
+	{
+		int value = 0;
 
-				m_recursivelist.Push(pDelegate);
-				pElx = pDelegate;
+		stack.Pop(value);
+		stack.Pop(pc);
+
+		// restore a slot
+		if(pc < 0)
+		{
+			pslots[-1 - pc] = value;
+			continue;
+		}
+
+		for(;;)
+		{
+			// already added
+			int index = psparse[pc];
+			if(index < *pcount && plist[index] == pc)
+				break;
+
+			psparse[pc] = *pcount;
+			plist[(*pcount) ++] = pc;
+
+			const INSTRUCTION & inst = m_program[pc];
+
+			if(inst.m_opcode == AUTOMATON_JUMP)
+			{
+				pc = inst.m_next;
 			}
-			else
+			else if(inst.m_opcode == AUTOMATON_SPLIT)
 			{
-				// flag
-				int newflags = flags;
-				while(curr != CHART_INFO(0, 1) && curr.ch != RCHART(':') && curr.ch != RCHART(')') && curr != CHART_INFO(RCHART('('), 1))
-				{
-					int tochange = 0;
+				stack.Push(inst.m_arg);
+				stack.Push(0);
 
-					switch(curr.ch)
-					{
-					case RCHART('i'):
-					case RCHART('I'):
-						tochange = IGNORECASE;
-						break;
+				pc = inst.m_next;
+			}
+			else if(inst.m_opcode == AUTOMATON_SAVE)
+			{
+				stack.Push(-1 - inst.m_arg);
+				stack.Push(pslots[inst.m_arg]);
 
-					case RCHART('s'):
-					case RCHART('S'):
-						tochange = SINGLELINE;
-						break;
+				pslots[inst.m_arg] = npos;
+				pc = inst.m_next;
+			}
+			else if(inst.m_opcode == AUTOMATON_ASSERT)
+			{
+				pTest->m_nCurrentPos = npos;
 
-					case RCHART('m'):
-					case RCHART('M'):
-						tochange = MULTILINE;
-						break;
+				if( ! inst.m_pelx->Match(pTest) )
+					break;
 
-					case RCHART('g'):
-					case RCHART('G'):
-						tochange = GLOBAL;
-						break;
+				pc = inst.m_next;
+			}
+			else
+			{
+				memcpy(pcaps + psparse[pc] * m_nSlots, pslots, sizeof(int) * m_nSlots);
+				break;
+			}
+		}
+	}
+}
 
-					case RCHART('-'):
-						bNegative = 1;
-						break;
-					}
+//
+// All threads a char at a time; a thread that reaches MATCH ends the
+// ones of lower priority.
+//
+template <class CHART> int CAutomatonT <CHART> :: Simulate(CContext * pContext, int start, int bexact) const
+{
+	const CHART * tstring = (const CHART *)pContext->m_pMatchString;
+	int length = pContext->m_pMatchStringLength;
+	int ninst  = m_program.GetSize();
+	int i, npos;
+
+	// threads of this pos and the next: pc, index by pc, captures
+	CBufferT <int> & lists = pContext->m_threads, & caps = pContext->m_threadcaps;
+	CBufferT <int> & stack = pContext->m_stack, & slots = pContext->m_slots;
+
+	lists.Restore(0);
+	lists.Prepare(ninst * 4 - 1, 0);
+	caps .Restore(0);
+	caps .Prepare(ninst * m_nSlots * 2 - 1, -1);
+	slots.Prepare(m_nSlots - 1, -1);
+	stack.Restore(0);
+
+	int * clist   = lists.GetBuffer();
+	int * csparse = clist + ninst;
+	int * nlist   = clist + ninst * 2;
+	int * nsparse = clist + ninst * 3;
+	int * ccaps   = caps.GetBuffer();
+	int * ncaps   = ccaps + ninst * m_nSlots;
+	int   ccount  = 0, ncount = 0;
+
+	int bmatched = 0;
+
+	for(npos = start; ; npos ++)
+	{
+		// a new thread here, after all older ones
+		if( ! bmatched && (npos == start || ! bexact) )
+		{
+			// nothing alive, skip to where a match may begin
+			if(ccount == 0 && ! bexact)
+			{
+				npos = m_pBuilder->FindCandidate(tstring, length, npos);
+				if(npos < 0) break;
+			}
 
-					if(bNegative)
-						newflags &= ~tochange;
-					else
-						newflags |=  tochange;
+			for(i=0; i<m_nSlots; i++) slots[i] = -1;
+			AddThread(0, npos, pContext, slots.GetBuffer(), clist, &ccount, csparse, ccaps, stack);
+		}
 
-					// move to next char
-					MoveNext();
-				}
+		if(ccount == 0)
+			break;
 
-				if(curr.ch == RCHART(':') || curr == CHART_INFO(RCHART('('), 1))
-				{
-					// skip ':'
-					if(curr.ch == RCHART(':')) MoveNext();
+		ncount = 0;
 
-					pElx = BuildAlternative(newflags);
-				}
-				else
-				{
-					// change parent flags
-					flags = newflags;
+		for(i=0; i<ccount; i++)
+		{
+			const INSTRUCTION & inst = m_program[clist[i]];
 
-					pElx = GetStockElx(STOCKELX_EMPTY);
-				}
+			if(npos < length && IsMatchChar(tstring, npos, inst, pContext))
+			{
+				memcpy(slots.GetBuffer(), ccaps + i * m_nSlots, sizeof(int) * m_nSlots);
+				AddThread(inst.m_next, npos + 1, pContext, slots.GetBuffer(), nlist, &ncount, nsparse, ncaps, stack);
+			}
+			else if(inst.m_opcode == AUTOMATON_MATCH && ( ! bexact || npos == length ))
+			{
+				// threads after this one rank lower
+				pContext->m_best.Restore(0);
+				pContext->m_best.Append(ccaps + i * m_nSlots, m_nSlots);
+				bmatched = 1;
+				break;
 			}
-			break;
 		}
 
-		MoveNext(); // skip ')'
+		if(npos >= length)
+			break;
 
-		return pElx;
+		// swap
+		int * t;
+		t = clist  ; clist   = nlist  ; nlist   = t;
+		t = csparse; csparse = nsparse; nsparse = t;
+		t = ccaps  ; ccaps   = ncaps  ; ncaps   = t;
+		ccount = ncount;
 	}
-	else
-	{
-		// group and number
-		CListElx * pList = (CListElx *)Keep(new CListElx(flags & RIGHTTOLEFT));
-		int nThisBackref = ++ m_nMaxNumber;
 
-		// left, center, right
-		pList->m_elxlist.Push(Keep(new CBracketElx(nThisBackref, flags & RIGHTTOLEFT ? 1 : 0)));
-		pList->m_elxlist.Push(BuildAlternative(flags));
-		pList->m_elxlist.Push(Keep(new CBracketElx(nThisBackref, flags & RIGHTTOLEFT ? 0 : 1)));
+	return bmatched;
+}
 
-		// for recursive
-		m_grouplist.Prepare(nThisBackref);
-		m_grouplist[nThisBackref] = pList;
+//
+// Adds the program of other, with MATCH reporting index, to the programs
+// of a set. The elx other's program points to must outlive this one.
+//
+template <class CHART> int CAutomatonT <CHART> :: Append(const CAutomatonT <CHART> & other, int index)
+{
+	if( ! other.IsCompiled() )
+		return 0;
 
-		// right
-		MoveNext(); // skip ')' 
+	int base = m_program.GetSize(), classbase = m_classes.GetSize();
 
-		return pList;
+	m_entries.Push(base);
+	m_entries.Push(index);
+	m_builders.Push(other.m_pBuilder);
+
+	m_classes.Append(other.m_classes.GetBuffer(), other.m_classes.GetSize());
+
+	for(int i=0; i<other.m_program.GetSize(); i++)
+	{
+		INSTRUCTION inst = other.m_program[i];
+
+		inst.m_next += base;
+
+		if(inst.m_opcode == AUTOMATON_SPLIT)
+			inst.m_arg += base;
+		else if(inst.m_opcode == AUTOMATON_CLASS)
+			inst.m_arg += classbase;
+		else if(inst.m_opcode == AUTOMATON_MATCH)
+			inst.m_arg  = index;
+
+		m_program.Push(inst);
 	}
+
+	return 1;
 }
 
-template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildBoundary(int & flags)
+//
+// Adds pc and what it leads to to a set's threads, and marks the
+// patterns whose MATCH it reaches.
+//
+template <class CHART> void CAutomatonT <CHART> :: AddSetThread(int pc, int npos, CContext * pTest, int * plist, int * pcount, int * psparse, int * pmatched, int * pleft, CBufferT <int> & stack) const
 {
-	// char
-	CHART ch = curr.ch;
+	int base = stack.GetSize();
 
-	// skip
-	MoveNext();
+	stack.Push(pc);
 
-	switch(ch)
+	while(stack.GetSize() > base)
 	{
-	case RCHART('^'):
-		return Keep(new CBoundaryElxT <CHART> ((flags & MULTILINE) ? BOUNDARY_LINE_BEGIN : BOUNDARY_FILE_BEGIN));
+		stack.Pop(pc);
 
-	case RCHART('$'):
-		return Keep(new CBoundaryElxT <CHART> ((flags & MULTILINE) ? BOUNDARY_LINE_END : BOUNDARY_FILE_END));
-
-	case RCHART('b'):
-		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_WORD_EDGE));
-
-	case RCHART('B'):
-		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_WORD_EDGE, 0));
+		for(;;)
+		{
+			// already added
+			int index = psparse[pc];
+			if(index < *pcount && plist[index] == pc)
+				break;
 
-	case RCHART('A'):
-		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_FILE_BEGIN));
+			psparse[pc] = *pcount;
+			plist[(*pcount) ++] = pc;
 
-	case RCHART('Z'):
-		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_FILE_END_N));
+			const INSTRUCTION & inst = m_program[pc];
 
-	case RCHART('z'):
-		return Keep(new CBoundaryElxT <CHART> (BOUNDARY_FILE_END));
+			if(inst.m_opcode == AUTOMATON_JUMP || inst.m_opcode == AUTOMATON_SAVE)
+			{
+				pc = inst.m_next;
+			}
+			else if(inst.m_opcode == AUTOMATON_SPLIT)
+			{
+				stack.Push(inst.m_arg);
+				pc = inst.m_next;
+			}
+			else if(inst.m_opcode == AUTOMATON_ASSERT)
+			{
+				pTest->m_nCurrentPos = npos;
 
-	case RCHART('G'):
-		if(flags & GLOBAL)
-			return Keep(new CGlobalElx());
-		else
-			return GetStockElx(STOCKELX_EMPTY);
+				if( ! inst.m_pelx->Match(pTest) )
+					break;
 
-	default:
-		return GetStockElx(STOCKELX_EMPTY);
+				pc = inst.m_next;
+			}
+			else
+			{
+				if(inst.m_opcode == AUTOMATON_MATCH && ! pmatched[inst.m_arg])
+				{
+					pmatched[inst.m_arg] = 1;
+					(*pleft) --;
+				}
+				break;
+			}
+		}
 	}
 }
 
-template <class CHART> ElxInterface * CBuilderT <CHART> :: BuildBackref(int & flags)
+//
+// One pass over the text from m_nCurrentPos for all the programs of a
+// set: sets matched[index] of each pattern that matches anywhere, and
+// returns how many did. Captures and priority don't matter here, so a
+// thread is only a pc, and it stops when every pattern has matched. A
+// pattern only starts threads where its builder finds a candidate, and
+// with no thread alive the pass skips to the nearest one.
+//
+template <class CHART> int CAutomatonT <CHART> :: MatchSet(CContext * pContext, CBufferT <int> & matched) const
 {
-	// skip '\\' or '\k' or '\g'
-	MoveNext();
+	const CHART * tstring = (const CHART *)pContext->m_pMatchString;
+	int length = pContext->m_pMatchStringLength;
+	int ninst  = m_program.GetSize();
+	int nentries = m_entries.GetSize() / 2;
+	int nleft  = 0, nfound = 0, i, npos;
 
-	if(curr.ch == RCHART('<') || curr.ch == RCHART('\''))
+	for(i=0; i<nentries; i++)
 	{
-		CHART named_end = curr.ch == RCHART('<') ? RCHART('>') : RCHART('\'');
-		CBackrefElxT <CHART> * pbackref = (CBackrefElxT <CHART> *)Keep(new CBackrefElxT <CHART> (-1, flags & RIGHTTOLEFT, flags & IGNORECASE));
+		if( ! matched[m_entries[i*2+1]] ) nleft ++;
+	}
+
+	// where each pattern may begin next
+	CBufferT <int> & lists = pContext->m_threads, & stack = pContext->m_stack, & next = pContext->m_slots;
+
+	lists.Restore(0);
+	lists.Prepare(ninst * 4 - 1, 0);
+	stack.Restore(0);
+	next .Restore(0);
+	next .Prepare(nentries - 1, -1);
 
-		MoveNext(); // skip '<' or '\''
+	int * clist   = lists.GetBuffer();
+	int * csparse = clist + ninst;
+	int * nlist   = clist + ninst * 2;
+	int * nsparse = clist + ninst * 3;
+	int   ccount  = 0, ncount = 0;
 
-		// save name
-		CBufferT <CHART> & name = pbackref->m_szNamed;
-		CBufferT <char> num;
+	nfound = nleft;
 
-		while(curr.ch != RCHART(0) && curr.ch != named_end)
+	for(npos = pContext->m_nCurrentPos; nleft > 0 && npos <= length; )
+	{
+		int nnext = length + 1;
+
+		// patterns still missing that may begin here
+		for(i=0; i<nentries; i++)
 		{
-			name.Append(curr.ch, 1);
-			num .Append(((curr.ch & (CHART)0xff) == curr.ch) ? (char)curr.ch : 0, 1);
-			MoveNext();
-		}
-		MoveNext(); // skip '>' or '\''
+			if( matched[m_entries[i*2+1]] )
+				continue;
 
-		// check <num>
-		unsigned int number;
-		char * str = num.GetBuffer();
+			if(next[i] < npos)
+			{
+				next[i] = m_builders[i]->FindCandidate(tstring, length, npos);
+				if(next[i] < 0) next[i] = length + 1;
+			}
 
-		if( ReadDec(str, number) ? ( *str == '\0') : 0 )
-		{
-			pbackref->m_nnumber = number;
-			name.Release();
+			if(next[i] == npos)
+				AddSetThread(m_entries[i*2], npos, pContext, clist, &ccount, csparse, matched.GetBuffer(), &nleft, stack);
+			else if(next[i] < nnext)
+				nnext = next[i];
 		}
-		else
+
+		// nothing alive, skip
+		if(ccount == 0)
 		{
-			m_namedbackreflist.Push(pbackref);
+			npos = nnext;
+			continue;
 		}
 
-		return pbackref;
-	}
-	else
-	{
-		unsigned int nbackref = 0;
+		if(npos >= length)
+			break;
 
-		for(int i=0; i<3; i++)
+		ncount = 0;
+
+		for(i=0; i<ccount; i++)
 		{
-			if(curr.ch >= RCHART('0') && curr.ch <= RCHART('9'))
-				nbackref = nbackref * 10 + (curr.ch - RCHART('0'));
-			else
-				break;
+			const INSTRUCTION & inst = m_program[clist[i]];
 
-			MoveNext();
+			if(IsMatchChar(tstring, npos, inst, pContext))
+				AddSetThread(inst.m_next, npos + 1, pContext, nlist, &ncount, nsparse, matched.GetBuffer(), &nleft, stack);
 		}
 
-		return Keep(new CBackrefElxT <CHART> (nbackref, flags & RIGHTTOLEFT, flags & IGNORECASE));
+		// swap
+		int * t;
+		t = clist  ; clist   = nlist  ; nlist   = t;
+		t = csparse; csparse = nsparse; nsparse = t;
+		ccount = ncount;
+		npos ++;
 	}
+
+	return nfound - nleft;
 }
 
-template <class CHART> int CBuilderT <CHART> :: ReadDec(char * & str, unsigned int & dec)
+//
+// Finds the first match at or after m_nCurrentPos, or with bexact the
+// one spanning the whole text, and leaves it in pContext the way the
+// elx tree would: captures on m_capturestack, m_nCurrentPos at its end.
+//
+template <class CHART> int CAutomatonT <CHART> :: Match(CContext * pContext, int bexact) const
 {
-	int s = 0;
-	while(str[s] != 0 && isspace(str[s])) s++;
+	int length = pContext->m_pMatchStringLength;
+	int start  = pContext->m_nCurrentPos;
+	int i;
 
-	if(str[s] < '0' || str[s] > '9') return 0;
+	if(start < 0 || start > length)
+		return 0;
 
-	dec = 0;
-	unsigned int i;
+	// classes and asserts are tested on pContext, moving m_nCurrentPos
+	int bmatched = length - start + 1 <= m_nMaxVisited / m_program.GetSize() ?
+		Backtrack(pContext, start, bexact) : Simulate(pContext, start, bexact);
 
-	for(i = s; i<sizeof(CHART)*3 + s; i++)
+	if( ! bmatched )
 	{
-		if(str[i] >= '0' && str[i] <= '9')
-			dec = dec * 10 + (str[i] - '0');
-		else
-			break;
+		pContext->m_nCurrentPos = start;
+		return 0;
 	}
 
-	while(str[i] != 0 && isspace(str[i])) i++;
-	str += i;
+	const int * best = pContext->m_best.GetBuffer();
+
+	// as the elx tree leaves them
+	pContext->m_captureindex.Restore(0);
+	pContext->m_capturestack.Restore(0);
+	pContext->m_captureindex.Prepare(m_nMaxNumber, -1);
+
+	for(i=0; i<=m_nMaxNumber; i++)
+	{
+		if(best[i*2] < 0 || best[i*2+1] < 0)
+			continue;
+
+		pContext->m_captureindex[i] = pContext->m_capturestack.GetSize();
+		pContext->m_capturestack.Push(i);
+		pContext->m_capturestack.Push(best[i*2]);
+		pContext->m_capturestack.Push(best[i*2+1]);
+		pContext->m_capturestack.Push(i == 0 ? -1 : 0);
+	}
+
+	pContext->m_nCurrentPos = best[1];
 
 	return 1;
 }
 
+// bits of failed (repeat, pos) pairs one match may keep
+#define REGEX_MAX_FAILED (32 * 1024 * 1024)
+
 //
 // Regexp
 //
@@ -3140,6 +5108,8 @@ public:
 	MatchResult Match(const CHART * tstring, int start = -1, CContext * pContext = 0) const;
 	MatchResult Match(const CHART * tstring, int length, int start, CContext * pContext = 0) const;
 	MatchResult Match(CContext * pContext) const;
+	int IsMatch(const CHART * tstring, CContext * pContext = 0) const;
+	int IsMatch(const CHART * tstring, int length, CContext * pContext = 0) const;
 	CContext * PrepareMatch(const CHART * tstring, int start = -1, CContext * pContext = 0) const;
 	CContext * PrepareMatch(const CHART * tstring, int length, int start, CContext * pContext = 0) const;
 	CHART * Replace(const CHART * tstring, const CHART * replaceto, int start = -1, int ntimes = -1, MatchResult * result = 0, CContext * pContext = 0) const;
@@ -3150,8 +5120,14 @@ public:
 	static void ReleaseString (CHART    * tstring );
 	static void ReleaseContext(CContext * pContext);
 
+protected:
+	int  Search(CContext * pContext) const;
+	void PrepareFailed(CContext * pContext) const;
+
 public:
 	CBuilderT <CHART> m_builder;
+	CAutomatonT <CHART> m_automaton;
+	int m_nMaxSteps;
 };
 
 //
@@ -3175,7 +5151,14 @@ template <class CHART> inline void CRegexpT <CHART> :: Compile(const CHART * pat
 template <class CHART> void CRegexpT <CHART> :: Compile(const CHART * pattern, int length, int flags)
 {
 	m_builder.Clear();
-	if(pattern != 0) m_builder.Build(CBufferRefT<CHART>(pattern, length), flags);
+	m_automaton.Clear();
+	m_nMaxSteps = CStepBudget::m_nDefaultMaxSteps;
+
+	if(pattern != 0)
+	{
+		m_builder.Build(CBufferRefT<CHART>(pattern, length), flags);
+		m_automaton.Compile(m_builder);
+	}
 }
 
 template <class CHART> inline MatchResult CRegexpT <CHART> :: MatchExact(const CHART * tstring, CContext * pContext) const
@@ -3188,6 +5171,10 @@ template <class CHART> MatchResult CRegexpT <CHART> :: MatchExact(const CHART *
 	if(m_builder.m_pTopElx == 0)
 		return 0;
 
+	// no match is that long or that short
+	if(length < m_builder.m_nMinLength || length > m_builder.m_nMaxLength)
+		return 0;
+
 	// info
 	int endpos = 0;
 
@@ -3223,6 +5210,19 @@ template <class CHART> MatchResult CRegexpT <CHART> :: MatchExact(const CHART *
 	pContext->m_capturestack.Push(-1);
 	pContext->m_capturestack.Push(-1);
 
+	pContext->m_nStepsLeft  = m_nMaxSteps > 0 ? m_nMaxSteps : -1;
+	pContext->m_bOverBudget = 0;
+
+	if( m_automaton.IsCompiled() )
+	{
+		if( ! m_automaton.Match(pContext, 1) )
+			return 0;
+
+		return MatchResult( pContext, m_builder.m_nMaxNumber );
+	}
+
+	PrepareFailed(pContext);
+
 	// match
 	if( ! m_builder.m_pTopElx->Match( pContext ) )
 		return 0;
@@ -3232,15 +5232,12 @@ template <class CHART> MatchResult CRegexpT <CHART> :: MatchExact(const CHART *
 		{
 			if( ! m_builder.m_pTopElx->MatchNext( pContext ) )
 				return 0;
-			else
-			{
-				if( pContext->m_nLastBeginPos == pContext->m_nBeginPos && pContext->m_nBeginPos == pContext->m_nCurrentPos )
-					return 0;
-				else
-					pContext->m_nLastBeginPos = pContext->m_nCurrentPos;
-			}
 		}
 
+		// choices were cut short, so it may not be the right match
+		if( pContext->m_bOverBudget )
+			return 0;
+
 		// end pos
 		pContext->m_capturestack[2] = pContext->m_nCurrentPos;
 
@@ -3265,6 +5262,7 @@ template <class CHART> MatchResult CRegexpT <CHART> :: Match(const CHART * tstri
 	pContext->m_nLastBeginPos = -1;
 	pContext->m_pMatchString  = (void*)tstring;
 	pContext->m_pMatchStringLength = length;
+	pContext->m_nFailedRow    = -1;
 
 	if(start < 0)
 	{
@@ -3289,6 +5287,34 @@ template <class CHART> MatchResult CRegexpT <CHART> :: Match(const CHART * tstri
 }
 
 template <class CHART> MatchResult CRegexpT <CHART> :: Match(CContext * pContext) const
+{
+	if( ! Search(pContext) )
+		return 0;
+
+	return MatchResult( pContext, m_builder.m_nMaxNumber );
+}
+
+template <class CHART> inline int CRegexpT <CHART> :: IsMatch(const CHART * tstring, CContext * pContext) const
+{
+	return IsMatch(tstring, CBufferRefT<CHART>(tstring).GetSize(), pContext);
+}
+
+//
+// Match without the MatchResult; with the same pContext every time,
+// it allocates nothing once the context's buffers have grown.
+//
+template <class CHART> int CRegexpT <CHART> :: IsMatch(const CHART * tstring, int length, CContext * pContext) const
+{
+	CContext context;
+	if(pContext == 0) pContext = &context;
+
+	return PrepareMatch(tstring, length, -1, pContext) != 0 && Search(pContext);
+}
+
+//
+// Finds the next match, leaving it in pContext
+//
+template <class CHART> int CRegexpT <CHART> :: Search(CContext * pContext) const
 {
 	if(m_builder.m_pTopElx == 0)
 		return 0;
@@ -3306,8 +5332,49 @@ template <class CHART> MatchResult CRegexpT <CHART> :: Match(CContext * pContext
 		delta  = 1;
 	}
 
+	pContext->m_nStepsLeft  = m_nMaxSteps > 0 ? m_nMaxSteps : -1;
+	pContext->m_bOverBudget = 0;
+
+	if( m_automaton.IsCompiled() )
+	{
+		while( m_automaton.Match(pContext, 0) )
+		{
+			int nbegin = pContext->m_capturestack[1];
+
+			// zero width
+			if( pContext->m_nLastBeginPos == pContext->m_nBeginPos && pContext->m_nBeginPos == pContext->m_nCurrentPos )
+			{
+				pContext->m_nCurrentPos = nbegin + 1;
+				continue;
+			}
+
+			pContext->m_nLastBeginPos = pContext->m_nBeginPos;
+			pContext->m_nBeginPos     = pContext->m_nCurrentPos;
+
+			return 1;
+		}
+
+		pContext->m_nCurrentPos = endpos;
+		return 0;
+	}
+
+	// failures stay known across the searches of a text
+	if( pContext->m_nFailedRow < 0 )
+		PrepareFailed(pContext);
+
 	while(pContext->m_nCurrentPos != endpos)
 	{
+		// skip to where a match may begin
+		int ncandidate = m_builder.FindCandidate((const CHART *)pContext->m_pMatchString, pContext->m_pMatchStringLength, pContext->m_nCurrentPos);
+
+		if(ncandidate < 0)
+		{
+			pContext->m_nCurrentPos = endpos;
+			break;
+		}
+
+		pContext->m_nCurrentPos = ncandidate;
+
 		pContext->m_captureindex.Restore(0);
 		pContext->m_stack       .Restore(0);
 		pContext->m_capturestack.Restore(0);
@@ -3321,6 +5388,13 @@ template <class CHART> MatchResult CRegexpT <CHART> :: Match(CContext * pContext
 
 		if( m_builder.m_pTopElx->Match( pContext ) )
 		{
+			// choices were cut short, so it may not be the right match
+			if( pContext->m_bOverBudget )
+			{
+				pContext->m_nCurrentPos = endpos;
+				break;
+			}
+
 			// zero width
 			if( pContext->m_nLastBeginPos == pContext->m_nBeginPos && pContext->m_nBeginPos == pContext->m_nCurrentPos )
 			{
@@ -3334,7 +5408,12 @@ template <class CHART> MatchResult CRegexpT <CHART> :: Match(CContext * pContext
 			pContext->m_capturestack[2] = pContext->m_nCurrentPos;
 
 			// return
-			return MatchResult( pContext, m_builder.m_nMaxNumber );
+			return 1;
+		}
+		else if( pContext->m_bOverBudget )
+		{
+			pContext->m_nCurrentPos = endpos;
+			break;
 		}
 		else
 		{
@@ -3345,6 +5424,24 @@ template <class CHART> MatchResult CRegexpT <CHART> :: Match(CContext * pContext
 	return 0;
 }
 
+//
+// Clears pContext's failed pairs for a new text, or turns them off
+//
+template <class CHART> void CRegexpT <CHART> :: PrepareFailed(CContext * pContext) const
+{
+	int nrow = pContext->m_pMatchStringLength + 1;
+
+	if(m_builder.m_nMemoCount == 0 || m_builder.m_nMemoCount > REGEX_MAX_FAILED / nrow)
+	{
+		pContext->m_nFailedRow = 0;
+		return;
+	}
+
+	pContext->m_nFailedRow = nrow;
+	pContext->m_failed.Restore(0);
+	pContext->m_failed.Prepare((m_builder.m_nMemoCount * nrow) / 32, 0);
+}
+
 template <class CHART> inline CContext * CRegexpT <CHART> :: PrepareMatch(const CHART * tstring, int start, CContext * pContext) const
 {
 	return PrepareMatch(tstring, CBufferRefT<CHART>(tstring).GetSize(), start, pContext);
@@ -3361,6 +5458,7 @@ template <class CHART> CContext * CRegexpT <CHART> :: PrepareMatch(const CHART *
 	pContext->m_nLastBeginPos = -1;
 	pContext->m_pMatchString  = (void*)tstring;
 	pContext->m_pMatchStringLength = length;
+	pContext->m_nFailedRow    = -1;
 
 	if(start < 0)
 	{
@@ -3690,6 +5788,120 @@ template <class CHART> inline void CRegexpT <CHART> :: ReleaseContext(CContext *
 	if(pContext != 0) delete pContext;
 }
 
+//
+// Regexp set
+//
+// Tells which of many patterns match a text. The ones the automaton
+// compiles are appended to one combined program and run together in a
+// single pass over the text; the others are matched one by one.
+//
+template <class CHART> class CRegexSetT
+{
+public:
+	int Add(const CHART * pattern, int flags = 0);
+	int Add(const CHART * pattern, int length, int flags);
+	int GetSize() const;
+	const CRegexpT <CHART> & GetRegexp(int index) const;
+
+public:
+	int Match(const CHART * tstring, CBufferT <int> & matched, CContext * pContext = 0) const;
+	int Match(const CHART * tstring, int length, CBufferT <int> & matched, CContext * pContext = 0) const;
+
+public:
+	CRegexSetT();
+	~CRegexSetT();
+
+protected:
+	CRegexSetT(const CRegexSetT <CHART> &);
+	CRegexSetT <CHART> & operator = (const CRegexSetT <CHART> &);
+
+public:
+	CBufferT <CRegexpT <CHART> *> m_regexps;
+	CAutomatonT <CHART> m_combined;
+};
+
+//
+// Implementation
+//
+template <class CHART> CRegexSetT <CHART> :: CRegexSetT()
+{
+}
+
+template <class CHART> CRegexSetT <CHART> :: ~CRegexSetT()
+{
+	for(int i=0; i<m_regexps.GetSize(); i++)
+		delete m_regexps[i];
+}
+
+template <class CHART> inline int CRegexSetT <CHART> :: Add(const CHART * pattern, int flags)
+{
+	return Add(pattern, CBufferRefT<CHART>(pattern).GetSize(), flags);
+}
+
+//
+// returns the index of the pattern
+//
+template <class CHART> int CRegexSetT <CHART> :: Add(const CHART * pattern, int length, int flags)
+{
+	CRegexpT <CHART> * pRegexp = new CRegexpT <CHART> (pattern, length, flags);
+
+	m_regexps.Push(pRegexp);
+	m_combined.Append(pRegexp->m_automaton, m_regexps.GetSize() - 1);
+
+	return m_regexps.GetSize() - 1;
+}
+
+template <class CHART> inline int CRegexSetT <CHART> :: GetSize() const
+{
+	return m_regexps.GetSize();
+}
+
+template <class CHART> inline const CRegexpT <CHART> & CRegexSetT <CHART> :: GetRegexp(int index) const
+{
+	return * m_regexps[index];
+}
+
+template <class CHART> inline int CRegexSetT <CHART> :: Match(const CHART * tstring, CBufferT <int> & matched, CContext * pContext) const
+{
+	return Match(tstring, CBufferRefT<CHART>(tstring).GetSize(), matched, pContext);
+}
+
+//
+// matched[i] is set to 1 if pattern i matches somewhere in tstring, else
+// 0; returns how many matched
+//
+template <class CHART> int CRegexSetT <CHART> :: Match(const CHART * tstring, int length, CBufferT <int> & matched, CContext * pContext) const
+{
+	CContext context;
+	if(pContext == 0) pContext = &context;
+
+	int i, nfound = 0;
+
+	matched.Restore(0);
+	matched.Prepare(m_regexps.GetSize() - 1, 0);
+
+	for(i=0; i<m_regexps.GetSize(); i++)
+	{
+		if( ! m_regexps[i]->m_automaton.IsCompiled() && m_regexps[i]->IsMatch(tstring, length, pContext) )
+		{
+			matched[i] = 1;
+			nfound ++;
+		}
+	}
+
+	if( m_combined.IsCompiled() )
+	{
+		pContext->m_pMatchString       = (void*)tstring;
+		pContext->m_pMatchStringLength = length;
+		pContext->m_nBeginPos          = 0;
+		pContext->m_nCurrentPos        = 0;
+
+		nfound += m_combined.MatchSet(pContext, matched);
+	}
+
+	return nfound;
+}
+
 //
 // All implementations
 //
@@ -3705,7 +5917,7 @@ template <int x> int CAlternativeElxT <x> :: Match(CContext * pContext) const
 	// try all
 	for(int n = 0; n < m_elxlist.GetSize(); n++)
 	{
-		if(m_elxlist[n]->Match(pContext))
+		if(pContext->Step() && m_elxlist[n]->Match(pContext))
 		{
 			pContext->m_stack.Push(n);
 			return 1;
@@ -3736,7 +5948,7 @@ template <int x> int CAlternativeElxT <x> :: MatchNext(CContext * pContext) cons
 		// try rest
 		for(n++; n < m_elxlist.GetSize(); n++)
 		{
-			if(m_elxlist[n]->Match(pContext))
+			if(pContext->Step() && m_elxlist[n]->Match(pContext))
 			{
 				pContext->m_stack.Push(n);
 				return 1;
@@ -3862,19 +6074,44 @@ template <int x> int CGreedyElxT <x> :: MatchNext(CContext * pContext) const
 
 template <int x> int CGreedyElxT <x> :: MatchVart(CContext * pContext) const
 {
-	int n      = 0;
+	return MatchVartFrom(pContext, 0);
+}
+
+template <int x> int CGreedyElxT <x> :: MatchVartFrom(CContext * pContext, int n) const
+{
 	int nbegin = pContext->m_nCurrentPos;
 
-	while(n < m_nvart && CRepeatElxT <x> :: m_pelx->Match(pContext))
+	while(n < m_nvart && pContext->Step() && CRepeatElxT <x> :: m_pelx->Match(pContext))
 	{
-		while(pContext->m_nCurrentPos == nbegin)
+		int bfailed = 0, bmatch = 1;
+
+		for(;;)
 		{
-			if( ! CRepeatElxT <x> :: m_pelx->MatchNext(pContext) ) break;
+			// an empty one after a known failure is the last, as MatchNextVart would take it
+			if(pContext->m_nCurrentPos == nbegin)
+			{
+				if(bfailed) break;
+			}
+			else if(pContext->IsFailed(CRepeatElxT <x> :: m_nmemo, pContext->m_nCurrentPos))
+				bfailed = 1;
+			else
+				break;
+
+			if( ! CRepeatElxT <x> :: m_pelx->MatchNext(pContext) )
+			{
+				bmatch = 0;
+				break;
+			}
 		}
 
-		if(pContext->m_nCurrentPos == nbegin) break;
+		if( ! bmatch ) break;
+
+		pContext->m_stack.Push(nbegin);
 
 		n ++;
+
+		if(pContext->m_nCurrentPos == nbegin) break;
+
 		nbegin = pContext->m_nCurrentPos;
 	}
 
@@ -3885,16 +6122,40 @@ template <int x> int CGreedyElxT <x> :: MatchVart(CContext * pContext) const
 
 template <int x> int CGreedyElxT <x> :: MatchNextVart(CContext * pContext) const
 {
-	int n = 0;
+	int n = 0, nbegin = 0;
 	pContext->m_stack.Pop(n);
 
 	if(n == 0) return 0;
 
-	if( ! CRepeatElxT <x> :: m_pelx->MatchNext(pContext) )
+	pContext->m_stack.Pop(nbegin);
+
+	// more from here and the rest from here have both failed,
+	// unless the last one was empty and nothing followed it
+	if(pContext->m_nCurrentPos != nbegin)
+		pContext->SetFailed(CRepeatElxT <x> :: m_nmemo, pContext->m_nCurrentPos);
+
+	// the last one another way: an empty one ends the repeat,
+	// a longer one is followed by as many more as possible
+	while( CRepeatElxT <x> :: m_pelx->MatchNext(pContext) )
 	{
-		n --;
+		if(pContext->m_nCurrentPos == nbegin)
+		{
+			pContext->m_stack.Push(nbegin);
+			pContext->m_stack.Push(n);
+
+			return 1;
+		}
+
+		if( ! pContext->IsFailed(CRepeatElxT <x> :: m_nmemo, pContext->m_nCurrentPos) )
+		{
+			pContext->m_stack.Push(nbegin);
+
+			return MatchVartFrom(pContext, n);
+		}
 	}
 
+	n --;
+
 	pContext->m_stack.Push(n);
 
 	return 1;
@@ -4045,6 +6306,14 @@ template <int x> MatchResultT <x> :: MatchResultT(CContext * pContext, int nMaxN
 		for(int n = 0; n <= nMaxNumber; n++)
 		{
 			int index = pContext->m_captureindex[n];
+
+			// an atomic group given up leaves it past the stack, take the one before
+			if( index >= pContext->m_capturestack.GetSize() )
+				index  = pContext->m_capturestack.GetSize() - 4;
+
+			while( index >= 0 && pContext->m_capturestack[index] != n )
+				index -= 4;
+
 			if( index < 0 ) continue;
 
 			// check enclosed
@@ -4100,6 +6369,7 @@ template <int x> MatchResultT <x> & MatchResultT <x> :: operator = (const MatchR
 //
 template <int x> CPossessiveElxT <x> :: CPossessiveElxT(ElxInterface * pelx, int nmin, int nmax) : CGreedyElxT <x> (pelx, nmin, nmax)
 {
+	m_bimplied = 0;
 }
 
 template <int x> int CPossessiveElxT <x> :: Match(CContext * pContext) const
@@ -4202,9 +6472,9 @@ template <int x> int CReluctantElxT <x> :: MatchNextVart(CContext * pContext) co
 
 	pContext->m_stack.Pop(n);
 
-	if(n < m_nvart && CRepeatElxT <x> :: m_pelx->Match(pContext))
+	if(n < m_nvart && pContext->Step() && CRepeatElxT <x> :: m_pelx->Match(pContext))
 	{
-		while(pContext->m_nCurrentPos == nbegin)
+		while(pContext->m_nCurrentPos == nbegin || pContext->IsFailed(CRepeatElxT <x> :: m_nmemo, pContext->m_nCurrentPos))
 		{
 			if( ! CRepeatElxT <x> :: m_pelx->MatchNext(pContext) ) break;
 		}
@@ -4222,11 +6492,14 @@ template <int x> int CReluctantElxT <x> :: MatchNextVart(CContext * pContext) co
 
 	while(n > 0)
 	{
+		// the rest from here and more from here have both failed
+		pContext->SetFailed(CRepeatElxT <x> :: m_nmemo, pContext->m_nCurrentPos);
+
 		pContext->m_stack.Pop(nbegin);
 
 		while( CRepeatElxT <x> :: m_pelx->MatchNext(pContext) )
 		{
-			if(pContext->m_nCurrentPos != nbegin)
+			if(pContext->m_nCurrentPos != nbegin && ! pContext->IsFailed(CRepeatElxT <x> :: m_nmemo, pContext->m_nCurrentPos))
 			{
 				pContext->m_stack.Push(nbegin);
 				pContext->m_stack.Push(n);
@@ -4247,6 +6520,7 @@ template <int x> CRepeatElxT <x> :: CRepeatElxT(ElxInterface * pelx, int ntimes)
 {
 	m_pelx   = pelx;
 	m_nfixed = ntimes;
+	m_nmemo  = -1;
 }
 
 template <int x> int CRepeatElxT <x> :: Match(CContext * pContext) const
@@ -4333,6 +6607,9 @@ template <int x> int CRepeatElxT <x> :: MatchNextFixed(CContext * pContext) cons
 typedef CRegexpT <char> CRegexpA;
 typedef CRegexpT <unsigned short> CRegexpW;
 
+typedef CRegexSetT <char> CRegexSetA;
+typedef CRegexSetT <unsigned short> CRegexSetW;
+
 #if defined(_UNICODE) || defined(UNICODE)
 	typedef CRegexpW CRegexp;
 #else
@@ -0,0 +1,513 @@
+#ifndef __QUNIT_PRIVATE_FUZZ__
+#define __QUNIT_PRIVATE_FUZZ__
+
+#ifdef X_OS_WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// ----------------------------------------------------------------------------
+// Fuzz targets for qfuzz.
+//
+// A target's corpus lives in $QUNIT_CORPUS/<name> (corpus/<name> by
+// default), one input per file. A normal run replays the empty input
+// and every file there as cases of the target. With --fuzz=seconds the
+// runner instead mutates the corpus for that long, or until an input
+// fails or crashes, which is saved as crash-<hash>; inputs that reach
+// new code are saved as <hash>. New code is only noticed when the tests
+// are built with QUNIT_FUZZ_COVERAGE defined and -fsanitize-coverage=
+// trace-pc-guard (clang) or trace-pc (gcc).
+//
+// Defining QUNIT_LIBFUZZER turns a qfuzz target into the binary's
+// LLVMFuzzerTestOneInput instead, for a libFuzzer build; such a binary
+// holds a single target and no main().
+
+#ifndef QUNIT_FUZZ_MAX_LEN
+#define QUNIT_FUZZ_MAX_LEN 4096
+#endif
+
+#if defined(__clang__)
+#define QUNIT_NO_COVERAGE __attribute__((no_sanitize("coverage")))
+#elif defined(__GNUC__) && __GNUC__ >= 12
+#define QUNIT_NO_COVERAGE __attribute__((no_sanitize_coverage))
+#else
+#define QUNIT_NO_COVERAGE
+#endif
+
+namespace QUnit { namespace PrivateHelper
+{
+	typedef void (*QFuzzBody)(QRunCookie* cookie, const unsigned char* data, size_t size);
+
+	// code edges seen for the first time, counted by the coverage hooks
+	QUNIT_NO_COVERAGE inline
+	volatile long& new_edges()
+	{
+		static volatile long count = 0;
+		return count;
+	}
+
+	inline
+	std::vector<std::string> list_files(const std::string& dir)
+	{
+		std::vector<std::string> files;
+#ifdef X_OS_WIN32
+		WIN32_FIND_DATAA found;
+		HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &found);
+		if (h == INVALID_HANDLE_VALUE)
+			return files;
+		do
+		{
+			if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+				files.push_back(found.cFileName);
+		} while (FindNextFileA(h, &found));
+		FindClose(h);
+#else
+		DIR* d = opendir(dir.c_str());
+		if (d == NULL)
+			return files;
+		while (struct dirent* entry = readdir(d))
+		{
+			if (entry->d_name[0] != '.')
+				files.push_back(entry->d_name);
+		}
+		closedir(d);
+#endif
+		std::sort(files.begin(), files.end());
+		return files;
+	}
+
+	inline
+	void make_dirs(const std::string& path)
+	{
+		for (size_t i = 1; i <= path.size(); ++i)
+		{
+			if (i < path.size() && path[i] != '/' && path[i] != '\\')
+				continue;
+#ifdef X_OS_WIN32
+			CreateDirectoryA(path.substr(0, i).c_str(), NULL);
+#else
+			mkdir(path.substr(0, i).c_str(), 0777);
+#endif
+		}
+	}
+
+	// FNV-1a, as the file name of a saved input
+	inline
+	std::string input_name(const unsigned char* data, size_t size)
+	{
+		QUInt64 h = (QUInt64)0xCBF29CE4 << 32 | 0x84222325;
+		for (size_t i = 0; i < size; ++i)
+			h = (h ^ data[i]) * ((QUInt64)0x100 << 32 | 0x1B3);
+
+		char name[17];
+		for (int i = 15; i >= 0; --i, h >>= 4)
+			name[i] = "0123456789abcdef"[h & 0xf];
+		name[16] = 0;
+		return name;
+	}
+
+	inline
+	std::string save_input(const std::string& dir, const char* prefix,
+		const unsigned char* data, size_t size)
+	{
+		make_dirs(dir);
+		std::string path = dir + "/" + prefix + input_name(data, size);
+		FILE* f = fopen(path.c_str(), "wb");
+		if (f != NULL)
+		{
+			fwrite(data, 1, size, f);
+			fclose(f);
+		}
+		return path;
+	}
+
+	// What a fuzzing session shares between the runner and the process
+	// doing the fuzzing, which may die at any moment: the counters and
+	// the input being executed.
+	struct QFuzzState
+	{
+		volatile long executions;
+		volatile long new_inputs;
+		volatile long crashed;
+		char crash[512];
+		volatile size_t size;
+		unsigned char data[QUNIT_FUZZ_MAX_LEN];
+	};
+
+
+	class QFuzzRun : public QRun
+	{
+		std::string m_name;
+		QFuzzBody m_body;
+		std::vector<std::string> m_files;
+		bool m_listed;
+
+		void list()
+		{
+			if (m_listed)
+				return;
+			m_files = list_files(corpus());
+			m_listed = true;
+		}
+
+	public:
+		QFuzzRun(const char* name, QFuzzBody body)
+		{
+			m_name = name;
+			m_body = body;
+			m_listed = false;
+		}
+
+		static std::vector<QFuzzRun*>& all()
+		{
+			static std::vector<QFuzzRun*> targets;
+			return targets;
+		}
+
+		const std::string& name() const
+		{
+			return m_name;
+		}
+		QFuzzBody body() const
+		{
+			return m_body;
+		}
+		std::string corpus() const
+		{
+			const char* base = getenv("QUNIT_CORPUS");
+			return std::string(base != NULL ? base : "corpus") + "/" + m_name;
+		}
+
+		// case 0 is the empty input, case i the i-th corpus file
+		int cases()
+		{
+			list();
+			return 1 + (int)m_files.size();
+		}
+
+		void run(QRunCookie* cookie)
+		{
+			list();
+			if (cookie->__param == 0)
+			{
+				m_body(cookie, (const unsigned char*)"", 0);
+				return;
+			}
+
+			std::string path = corpus() + "/" + m_files[cookie->__param - 1];
+			QMappedFile input(path.c_str());
+			if (!input.is_open())
+				throw "can't open " + path;
+			try
+			{
+				m_body(cookie, (const unsigned char*)input.data(), input.size());
+			}
+			catch (QFailure& e)
+			{
+				e.condition = path + ": " + e.condition;
+				throw;
+			}
+			catch (const std::exception& e)
+			{
+				throw path + ": " + e.what();
+			}
+			catch (const char* e)
+			{
+				throw path + ": " + e;
+			}
+			catch (const std::string& e)
+			{
+				throw path + ": " + e;
+			}
+		}
+	};
+
+	template<class Target> inline
+	QRun* add_fuzz_target(const char* testcase, const char* name)
+	{
+		static QFuzzRun run(name, &Target::run);
+		QFuzzRun::all().push_back(&run);
+		QModule::inst().add_test(testcase, name, &run);
+		return &run;
+	}
+
+
+	// a few libFuzzer-style byte mutations, spliced with other inputs
+	inline
+	void mutate(QRandom& random, std::string& input, const std::vector<std::string>& corpus)
+	{
+		static const unsigned char interesting[] = {0, 1, 0x7f, 0x80, 0xff};
+
+		int count = 1 + (int)random.below(4);
+		for (int n = 0; n < count; ++n)
+		{
+			size_t at = input.empty() ? 0 : (size_t)random.below(input.size());
+			switch (random.below(input.empty() ? 1 : 7))
+			{
+			case 0:
+				if (input.size() < QUNIT_FUZZ_MAX_LEN)
+					input.insert(at, 1, (char)random.below(256));
+				break;
+			case 1:
+				input[at] ^= (char)(1 << random.below(8));
+				break;
+			case 2:
+				input[at] = (char)random.below(256);
+				break;
+			case 3:
+				input[at] = (char)interesting[random.below(sizeof(interesting))];
+				break;
+			case 4:
+				input.erase(at, 1 + (size_t)random.below(input.size() - at));
+				break;
+			case 5:
+				{
+					size_t from = (size_t)random.below(input.size());
+					size_t length = 1 + (size_t)random.below(input.size() - from);
+					if (input.size() + length <= QUNIT_FUZZ_MAX_LEN)
+						input.insert(at, input.substr(from, length));
+				}
+				break;
+			case 6:
+				{
+					const std::string& other = corpus[(size_t)random.below(corpus.size())];
+					if (!other.empty())
+						input = input.substr(0, at) + other.substr((size_t)random.below(other.size()));
+				}
+				break;
+			}
+		}
+		if (input.size() > QUNIT_FUZZ_MAX_LEN)
+			input.resize(QUNIT_FUZZ_MAX_LEN);
+	}
+
+	inline
+	void note_crash(QFuzzState* state, const std::string& dir)
+	{
+		std::string path = save_input(dir, "crash-", state->data, state->size);
+		strncpy(state->crash, path.c_str(), sizeof(state->crash) - 1);
+		state->crash[sizeof(state->crash) - 1] = 0;
+		state->crashed = 1;
+	}
+
+	// Mutates the target's corpus until deadline. A body that fails or
+	// throws has its input saved on the spot; one that kills the process
+	// leaves it in state for the runner to save.
+	inline
+	void fuzz_loop(QFuzzRun& target, QInt64 deadline, QUInt64 seed, QFuzzState* state)
+	{
+		std::string dir = target.corpus();
+		std::vector<std::string> corpus;
+		std::vector<std::string> files = list_files(dir);
+		for (size_t i = 0; i < files.size(); ++i)
+		{
+			if (files[i].compare(0, 6, "crash-") == 0)
+				continue;
+			QMappedFile input((dir + "/" + files[i]).c_str());
+			std::string content(input.data() != NULL ? input.data() : "", input.size());
+			if (content.size() > QUNIT_FUZZ_MAX_LEN)
+				content.resize(QUNIT_FUZZ_MAX_LEN);
+			corpus.push_back(content);
+		}
+		if (corpus.empty())
+			corpus.push_back(std::string());
+
+		QRandom random(seed);
+		long edges = new_edges();
+		for (long n = 0; (n & 15) != 0 || now_ns() < deadline; ++n)
+		{
+			std::string input = corpus[(size_t)random.below(corpus.size())];
+			mutate(random, input, corpus);
+
+			// an exact-size copy, so overreads show up under sanitizers
+			state->size = input.size();
+			memcpy(state->data, input.data(), input.size());
+			unsigned char* data = new unsigned char[input.size() + 1];
+			memcpy(data, input.data(), input.size());
+
+			bool failed = true;
+			try
+			{
+				QRunCookie cookie;
+				target.body()(&cookie, data, input.size());
+				failed = false;
+			}
+			catch (...)
+			{
+			}
+			delete[] data;
+			++state->executions;
+
+			if (failed)
+			{
+				note_crash(state, dir);
+				return;
+			}
+			if (new_edges() != edges)
+			{
+				edges = new_edges();
+				corpus.push_back(input);
+				save_input(dir, "", state->data, state->size);
+				++state->new_inputs;
+			}
+		}
+	}
+
+	inline
+	QResult fuzz_target(QFuzzRun& target, const QTest& test, int seconds)
+	{
+		QInt64 start = now_ns();
+		QInt64 deadline = start + (QInt64)seconds * 1000000000;
+		QUInt64 seed = (QUInt64)start;
+
+		QFuzzState local;
+		QFuzzState* state = &local;
+#ifdef X_OS_UNIX
+		// fuzz in a child process, so an input that kills it can still be
+		// saved by the runner
+		void* shared = mmap(NULL, sizeof(QFuzzState), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (shared != MAP_FAILED)
+			state = (QFuzzState*)shared;
+#endif
+		memset(state, 0, sizeof(QFuzzState));
+
+#ifdef X_OS_UNIX
+		pid_t pid = -1;
+		if (state != &local)
+		{
+			fflush(stdout);
+			fflush(stderr);
+			pid = fork();
+			if (pid == 0)
+			{
+				fuzz_loop(target, deadline, seed, state);
+				_exit(0);
+			}
+		}
+		if (pid > 0)
+		{
+			int status = 0;
+			while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+				;
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				note_crash(state, target.corpus());
+		}
+		else
+#endif
+			fuzz_loop(target, deadline, seed, state);
+
+		QResult result(test);
+		result.duration_ns = now_ns() - start;
+		result.executions = state->executions;
+		result.new_inputs = state->new_inputs;
+		if (state->crashed)
+		{
+			result.type = QResult::error;
+			result.msg = std::string("crashing input saved as ") + state->crash;
+		}
+
+#ifdef X_OS_UNIX
+		if (state != &local)
+			munmap(state, sizeof(QFuzzState));
+#endif
+		return result;
+	}
+
+	// the body of a qfuzz target in a libFuzzer build
+	inline
+	int fuzz_one(QFuzzBody body, const unsigned char* data, size_t size)
+	{
+		try
+		{
+			QRunCookie cookie;
+			body(&cookie, data, size);
+		}
+		catch (const QFailure& e)
+		{
+			fprintf(stderr, "%s:%d: %s\n", e.file.c_str(), e.line, e.condition.c_str());
+			abort();
+		}
+		catch (...)
+		{
+			fprintf(stderr, "qfuzz: uncaught exception\n");
+			abort();
+		}
+		return 0;
+	}
+}}
+
+namespace QUnit
+{
+	// Fuzzes every qfuzz target among tests for the given number of
+	// seconds each, reporting one result per target to the host.
+	inline
+	void fuzz(QRunHost* host, const QTests& tests, int seconds)
+	{
+		using namespace PrivateHelper;
+
+		std::vector<QFuzzRun*>& targets = QFuzzRun::all();
+		for (size_t t = 0; t < targets.size(); ++t)
+		{
+			const QTest* selected = NULL;
+			for (size_t i = 0; i < tests.size() && selected == NULL; ++i)
+			{
+				if (tests[i].run == targets[t] && is_selected(host, tests[i]))
+					selected = &tests[i];
+			}
+			if (selected == NULL)
+				continue;
+
+			QTest test = *selected;
+			test.name = targets[t]->name();
+			host->started(test);
+			host->done(fuzz_target(*targets[t], test, seconds));
+		}
+	}
+}
+
+#if defined(QUNIT_FUZZ_COVERAGE) && defined(X_CC_GCC) && !defined(QUNIT_LIBFUZZER)
+// Weak, so a sanitizer or fuzzing runtime that brings its own wins.
+// trace-pc-guard numbers each edge; trace-pc only gives its address,
+// which is hashed into a bitmap of edges seen.
+extern "C" QUNIT_NO_COVERAGE __attribute__((weak))
+void __sanitizer_cov_trace_pc_guard_init(unsigned int* start, unsigned int* stop)
+{
+	static unsigned int guards = 0;
+	if (start == stop || *start != 0)
+		return;
+	for (unsigned int* guard = start; guard < stop; ++guard)
+		*guard = ++guards;
+}
+
+extern "C" QUNIT_NO_COVERAGE __attribute__((weak))
+void __sanitizer_cov_trace_pc_guard(unsigned int* guard)
+{
+	if (*guard == 0)
+		return;
+	*guard = 0;
+	++QUnit::PrivateHelper::new_edges();
+}
+
+extern "C" QUNIT_NO_COVERAGE __attribute__((weak))
+void __sanitizer_cov_trace_pc()
+{
+	static unsigned char seen[1 << 16];
+	size_t pc = (size_t)__builtin_return_address(0);
+	size_t h = (pc ^ (pc >> 16)) & ((1 << 19) - 1);
+	if (seen[h >> 3] & (1 << (h & 7)))
+		return;
+	seen[h >> 3] |= (unsigned char)(1 << (h & 7));
+	++QUnit::PrivateHelper::new_edges();
+}
+#endif
+
+// ----------------------------------------------------------------------------
+#endif // __QUNIT_PRIVATE_FUZZ__
@@ -5,9 +5,20 @@
 #include <alloca.h>
 #endif
 
+#ifdef X_OS_WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sstream>
+#include <vector>
+#include <algorithm>
 
 
 	
@@ -18,16 +29,31 @@
 #endif
 
 
+namespace QUnit
+{
+#ifdef X_CC_VC
+	typedef __int64 QInt64;
+	typedef unsigned __int64 QUInt64;
+#else
+	typedef long long QInt64;
+	typedef unsigned long long QUInt64;
+#endif
+}
+
 namespace QUnit { namespace PrivateHelper
 {
+	// state of one execution of a test; tests running side by side on
+	// different workers each have their own
 	class QRunCookie
 	{
 	public:
 		int __assertion_counter;
+		int __param;
 	public:
-		QRunCookie()
+		QRunCookie(int param = -1)
 		{
 			__initialize_cookie();
+			__param = param;
 		}
 		void __initialize_cookie()
 		{
@@ -67,6 +93,52 @@ namespace QUnit { namespace PrivateHelper
 		return to_s(std::wstring(value));
 	}
 
+	template<class A, class B> inline
+	std::string to_s(const std::pair<A, B>& value);
+
+	template<class T> inline
+	std::string to_s(const std::vector<T>& value)
+	{
+		std::string s = "[";
+		for (size_t i = 0; i < value.size(); ++i)
+		{
+			if (i > 0)
+				s += ", ";
+			s += to_s(value[i]);
+		}
+		return s + "]";
+	}
+
+	template<class A, class B> inline
+	std::string to_s(const std::pair<A, B>& value)
+	{
+		return "(" + to_s(value.first) + ", " + to_s(value.second) + ")";
+	}
+
+	// length of the UTF-8 sequence at p, 0 if it is malformed.
+	inline
+	int utf8_length(const unsigned char* p, const unsigned char* e)
+	{
+		int n;
+		if ((*p & 0xE0) == 0xC0 && *p >= 0xC2)
+			n = 2;
+		else if ((*p & 0xF0) == 0xE0)
+			n = 3;
+		else if ((*p & 0xF8) == 0xF0 && *p <= 0xF4)
+			n = 4;
+		else
+			return 0;
+
+		if (e - p < n)
+			return 0;
+		for (int i = 1; i < n; ++i)
+		{
+			if ((p[i] & 0xC0) != 0x80)
+				return 0;
+		}
+		return n;
+	}
+
 
 
 	template<class L, class R> inline 
@@ -117,6 +189,212 @@ namespace QUnit { namespace PrivateHelper
 		return wcscmp(l, r) == 0;
 	}
 
+
+	// monotonic clock in nanoseconds, only differences are meaningful.
+	inline
+	QInt64 now_ns()
+	{
+#ifdef X_OS_WIN32
+		static LARGE_INTEGER freq;
+		if (freq.QuadPart == 0)
+			QueryPerformanceFrequency(&freq);
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		return (QInt64)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (QInt64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+	}
+
+	inline
+	bool is_terminal(FILE* file)
+	{
+#ifdef X_OS_WIN32
+		return _isatty(_fileno(file)) != 0;
+#else
+		return isatty(fileno(file)) != 0;
+#endif
+	}
+
+	inline
+	void compiler_barrier()
+	{
+#if defined(X_CC_GCC)
+		__asm__ __volatile__("" ::: "memory");
+#elif defined(X_CC_VC)
+		_ReadWriteBarrier();
+#endif
+	}
+
+
+	// Drives the repeated measurement behind qassert_faster_than:
+	// calibrates a batch size so one batch is well above timer resolution,
+	// discards warmup batches, then samples until the median settles or
+	// the time cap is hit. Samples are per-call nanoseconds.
+	class QLatencyMeter
+	{
+	public:
+		enum
+		{
+			min_batch_ns	= 20000,
+			max_batch		= 1 << 24,
+			warmup_batches	= 3,
+			min_samples		= 7,
+			max_samples		= 201,
+			check_every		= 8
+		};
+
+		QLatencyMeter(QInt64 budget_ns, QInt64 time_cap_ns = 500000000)
+		{
+			m_budget = budget_ns;
+			m_cap = time_cap_ns;
+			m_batch = 1;
+			m_calibrating = true;
+			m_warmup = warmup_batches;
+			m_started = now_ns();
+			m_last_median = -1;
+			m_done = false;
+		}
+
+		bool next_batch() const
+		{
+			return !m_done;
+		}
+		int batch() const
+		{
+			return m_batch;
+		}
+
+		void record(QInt64 elapsed_ns)
+		{
+			bool over_time = now_ns() - m_started > m_cap;
+
+			if (m_calibrating)
+			{
+				if (elapsed_ns < min_batch_ns && m_batch < max_batch && !over_time)
+				{
+					m_batch *= 2;
+					return;
+				}
+				m_calibrating = false;
+			}
+			else if (m_warmup > 0 && !over_time)
+			{
+				--m_warmup;
+				return;
+			}
+
+			m_samples.push_back((double)elapsed_ns / m_batch);
+			int n = (int)m_samples.size();
+
+			if (n >= max_samples || (over_time && n >= 1))
+			{
+				finish();
+				return;
+			}
+			if (n >= min_samples && n % check_every == 0)
+			{
+				double median = median_of(m_samples);
+				if (m_last_median > 0 && 
+					fabs_(median - m_last_median) <= m_last_median * 0.02)
+				{
+					finish();
+					return;
+				}
+				m_last_median = median;
+			}
+		}
+
+		bool passed() const
+		{
+			return m_median <= (double)m_budget;
+		}
+
+		double median() const
+		{
+			return m_median;
+		}
+
+		std::string distribution() const
+		{
+			char buf[256];
+			sprintf(buf, "median %.1fns, min %.1fns, p25 %.1fns, p75 %.1fns, max %.1fns; "
+				"%d samples x %d calls, %d outliers trimmed",
+				m_median, m_min, m_p25, m_p75, m_max,
+				(int)m_samples.size(), m_batch, m_trimmed);
+			return buf;
+		}
+
+	private:
+		static double fabs_(double v)
+		{
+			return v < 0 ? -v : v;
+		}
+
+		static double median_of(std::vector<double> v)
+		{
+			std::sort(v.begin(), v.end());
+			return quantile(v, 0.5);
+		}
+
+		static double quantile(const std::vector<double>& sorted, double q)
+		{
+			if (sorted.empty())
+				return 0;
+			double pos = q * (sorted.size() - 1);
+			size_t lo = (size_t)pos;
+			if (lo + 1 >= sorted.size())
+				return sorted[lo];
+			return sorted[lo] + (sorted[lo + 1] - sorted[lo]) * (pos - lo);
+		}
+
+		// Tukey fences on the sorted samples; scheduler hiccups and
+		// page faults only ever show up on the slow side, but trim both.
+		void finish()
+		{
+			m_done = true;
+
+			std::vector<double> v = m_samples;
+			std::sort(v.begin(), v.end());
+
+			double q1 = quantile(v, 0.25);
+			double q3 = quantile(v, 0.75);
+			double lo = q1 - 1.5 * (q3 - q1);
+			double hi = q3 + 1.5 * (q3 - q1);
+
+			std::vector<double> kept;
+			for (size_t i = 0; i < v.size(); ++i)
+			{
+				if (v[i] >= lo && v[i] <= hi)
+					kept.push_back(v[i]);
+			}
+			if (kept.empty())
+				kept = v;
+
+			m_trimmed = (int)(v.size() - kept.size());
+			m_median = quantile(kept, 0.5);
+			m_p25 = quantile(kept, 0.25);
+			m_p75 = quantile(kept, 0.75);
+			m_min = kept.front();
+			m_max = kept.back();
+		}
+
+		QInt64 m_budget;
+		QInt64 m_cap;
+		QInt64 m_started;
+		int m_batch;
+		bool m_calibrating;
+		int m_warmup;
+		bool m_done;
+		double m_last_median;
+		std::vector<double> m_samples;
+
+		double m_median, m_min, m_p25, m_p75, m_max;
+		int m_trimmed;
+	};
+
 }}
 
 
@@ -0,0 +1,109 @@
+#ifndef __QUNIT_PRIVATE_MMAP__
+#define __QUNIT_PRIVATE_MMAP__
+
+#ifdef X_OS_WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace QUnit { namespace PrivateHelper
+{
+	// read-only view of a whole file
+	class QMappedFile
+	{
+		const char* m_data;
+		size_t m_size;
+		bool m_open;
+#ifdef X_OS_WIN32
+		HANDLE m_file;
+		HANDLE m_mapping;
+#endif
+
+	public:
+		QMappedFile(const char* name)
+		{
+			m_data = NULL;
+			m_size = 0;
+			m_open = false;
+#ifdef X_OS_WIN32
+			m_mapping = NULL;
+			m_file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+				NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (m_file == INVALID_HANDLE_VALUE)
+				return;
+			// a view can't be larger than the address space
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(m_file, &size) || (QUInt64)size.QuadPart > (size_t)-1)
+				return;
+			m_open = true;
+			m_size = (size_t)size.QuadPart;
+			if (m_size == 0)
+				return;
+			m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (m_mapping != NULL)
+				m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+			int fd = open(name, O_RDONLY);
+			if (fd < 0)
+				return;
+			struct stat st;
+			if (fstat(fd, &st) != 0 || (QUInt64)st.st_size > (size_t)-1)
+			{
+				close(fd);
+				return;
+			}
+			m_open = true;
+			if (st.st_size > 0)
+			{
+				void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p != MAP_FAILED)
+				{
+					m_data = (const char*)p;
+					m_size = st.st_size;
+				}
+			}
+			close(fd);
+#endif
+		}
+		~QMappedFile()
+		{
+#ifdef X_OS_WIN32
+			if (m_data != NULL)
+				UnmapViewOfFile(m_data);
+			if (m_mapping != NULL)
+				CloseHandle(m_mapping);
+			if (m_file != INVALID_HANDLE_VALUE)
+				CloseHandle(m_file);
+#else
+			if (m_data != NULL)
+				munmap((void*)m_data, m_size);
+#endif
+		}
+
+		// true for an empty file too, which has no data()
+		bool is_open() const
+		{
+			return m_open;
+		}
+		const char* data() const
+		{
+			return m_data;
+		}
+		size_t size() const
+		{
+			return m_data != NULL ? m_size : 0;
+		}
+
+	private:
+		QMappedFile(const QMappedFile&);
+		QMappedFile& operator=(const QMappedFile&);
+	};
+}}
+
+// ----------------------------------------------------------------------------
+#endif // __QUNIT_PRIVATE_MMAP__
@@ -0,0 +1,150 @@
+#ifndef __QUNIT_PRIVATE_PARAM__
+#define __QUNIT_PRIVATE_PARAM__
+
+// ----------------------------------------------------------------------------
+// Generators for qtest_p. A generator is any copyable class with
+//
+//	size_t size() const;
+//	value_type at(size_t i) const;
+//
+// at() is called once per case, when the case runs, so a generator
+// should compute its values rather than hold them.
+
+namespace QUnit
+{
+	// begin, begin + step, ... up to but excluding end
+	template<class T>
+	class QRangeGen
+	{
+		T m_begin;
+		T m_step;
+		size_t m_size;
+
+	public:
+		typedef T value_type;
+
+		QRangeGen(T begin, T end, T step)
+		{
+			m_begin = begin;
+			m_step = step;
+			m_size = step > 0 && end > begin ? (size_t)((end - begin + step - 1) / step) : 0;
+		}
+		size_t size() const
+		{
+			return m_size;
+		}
+		T at(size_t i) const
+		{
+			return (T)(m_begin + m_step * (T)i);
+		}
+	};
+
+	template<class T> inline
+	QRangeGen<T> range(T begin, T end, T step = 1)
+	{
+		return QRangeGen<T>(begin, end, step);
+	}
+
+	// the rows of an existing table, by reference
+	template<class T>
+	class QValuesGen
+	{
+		const T* m_values;
+		size_t m_size;
+
+	public:
+		typedef T value_type;
+
+		QValuesGen(const T* values, size_t size)
+		{
+			m_values = values;
+			m_size = size;
+		}
+		size_t size() const
+		{
+			return m_size;
+		}
+		const T& at(size_t i) const
+		{
+			return m_values[i];
+		}
+	};
+
+	template<class T, size_t N> inline
+	QValuesGen<T> values(const T (&table)[N])
+	{
+		return QValuesGen<T>(table, N);
+	}
+
+	template<class T> inline
+	QValuesGen<T> values(const T* table, size_t size)
+	{
+		return QValuesGen<T>(table, size);
+	}
+
+	// f(0) ... f(size - 1)
+	template<class T>
+	class QComputedGen
+	{
+		T (*m_func)(size_t);
+		size_t m_size;
+
+	public:
+		typedef T value_type;
+
+		QComputedGen(size_t size, T (*func)(size_t))
+		{
+			m_func = func;
+			m_size = size;
+		}
+		size_t size() const
+		{
+			return m_size;
+		}
+		T at(size_t i) const
+		{
+			return m_func(i);
+		}
+	};
+
+	template<class T> inline
+	QComputedGen<T> generate(size_t size, T (*func)(size_t))
+	{
+		return QComputedGen<T>(size, func);
+	}
+}
+
+namespace QUnit { namespace PrivateHelper
+{
+	template<class Test, class Generator>
+	class QParamRun : public QRun
+	{
+		Generator m_generator;
+
+	public:
+		QParamRun(const Generator& generator) : m_generator(generator)
+		{
+		}
+
+		int cases()
+		{
+			return (int)m_generator.size();
+		}
+		void run(QRunCookie* cookie)
+		{
+			Test inst;
+			inst.run(cookie, m_generator.at((size_t)cookie->__param));
+		}
+	};
+
+	template<class Test, class Generator> inline
+	QRun* add_param_test(const char* testcase, const char* name, const Generator& generator)
+	{
+		static QParamRun<Test, Generator> run(generator);
+		QModule::inst().add_test(testcase, name, &run);
+		return &run;
+	}
+}}
+
+// ----------------------------------------------------------------------------
+#endif // __QUNIT_PRIVATE_PARAM__
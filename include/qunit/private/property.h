@@ -0,0 +1,413 @@
+#ifndef __QUNIT_PRIVATE_PROPERTY__
+#define __QUNIT_PRIVATE_PROPERTY__
+
+// ----------------------------------------------------------------------------
+// Generators for qproperty. A generator is a copyable class with
+//
+//	typedef ... value_type;
+//	value_type generate(QRandom& random, int size) const;
+//	void shrink(const value_type& value, std::vector<value_type>& smaller) const;
+//
+// size grows from 1 to 100 over a property's cases, so early cases are
+// small. shrink() appends simpler candidates, simplest first.
+
+#ifndef QUNIT_PROPERTY_CASES
+#define QUNIT_PROPERTY_CASES 1000
+#endif
+
+namespace QUnit
+{
+	// xorshift64*; cheap, and every case gets its own deterministic stream
+	class QRandom
+	{
+		QUInt64 m_state;
+
+	public:
+		QRandom(QUInt64 seed)
+		{
+			// splitmix64 spreads nearby seeds apart
+			QUInt64 z = seed + ((QUInt64)0x9E3779B9 << 32 | 0x7F4A7C15);
+			z = (z ^ (z >> 30)) * ((QUInt64)0xBF58476D << 32 | 0x1CE4E5B9);
+			z = (z ^ (z >> 27)) * ((QUInt64)0x94D049BB << 32 | 0x133111EB);
+			m_state = (z ^ (z >> 31)) | 1;
+		}
+
+		QUInt64 next()
+		{
+			m_state ^= m_state >> 12;
+			m_state ^= m_state << 25;
+			m_state ^= m_state >> 27;
+			return m_state * ((QUInt64)0x2545F491 << 32 | 0x4F6CDD1D);
+		}
+
+		// uniform in [0, n)
+		QUInt64 below(QUInt64 n)
+		{
+			return n == 0 ? next() : next() % n;
+		}
+	};
+
+	// integers in [lo, hi], shrinking towards the one closest to zero
+	template<class T>
+	class QIntGen
+	{
+		T m_lo;
+		T m_hi;
+
+		T target() const
+		{
+			if (m_lo > 0)
+				return m_lo;
+			if (m_hi < 0)
+				return m_hi;
+			return 0;
+		}
+
+	public:
+		typedef T value_type;
+
+		QIntGen(T lo, T hi)
+		{
+			m_lo = lo;
+			m_hi = hi;
+		}
+
+		T generate(QRandom& random, int) const
+		{
+			QUInt64 span = (QUInt64)m_hi - (QUInt64)m_lo + 1;
+			return (T)(m_lo + (T)random.below(span));
+		}
+
+		void shrink(const T& value, std::vector<T>& smaller) const
+		{
+			T t = target();
+			if (value == t)
+				return;
+			smaller.push_back(t);
+			T half = (T)(value - (value - t) / 2);
+			if (half != value && half != t)
+				smaller.push_back(half);
+			T step = (T)(value > t ? value - 1 : value + 1);
+			if (step != t && step != half)
+				smaller.push_back(step);
+		}
+	};
+
+	template<class T> inline
+	QIntGen<T> ints(T lo, T hi)
+	{
+		return QIntGen<T>(lo, hi);
+	}
+
+	// printable ASCII strings of up to max_length characters
+	class QStringGen
+	{
+		size_t m_max;
+
+	public:
+		typedef std::string value_type;
+
+		QStringGen(size_t max_length)
+		{
+			m_max = max_length;
+		}
+
+		std::string generate(QRandom& random, int size) const
+		{
+			size_t limit = m_max < (size_t)size ? m_max : (size_t)size;
+			std::string s((size_t)random.below(limit + 1), ' ');
+			for (size_t i = 0; i < s.size(); ++i)
+				s[i] = (char)(' ' + random.below(95));
+			return s;
+		}
+
+		void shrink(const std::string& value, std::vector<std::string>& smaller) const
+		{
+			if (value.empty())
+				return;
+			smaller.push_back(std::string());
+			if (value.size() > 1)
+			{
+				smaller.push_back(value.substr(0, value.size() / 2));
+				smaller.push_back(value.substr(value.size() / 2));
+			}
+			for (size_t i = 0; i < value.size(); ++i)
+				smaller.push_back(value.substr(0, i) + value.substr(i + 1));
+			for (size_t i = 0; i < value.size(); ++i)
+			{
+				if (value[i] != 'a')
+				{
+					std::string simpler = value;
+					simpler[i] = 'a';
+					smaller.push_back(simpler);
+				}
+			}
+		}
+	};
+
+	inline
+	QStringGen strings(size_t max_length = 100)
+	{
+		return QStringGen(max_length);
+	}
+
+	// vectors of up to max_length elements from an element generator
+	template<class G>
+	class QVectorGen
+	{
+		G m_element;
+		size_t m_max;
+
+	public:
+		typedef std::vector<typename G::value_type> value_type;
+
+		QVectorGen(const G& element, size_t max_length)
+			: m_element(element)
+		{
+			m_max = max_length;
+		}
+
+		value_type generate(QRandom& random, int size) const
+		{
+			size_t limit = m_max < (size_t)size ? m_max : (size_t)size;
+			value_type v((size_t)random.below(limit + 1));
+			for (size_t i = 0; i < v.size(); ++i)
+				v[i] = m_element.generate(random, size);
+			return v;
+		}
+
+		void shrink(const value_type& value, std::vector<value_type>& smaller) const
+		{
+			if (value.empty())
+				return;
+			smaller.push_back(value_type());
+			if (value.size() > 1)
+			{
+				smaller.push_back(value_type(value.begin(), value.begin() + value.size() / 2));
+				smaller.push_back(value_type(value.begin() + value.size() / 2, value.end()));
+			}
+			for (size_t i = 0; i < value.size(); ++i)
+			{
+				value_type fewer = value;
+				fewer.erase(fewer.begin() + i);
+				smaller.push_back(fewer);
+			}
+			for (size_t i = 0; i < value.size(); ++i)
+			{
+				std::vector<typename G::value_type> elements;
+				m_element.shrink(value[i], elements);
+				for (size_t e = 0; e < elements.size(); ++e)
+				{
+					value_type simpler = value;
+					simpler[i] = elements[e];
+					smaller.push_back(simpler);
+				}
+			}
+		}
+	};
+
+	template<class G> inline
+	QVectorGen<G> vectors(const G& element, size_t max_length = 100)
+	{
+		return QVectorGen<G>(element, max_length);
+	}
+
+	// two independent inputs as a std::pair; qproperty takes a single
+	// generator, so this is how a property gets several inputs (nest it
+	// for more than two)
+	template<class A, class B>
+	class QPairGen
+	{
+		A m_first;
+		B m_second;
+
+	public:
+		typedef std::pair<typename A::value_type, typename B::value_type> value_type;
+
+		QPairGen(const A& first, const B& second)
+			: m_first(first), m_second(second)
+		{
+		}
+
+		value_type generate(QRandom& random, int size) const
+		{
+			typename A::value_type first = m_first.generate(random, size);
+			return value_type(first, m_second.generate(random, size));
+		}
+
+		void shrink(const value_type& value, std::vector<value_type>& smaller) const
+		{
+			std::vector<typename A::value_type> firsts;
+			m_first.shrink(value.first, firsts);
+			for (size_t i = 0; i < firsts.size(); ++i)
+				smaller.push_back(value_type(firsts[i], value.second));
+
+			std::vector<typename B::value_type> seconds;
+			m_second.shrink(value.second, seconds);
+			for (size_t i = 0; i < seconds.size(); ++i)
+				smaller.push_back(value_type(value.first, seconds[i]));
+		}
+	};
+
+	template<class A, class B> inline
+	QPairGen<A, B> pairs(const A& first, const B& second)
+	{
+		return QPairGen<A, B>(first, second);
+	}
+}
+
+namespace QUnit { namespace PrivateHelper
+{
+	// One seed per process, taken from QUNIT_SEED when set so a failure
+	// can be replayed. It is fixed before any worker starts, so forked
+	// workers agree on it.
+	inline
+	QUInt64 property_seed()
+	{
+		static QUInt64 seed = 0;
+		static bool chosen = false;
+		if (!chosen)
+		{
+			const char* env = getenv("QUNIT_SEED");
+			seed = env != NULL ? (QUInt64)strtoul(env, NULL, 10) : (QUInt64)now_ns() % 1000000000;
+			chosen = true;
+		}
+		return seed;
+	}
+
+	// Cases are evaluated in chunks of chunk_cases, each chunk being one
+	// case of the runner, so a large property is split between workers.
+	// Case i always draws from QRandom(seed + i), whichever worker runs
+	// it. The first failing input is shrunk to a local minimum, trying
+	// at most max_shrinks candidates.
+	template<class Test, class Generator>
+	class QPropertyRun : public QRun
+	{
+		enum {chunk_cases = 4096, max_shrinks = 2000};
+
+		typedef typename Generator::value_type Value;
+
+		struct Outcome
+		{
+			bool is_failure;
+			QFailure failure;
+			std::string error;
+		};
+
+		Generator m_generator;
+		int m_cases;
+
+		static bool holds(QRunCookie* cookie, const Value& value, Outcome& outcome)
+		{
+			try
+			{
+				Test inst;
+				inst.run(cookie, value);
+				return true;
+			}
+			catch (const QFailure& e)
+			{
+				outcome.is_failure = true;
+				outcome.failure = e;
+			}
+			catch (const std::exception& e)
+			{
+				outcome.is_failure = false;
+				outcome.error = e.what();
+			}
+			catch (const char* e)
+			{
+				outcome.is_failure = false;
+				outcome.error = e;
+			}
+			catch (const std::string& e)
+			{
+				outcome.is_failure = false;
+				outcome.error = e;
+			}
+			catch (...)
+			{
+				outcome.is_failure = false;
+				outcome.error = "Unknown exception";
+			}
+			return false;
+		}
+
+		void falsified(int index, Value value, Outcome outcome)
+		{
+			QRunCookie scratch;
+			int shrinks = 0, tries = 0;
+			bool progress = true;
+			while (progress && tries < max_shrinks)
+			{
+				progress = false;
+				std::vector<Value> candidates;
+				m_generator.shrink(value, candidates);
+				for (size_t i = 0; i < candidates.size() && tries < max_shrinks; ++i, ++tries)
+				{
+					Outcome smaller;
+					if (!holds(&scratch, candidates[i], smaller))
+					{
+						value = candidates[i];
+						outcome = smaller;
+						++shrinks;
+						progress = true;
+						break;
+					}
+				}
+			}
+
+			std::ostringstream o;
+			o << "falsified by " << to_s(value) << " (case " << index
+				<< ", " << shrinks << " shrinks; replay with QUNIT_SEED="
+				<< property_seed() << "): ";
+			if (outcome.is_failure)
+			{
+				outcome.failure.condition = o.str() + outcome.failure.condition;
+				throw outcome.failure;
+			}
+			throw o.str() + outcome.error;
+		}
+
+	public:
+		QPropertyRun(const Generator& generator, int cases)
+			: m_generator(generator)
+		{
+			m_cases = cases;
+		}
+
+		int cases()
+		{
+			property_seed();
+			return (m_cases + chunk_cases - 1) / chunk_cases;
+		}
+
+		void run(QRunCookie* cookie)
+		{
+			int first = cookie->__param * chunk_cases;
+			int last = first + chunk_cases < m_cases ? first + chunk_cases : m_cases;
+			for (int i = first; i < last; ++i)
+			{
+				QRandom random(property_seed() + (QUInt64)i);
+				int size = 1 + (int)((QInt64)i * 99 / (m_cases > 1 ? m_cases - 1 : 1));
+				Value value = m_generator.generate(random, size);
+
+				Outcome outcome;
+				if (!holds(cookie, value, outcome))
+					falsified(i, value, outcome);
+			}
+		}
+	};
+
+	template<class Test, class Generator> inline
+	QRun* add_property(const char* testcase, const char* name,
+		const Generator& generator, int cases)
+	{
+		static QPropertyRun<Test, Generator> run(generator, cases);
+		QModule::inst().add_test(testcase, name, &run);
+		return &run;
+	}
+}}
+
+// ----------------------------------------------------------------------------
+#endif // __QUNIT_PRIVATE_PROPERTY__
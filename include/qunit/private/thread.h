@@ -0,0 +1,378 @@
+#ifndef __QUNIT_PRIVATE_THREAD__
+#define __QUNIT_PRIVATE_THREAD__
+
+#ifdef X_OS_WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+
+namespace QUnit { namespace PrivateHelper
+{
+	// ------------------------------------------------------------------------
+	// atomics, all with full or acquire/release ordering.
+
+	inline
+	long atomic_increment(volatile long* value)
+	{
+#ifdef X_CC_VC
+		return InterlockedIncrement(value);
+#else
+		return __sync_add_and_fetch(value, 1);
+#endif
+	}
+
+	inline
+	long atomic_decrement(volatile long* value)
+	{
+#ifdef X_CC_VC
+		return InterlockedDecrement(value);
+#else
+		return __sync_sub_and_fetch(value, 1);
+#endif
+	}
+
+	template<class T> inline
+	T* atomic_exchange(T* volatile* slot, T* value)
+	{
+#ifdef X_CC_VC
+		return (T*)InterlockedExchangePointer((PVOID volatile*)slot, value);
+#else
+		return __atomic_exchange_n(slot, value, __ATOMIC_ACQ_REL);
+#endif
+	}
+
+	template<class T> inline
+	T* atomic_load(T* volatile const* slot)
+	{
+#ifdef X_CC_VC
+		return *slot;
+#else
+		return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+#endif
+	}
+
+	template<class T> inline
+	void atomic_store(T* volatile* slot, T* value)
+	{
+#ifdef X_CC_VC
+		*slot = value;
+#else
+		__atomic_store_n(slot, value, __ATOMIC_RELEASE);
+#endif
+	}
+
+	// orders every load and store before it against every one after it
+	inline
+	void memory_fence()
+	{
+#ifdef X_CC_VC
+		MemoryBarrier();
+#else
+		__sync_synchronize();
+#endif
+	}
+
+
+	// ------------------------------------------------------------------------
+	inline
+	void sleep_ms(int ms)
+	{
+#ifdef X_OS_WIN32
+		Sleep(ms);
+#else
+		struct timespec ts;
+		ts.tv_sec = ms / 1000;
+		ts.tv_nsec = (ms % 1000) * 1000000L;
+		nanosleep(&ts, NULL);
+#endif
+	}
+
+	inline
+	void yield_thread()
+	{
+#ifdef X_OS_WIN32
+		SwitchToThread();
+#else
+		sched_yield();
+#endif
+	}
+
+	inline
+	int cpu_count()
+	{
+#ifdef X_OS_WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return (int)info.dwNumberOfProcessors;
+#else
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		return n > 0 ? (int)n : 1;
+#endif
+	}
+
+
+	// ------------------------------------------------------------------------
+	class QMutex
+	{
+#ifdef X_OS_WIN32
+		CRITICAL_SECTION m_cs;
+	public:
+		QMutex() { InitializeCriticalSection(&m_cs); }
+		~QMutex() { DeleteCriticalSection(&m_cs); }
+		void lock() { EnterCriticalSection(&m_cs); }
+		void unlock() { LeaveCriticalSection(&m_cs); }
+#else
+		pthread_mutex_t m_mutex;
+	public:
+		QMutex() { pthread_mutex_init(&m_mutex, NULL); }
+		~QMutex() { pthread_mutex_destroy(&m_mutex); }
+		void lock() { pthread_mutex_lock(&m_mutex); }
+		void unlock() { pthread_mutex_unlock(&m_mutex); }
+#endif
+	private:
+		QMutex(const QMutex&);
+		QMutex& operator=(const QMutex&);
+	};
+
+	class QLock
+	{
+		QMutex& m_mutex;
+	public:
+		QLock(QMutex& mutex) : m_mutex(mutex)
+		{
+			m_mutex.lock();
+		}
+		~QLock()
+		{
+			m_mutex.unlock();
+		}
+	};
+
+
+	// ------------------------------------------------------------------------
+	// Auto-reset event: wait() blocks until set(), and each set() lets one
+	// wait() through, now or, if nobody is waiting, the next one.
+	class QEvent
+	{
+#ifdef X_OS_WIN32
+		HANDLE m_event;
+	public:
+		QEvent() { m_event = CreateEvent(NULL, FALSE, FALSE, NULL); }
+		~QEvent() { CloseHandle(m_event); }
+		void set() { SetEvent(m_event); }
+		void wait() { WaitForSingleObject(m_event, INFINITE); }
+#else
+		pthread_mutex_t m_mutex;
+		pthread_cond_t m_cond;
+		bool m_set;
+	public:
+		QEvent()
+		{
+			pthread_mutex_init(&m_mutex, NULL);
+			pthread_cond_init(&m_cond, NULL);
+			m_set = false;
+		}
+		~QEvent()
+		{
+			pthread_cond_destroy(&m_cond);
+			pthread_mutex_destroy(&m_mutex);
+		}
+		void set()
+		{
+			pthread_mutex_lock(&m_mutex);
+			m_set = true;
+			pthread_cond_signal(&m_cond);
+			pthread_mutex_unlock(&m_mutex);
+		}
+		void wait()
+		{
+			pthread_mutex_lock(&m_mutex);
+			while (!m_set)
+				pthread_cond_wait(&m_cond, &m_mutex);
+			m_set = false;
+			pthread_mutex_unlock(&m_mutex);
+		}
+#endif
+	private:
+		QEvent(const QEvent&);
+		QEvent& operator=(const QEvent&);
+	};
+
+
+	// ------------------------------------------------------------------------
+	class QThread
+	{
+	public:
+		typedef void (*Proc)(void*);
+
+		QThread()
+		{
+			m_started = false;
+		}
+
+		bool start(Proc proc, void* arg)
+		{
+			m_proc = proc;
+			m_arg = arg;
+#ifdef X_OS_WIN32
+			m_handle = (HANDLE)_beginthreadex(NULL, 0, &QThread::entry, this, 0, NULL);
+			m_started = m_handle != 0;
+#else
+			m_started = pthread_create(&m_thread, NULL, &QThread::entry, this) == 0;
+#endif
+			return m_started;
+		}
+
+		void join()
+		{
+			if (!m_started)
+				return;
+#ifdef X_OS_WIN32
+			WaitForSingleObject(m_handle, INFINITE);
+			CloseHandle(m_handle);
+#else
+			pthread_join(m_thread, NULL);
+#endif
+			m_started = false;
+		}
+
+	private:
+#ifdef X_OS_WIN32
+		static unsigned __stdcall entry(void* self)
+		{
+			((QThread*)self)->m_proc(((QThread*)self)->m_arg);
+			return 0;
+		}
+		HANDLE m_handle;
+#else
+		static void* entry(void* self)
+		{
+			((QThread*)self)->m_proc(((QThread*)self)->m_arg);
+			return NULL;
+		}
+		pthread_t m_thread;
+#endif
+		Proc m_proc;
+		void* m_arg;
+		bool m_started;
+	};
+
+
+	// ------------------------------------------------------------------------
+	// Unbounded multi-producer/single-consumer queue (Vyukov's intrusive
+	// MPSC design). push() is one atomic exchange and never blocks or
+	// waits on the consumer; pop() is only ever called from one thread.
+	template<class T>
+	class QMpscQueue
+	{
+		struct Node
+		{
+			Node* volatile next;
+			T value;
+		};
+
+		Node* volatile m_head;
+		Node* m_tail;
+
+	public:
+		QMpscQueue()
+		{
+			Node* stub = new Node();
+			stub->next = NULL;
+			m_head = stub;
+			m_tail = stub;
+		}
+		~QMpscQueue()
+		{
+			T value;
+			while (pop(value))
+				;
+			delete m_tail;
+		}
+
+		void push(const T& value)
+		{
+			Node* node = new Node();
+			node->next = NULL;
+			node->value = value;
+			Node* prev = atomic_exchange(&m_head, node);
+			atomic_store(&prev->next, node);
+		}
+
+		bool pop(T& value)
+		{
+			Node* tail = m_tail;
+			Node* next = atomic_load(&tail->next);
+			if (next == NULL)
+				return false;
+			value = next->value;
+			next->value = T();
+			m_tail = next;
+			delete tail;
+			return true;
+		}
+
+	private:
+		QMpscQueue(const QMpscQueue&);
+		QMpscQueue& operator=(const QMpscQueue&);
+	};
+
+
+	// ------------------------------------------------------------------------
+	// One T per thread, made by the thread's first get() and deleted when
+	// the thread ends. Construct it before the threads that use it start.
+	template<class T>
+	class QThreadLocal
+	{
+#ifdef X_OS_WIN32
+		DWORD m_key;
+		static void WINAPI destroy(void* value)
+		{
+			delete (T*)value;
+		}
+	public:
+		QThreadLocal() { m_key = FlsAlloc(&QThreadLocal::destroy); }
+		T& get()
+		{
+			T* value = (T*)FlsGetValue(m_key);
+			if (value == NULL)
+			{
+				value = new T();
+				FlsSetValue(m_key, value);
+			}
+			return *value;
+		}
+#else
+		pthread_key_t m_key;
+		static void destroy(void* value)
+		{
+			delete (T*)value;
+		}
+	public:
+		QThreadLocal() { pthread_key_create(&m_key, &QThreadLocal::destroy); }
+		T& get()
+		{
+			T* value = (T*)pthread_getspecific(m_key);
+			if (value == NULL)
+			{
+				value = new T();
+				pthread_setspecific(m_key, value);
+			}
+			return *value;
+		}
+#endif
+	private:
+		QThreadLocal(const QThreadLocal&);
+		QThreadLocal& operator=(const QThreadLocal&);
+	};
+
+}}
+
+// ----------------------------------------------------------------------------
+#endif // __QUNIT_PRIVATE_THREAD__
@@ -0,0 +1,113 @@
+#ifndef __QUNIT_PRIVATE_TYPED__
+#define __QUNIT_PRIVATE_TYPED__
+
+#include <typeinfo>
+#ifdef X_CC_GCC
+#include <cxxabi.h>
+#endif
+
+// ----------------------------------------------------------------------------
+// Type lists for qtest_t. QUnit::Types<int, long, std::string> takes up
+// to 20 types and is turned into a cons list at compile time; each type
+// is registered as its own test, name<type>.
+
+namespace QUnit
+{
+	struct QNoType
+	{
+	};
+
+	template<class H, class T>
+	struct QTypeList
+	{
+		typedef H Head;
+		typedef T Tail;
+	};
+
+	template<
+		class T1 = QNoType, class T2 = QNoType, class T3 = QNoType, class T4 = QNoType,
+		class T5 = QNoType, class T6 = QNoType, class T7 = QNoType, class T8 = QNoType,
+		class T9 = QNoType, class T10 = QNoType, class T11 = QNoType, class T12 = QNoType,
+		class T13 = QNoType, class T14 = QNoType, class T15 = QNoType, class T16 = QNoType,
+		class T17 = QNoType, class T18 = QNoType, class T19 = QNoType, class T20 = QNoType>
+	struct Types
+	{
+		typedef QTypeList<T1, typename Types<
+			T2, T3, T4, T5, T6, T7, T8, T9, T10, T11,
+			T12, T13, T14, T15, T16, T17, T18, T19, T20>::type> type;
+	};
+
+	template<>
+	struct Types<
+		QNoType, QNoType, QNoType, QNoType, QNoType,
+		QNoType, QNoType, QNoType, QNoType, QNoType,
+		QNoType, QNoType, QNoType, QNoType, QNoType,
+		QNoType, QNoType, QNoType, QNoType, QNoType>
+	{
+		typedef QNoType type;
+	};
+}
+
+namespace QUnit { namespace PrivateHelper
+{
+	template<class T> inline
+	std::string type_name()
+	{
+		const char* name = typeid(T).name();
+#ifdef X_CC_GCC
+		int status = 0;
+		char* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+		if (demangled != NULL)
+		{
+			std::string readable = demangled;
+			free(demangled);
+			return readable;
+		}
+#endif
+		return name;
+	}
+
+	template<template<class> class Test, class T>
+	class QTypedRun : public QRun
+	{
+	public:
+		void run(QRunCookie* cookie)
+		{
+			Test<T> inst;
+			inst.run(cookie);
+		}
+	};
+
+	// registers Test<Head> and recurses into the tail of the list
+	template<template<class> class Test, class List>
+	struct QTypedTests
+	{
+		static void add(const char* testcase, const char* name)
+		{
+			typedef typename List::Head Head;
+			static QTypedRun<Test, Head> run;
+			std::string typed = std::string(name) + "<" + type_name<Head>() + ">";
+			QModule::inst().add_test(testcase, typed.c_str(), &run);
+
+			QTypedTests<Test, typename List::Tail>::add(testcase, name);
+		}
+	};
+
+	template<template<class> class Test>
+	struct QTypedTests<Test, QNoType>
+	{
+		static void add(const char*, const char*)
+		{
+		}
+	};
+
+	template<template<class> class Test, class Types> inline
+	bool add_typed_tests(const char* testcase, const char* name)
+	{
+		QTypedTests<Test, typename Types::type>::add(testcase, name);
+		return true;
+	}
+}}
+
+// ----------------------------------------------------------------------------
+#endif // __QUNIT_PRIVATE_TYPED__
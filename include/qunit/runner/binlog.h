@@ -0,0 +1,292 @@
+#ifndef __QUNIT_RUNNER_BINLOG_H__
+#define __QUNIT_RUNNER_BINLOG_H__
+
+// -------------------------------------------------------------------------
+// Binary result log.
+//
+// An 8 byte magic followed by records, each a tag byte and its payload.
+// Records are only ever added at the end, never patched in place; each
+// run writes a new log. Numbers are unsigned LEB128 varints; strings are written
+// once into the log's string table ('S' records, numbered from 0 in the
+// order they appear) and referred to by index afterwards.
+//
+//   'S' length bytes                          string table entry
+//   'T' testcase name                         a test started
+//   'R' testcase name type duration_ns asserts
+//       [file line message output]  for failures
+//       [message output]            for errors  one result
+//   'F' executions new_inputs                 fuzzing counts of the
+//                                             next result
+//   'E' duration_ns                           end of run
+//
+// A log cut short by a crash is still readable up to its last complete
+// record.
+
+#define QUNIT_BINLOG_MAGIC "QULOG\x01\r\n"
+
+namespace QUnit {
+
+	namespace PrivateHelper
+	{
+		inline
+		void put_varint(std::string& out, QInt64 value)
+		{
+			if (value < 0)
+				value = 0;
+			while (value >= 0x80)
+			{
+				out += (char)((value & 0x7f) | 0x80);
+				value >>= 7;
+			}
+			out += (char)value;
+		}
+
+		inline
+		bool get_varint(const unsigned char*& p, const unsigned char* e, QInt64& value)
+		{
+			value = 0;
+			for (int shift = 0; p < e && shift < 64; shift += 7)
+			{
+				unsigned char c = *p++;
+				value |= (QInt64)(c & 0x7f) << shift;
+				if ((c & 0x80) == 0)
+					return true;
+			}
+			return false;
+		}
+	}
+
+
+	class QBinaryLogWriter : public QReporter
+	{
+		QOutBuffer m_out;
+		std::map<std::string, int> m_strings;
+		std::string m_rec;
+
+		void string_ref(const std::string& s)
+		{
+			std::map<std::string, int>::iterator i = m_strings.find(s);
+			if (i == m_strings.end())
+			{
+				std::string def(1, 'S');
+				PrivateHelper::put_varint(def, s.size());
+				def += s;
+				m_out << def;
+
+				int index = (int)m_strings.size();
+				i = m_strings.insert(std::make_pair(s, index)).first;
+			}
+			PrivateHelper::put_varint(m_rec, i->second);
+		}
+
+	public:
+		// buffer_size 0 hands every record to the file as it is written
+		QBinaryLogWriter(FILE* file, size_t buffer_size = 256 * 1024) 
+			: m_out(file, buffer_size)
+		{
+		}
+
+	public:
+		void begin(const QTests&)
+		{
+			m_out << std::string(QUNIT_BINLOG_MAGIC, 8);
+			m_out.flush();
+		}
+
+		void test_started(const QTest& test)
+		{
+			m_rec.assign(1, 'T');
+			string_ref(test.testcase);
+			string_ref(test.name);
+			m_out << m_rec;
+			m_out.commit();
+		}
+
+		void test_finished(const QResult& result)
+		{
+			// string definitions go out first, the record after them
+			m_rec.assign(1, 'R');
+			string_ref(result.testcase);
+			string_ref(result.name);
+			PrivateHelper::put_varint(m_rec, result.type);
+			PrivateHelper::put_varint(m_rec, result.duration_ns);
+			PrivateHelper::put_varint(m_rec, result.assertion_count);
+
+			if (result.executions > 0)
+			{
+				std::string counts(1, 'F');
+				PrivateHelper::put_varint(counts, result.executions);
+				PrivateHelper::put_varint(counts, result.new_inputs);
+				m_out << counts;
+			}
+
+			if (result.type == QResult::failure)
+			{
+				string_ref(result.fail.file);
+				PrivateHelper::put_varint(m_rec, result.fail.line);
+				string_ref(result.fail.condition);
+				string_ref(result.output);
+			}
+			else if (result.type == QResult::error)
+			{
+				string_ref(result.msg);
+				string_ref(result.output);
+			}
+
+			m_out << m_rec;
+			m_out.commit();
+		}
+
+		void end(QInt64 duration_ns)
+		{
+			m_rec.assign(1, 'E');
+			PrivateHelper::put_varint(m_rec, duration_ns);
+			m_out << m_rec;
+			m_out.flush();
+		}
+	};
+
+
+	// Replays a log into a reporter. The reporter's begin() and end()
+	// are left to the caller, so several logs can be merged into one
+	// report.
+	class QBinaryLogReader
+	{
+		std::vector<std::string> m_strings;
+		QInt64 m_duration_ns;
+		QInt64 m_executions;
+		QInt64 m_new_inputs;
+		bool m_complete;
+
+		bool string_ref(const unsigned char*& p, const unsigned char* e, std::string& s)
+		{
+			QInt64 index;
+			if (!PrivateHelper::get_varint(p, e, index) || index >= (QInt64)m_strings.size())
+				return false;
+			s = m_strings[(size_t)index];
+			return true;
+		}
+
+		bool number(const unsigned char*& p, const unsigned char* e, int& value)
+		{
+			QInt64 v;
+			if (!PrivateHelper::get_varint(p, e, v))
+				return false;
+			value = (int)v;
+			return true;
+		}
+
+		// one record at p; false if it is truncated or malformed
+		bool record(const unsigned char*& p, const unsigned char* e, QReporter& sink)
+		{
+			switch (*p++)
+			{
+			case 'S':
+				{
+					QInt64 size;
+					if (!PrivateHelper::get_varint(p, e, size) || size > e - p)
+						return false;
+					m_strings.push_back(std::string((const char*)p, (size_t)size));
+					p += size;
+					return true;
+				}
+			case 'T':
+				{
+					QTest test;
+					test.run = NULL;
+					if (!string_ref(p, e, test.testcase) ||
+						!string_ref(p, e, test.name))
+						return false;
+					sink.test_started(test);
+					return true;
+				}
+			case 'R':
+				{
+					QTest test;
+					QResult result(test);
+					if (!string_ref(p, e, result.testcase) ||
+						!string_ref(p, e, result.name) ||
+						!number(p, e, result.type) ||
+						!PrivateHelper::get_varint(p, e, result.duration_ns) ||
+						!number(p, e, result.assertion_count))
+						return false;
+
+					if (result.type == QResult::failure)
+					{
+						if (!string_ref(p, e, result.fail.file) ||
+							!number(p, e, result.fail.line) ||
+							!string_ref(p, e, result.fail.condition) ||
+							!string_ref(p, e, result.output))
+							return false;
+					}
+					else if (result.type == QResult::error)
+					{
+						if (!string_ref(p, e, result.msg) ||
+							!string_ref(p, e, result.output))
+							return false;
+					}
+					result.executions = m_executions;
+					result.new_inputs = m_new_inputs;
+					m_executions = m_new_inputs = 0;
+					sink.test_finished(result);
+					return true;
+				}
+			case 'F':
+				return PrivateHelper::get_varint(p, e, m_executions) &&
+					PrivateHelper::get_varint(p, e, m_new_inputs);
+			case 'E':
+				if (!PrivateHelper::get_varint(p, e, m_duration_ns))
+					return false;
+				m_complete = true;
+				return true;
+			}
+			return false;
+		}
+
+	public:
+		QBinaryLogReader()
+		{
+			m_duration_ns = 0;
+			m_executions = m_new_inputs = 0;
+			m_complete = false;
+		}
+
+		// true if the run that wrote the log got to its end
+		bool complete() const
+		{
+			return m_complete;
+		}
+		QInt64 duration_ns() const
+		{
+			return m_duration_ns;
+		}
+
+		// Decodes whole records from data and returns the number of bytes
+		// consumed; a partial record at the end is left for the next call.
+		size_t decode(const char* data, size_t size, QReporter& sink)
+		{
+			const unsigned char* p = (const unsigned char*)data;
+			const unsigned char* e = p + size;
+			const unsigned char* last = p;
+			while (p < e && record(p, e, sink))
+				last = p;
+			return last - (const unsigned char*)data;
+		}
+
+		// Reads a whole log. Returns false if it isn't a result log or was
+		// cut short; every complete record is delivered either way.
+		bool read(const char* data, size_t size, QReporter& sink)
+		{
+			if (size < 8 || memcmp(data, QUNIT_BINLOG_MAGIC, 8) != 0)
+				return false;
+			size_t used = decode(data + 8, size - 8, sink);
+			return used == size - 8 && m_complete;
+		}
+	};
+
+}
+
+// -------------------------------------------------------------------------
+//
+
+#endif /* __QUNIT_RUNNER_BINLOG_H__ */
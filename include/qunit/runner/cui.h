@@ -1,12 +1,19 @@
 #ifndef __QUNIT_RUNNER_CUI_H__
 #define __QUNIT_RUNNER_CUI_H__
 
+#include <stdio.h>
 #include <time.h>
 
 #ifdef X_OS_WIN32
 #include <windows.h>
 #endif
 
+// Steps one regex match may take while the runner runs, unless
+// --regex-budget=N says otherwise (0 for no limit). See CStepBudget.
+#ifndef QUNIT_REGEX_BUDGET
+#define QUNIT_REGEX_BUDGET 10000000
+#endif
+
 // -------------------------------------------------------------------------
 namespace QUnit {
 
@@ -14,52 +21,322 @@ namespace QUnit {
 	{
 		std::string testcase;
 		std::string test;
+		std::string xml;
+		std::string log;
+		std::string format;
+		std::vector<std::string> filters;
+		int regex_budget;
+		int jobs;
+		bool isolate;
+		int fuzz;
 
 		QCUIOptParser(int argc, char** argv)
 		{
 			testcase = ".*";
 			test = ".*";
-			if (argc > 0)
-				test = argv[0];
-			if (argc > 1)
-				testcase = argv[1];
+			format = "console";
+			regex_budget = QUNIT_REGEX_BUDGET;
+			jobs = 1;
+			isolate = false;
+			fuzz = 0;
+
+			int positional = 0;
+			for (int i = 0; i < argc; ++i)
+			{
+				const char* arg = argv[i];
+				if (strncmp(arg, "--xml=", 6) == 0)
+					xml = arg + 6;
+				else if (strncmp(arg, "--log=", 6) == 0)
+					log = arg + 6;
+				else if (strncmp(arg, "--format=", 9) == 0)
+					format = arg + 9;
+				else if (strncmp(arg, "--filter=", 9) == 0)
+					filters.push_back(arg + 9);
+				else if (strncmp(arg, "--regex-budget=", 15) == 0)
+					regex_budget = atoi(arg + 15);
+				else if (strncmp(arg, "--jobs=", 7) == 0)
+					jobs = atoi(arg + 7) > 0 ? atoi(arg + 7) : PrivateHelper::cpu_count();
+				else if (strncmp(arg, "--fuzz=", 7) == 0)
+					fuzz = atoi(arg + 7);
+				else if (strcmp(arg, "--isolate") == 0)
+					isolate = true;
+				else if (positional++ == 0)
+					test = arg;
+				else
+					testcase = arg;
+			}
 		}
 	};
 
-	struct QCUIRunnerHost : QHostBase
+	struct QCUIRunnerHost : QRunHost
 	{
 		CRegexpT<char> rx_testcase;
 		CRegexpT<char> rx_test;
+		CContext context;	// reused by every is_excluded()
+		QReporter* reporter;
 
-		QCUIRunnerHost(const char* testcase, const char* test)
+		// --filter patterns, matched against "testcase.test" in one pass;
+		// those starting with '-' exclude
+		CRegexSetT<char> filters;
+		std::vector<bool> negated;
+		bool has_includes;
+		CBufferT<int> matched;
+		std::string full_name;
+
+		QCUIRunnerHost(const char* testcase, const char* test, QReporter* r,
+			const std::vector<std::string>& filter = std::vector<std::string>())
 		{
 			rx_testcase.Compile(testcase, IGNORECASE);
 			rx_test.Compile(test, IGNORECASE);
+			reporter = r;
+
+			has_includes = false;
+			for (size_t i = 0; i < filter.size(); ++i)
+			{
+				bool exclude = filter[i][0] == '-';
+				filters.Add(filter[i].c_str() + (exclude ? 1 : 0), IGNORECASE);
+				negated.push_back(exclude);
+				has_includes = has_includes || !exclude;
+			}
 		}
 		bool is_excluded(const QTest& test)
 		{
-			MatchResult mtest = rx_test.Match(test.name.c_str());
-			MatchResult mtestcase = rx_testcase.Match(test.testcase.c_str());
-			return !(mtest.IsMatched() && mtestcase.IsMatched());
+			if (!(rx_test.IsMatch(test.name.c_str(), (int)test.name.size(), &context) &&
+				rx_testcase.IsMatch(test.testcase.c_str(), (int)test.testcase.size(), &context)))
+				return true;
+			if (filters.GetSize() == 0)
+				return false;
+
+			full_name.assign(test.testcase);
+			full_name += '.';
+			full_name += test.name;
+			filters.Match(full_name.c_str(), (int)full_name.size(), matched, &context);
+
+			bool included = !has_includes;
+			for (int i = 0; i < filters.GetSize(); ++i)
+			{
+				if (matched[i] && negated[i])
+					return true;
+				included = included || matched[i];
+			}
+			return !included;
 		}
 
+		void started(const QTest& test)
+		{
+			reporter->test_started(test);
+		}
 		void done(const QResult& result)
 		{
+			reporter->test_finished(result);
+		}
+
+	};
+
+
+	// Test::Unit style console output. While the run is going a single
+	// progress line with an ETA is refreshed at most ten times a second
+	// (every few seconds, one line each, when stdout isn't a terminal);
+	// at the end the failures are listed in registration order, whatever
+	// order the workers finished them in, followed by the totals. All of
+	// it goes through one output buffer.
+	class QConsoleReporter : public QReporter
+	{
+		QOutBuffer m_out;
+		bool m_terminal;
+
+		std::map<std::string, size_t> m_order;
+		std::map<size_t, QResult> m_problems;
+		size_t m_unordered;
+		std::string m_fuzzed;
+
+		int m_total;
+		int m_test_count;
+		int m_assertion_count;
+		int m_failure_count;
+		int m_error_count;
+
+		QInt64 m_started;
+		QInt64 m_last_progress;
+		size_t m_progress_width;
+
+		static std::string key(const std::string& testcase, const std::string& name)
+		{
+			return testcase + '\0' + name;
+		}
+
+		static std::string clock_time(QInt64 ns)
+		{
+			int seconds = (int)(ns / 1000000000);
+			char buf[32];
+			sprintf(buf, "%d:%02d", seconds / 60, seconds % 60);
+			return buf;
+		}
+
+		void progress(QInt64 now)
+		{
+			char line[128];
+			sprintf(line, "%d/%d tests, %d failures, %d errors", 
+				m_test_count, m_total, m_failure_count, m_error_count);
+			std::string text = line;
+			if (m_test_count < m_total)
+			{
+				QInt64 eta = (QInt64)((double)(now - m_started) / m_test_count 
+					* (m_total - m_test_count));
+				text += ", ETA " + clock_time(eta);
+			}
+
+			if (m_terminal)
+			{
+				m_out << '\r' << text;
+				if (text.size() < m_progress_width)
+					m_out << std::string(m_progress_width - text.size(), ' ');
+				m_progress_width = text.size();
+			}
+			else
+				m_out << text << '\n';
+			m_out.flush();
+			m_last_progress = now;
+		}
+
+		void clear_progress()
+		{
+			if (m_terminal && m_progress_width > 0)
+				m_out << '\r' << std::string(m_progress_width, ' ') << '\r';
+			m_progress_width = 0;
+		}
+
+		void details(int index, const QResult& result)
+		{
+			std::string test_name;
+			if (result.testcase == "QDefaultCase")
+				test_name = result.name;
+			else
+				test_name = result.name + "(" + result.testcase + ")";
+
 			switch(result.type)
 			{
-			case QResult::pass:
-				printf(".");
-				break;
 			case QResult::failure:
-				printf("F");
+				m_out << "  " << index << ") Failure:\n";
+				m_out << test_name << " [" << result.fail.file << ":" << result.fail.line << "]:\n";
+				m_out << result.fail.condition << "\n\n";
 				break;
 			case QResult::error:
-				printf("E");
+				m_out << "  " << index << ") Error:\n";
+				m_out << result.name << "(" << result.testcase << "):\n";
+				m_out << result.msg << "\n\n";
 				break;
 			}
-			QHostBase::done(result);
+			if (!result.output.empty())
+			{
+				m_out << "--- output ---\n" << result.output;
+				if (result.output[result.output.size() - 1] != '\n')
+					m_out << "\n";
+				m_out << "--------------\n\n";
+			}
+		}
+
+	public:
+		QConsoleReporter(FILE* file = stdout) : m_out(file)
+		{
+			m_terminal = PrivateHelper::is_terminal(file);
+			m_unordered = 0;
+			m_total = 0;
+			m_test_count = 0;
+			m_assertion_count = 0;
+			m_failure_count = 0;
+			m_error_count = 0;
+			m_started = 0;
+			m_last_progress = 0;
+			m_progress_width = 0;
+		}
+
+		int failure_count() const
+		{
+			return m_failure_count;
+		}
+		int error_count() const
+		{
+			return m_error_count;
+		}
+
+	public:
+		void begin(const QTests& tests)
+		{
+			m_total = (int)tests.size();
+			for (size_t i = 0; i < tests.size(); ++i)
+				m_order.insert(std::make_pair(key(tests[i].testcase, tests[i].name), i));
+
+			m_out << "Started\n";
+			m_out.flush();
+			m_started = m_last_progress = PrivateHelper::now_ns();
+		}
+
+		void test_finished(const QResult& result)
+		{
+			++m_test_count;
+			m_assertion_count += result.assertion_count;
+			if (result.type == QResult::failure)
+				++m_failure_count;
+			else if (result.type == QResult::error)
+				++m_error_count;
+
+			if (result.type != QResult::pass)
+			{
+				// results of tests begin() didn't list go after the others
+				std::map<std::string, size_t>::const_iterator i = 
+					m_order.find(key(result.testcase, result.name));
+				size_t index = i != m_order.end() ? i->second : m_order.size() + m_unordered++;
+				m_problems.insert(std::make_pair(index, result));
+			}
+			if (result.executions > 0)
+			{
+				m_fuzzed += "fuzzed " + result.name + ": " + PrivateHelper::to_s(result.executions) +
+					" executions, " + PrivateHelper::to_s(result.new_inputs) + " new inputs\n";
+			}
+
+			QInt64 now = PrivateHelper::now_ns();
+			QInt64 interval = (QInt64)(m_terminal ? 100 : 5000) * 1000000;
+			if (now - m_last_progress >= interval)
+				progress(now);
 		}
 
+		void end(QInt64 duration_ns)
+		{
+			clear_progress();
+
+			char seconds[32];
+			sprintf(seconds, "%f", duration_ns / 1e9);
+			m_out << "Finished in " << seconds << " seconds.\n\n";
+			if (!m_fuzzed.empty())
+				m_out << m_fuzzed << "\n";
+
+			int index = 1;
+			std::map<size_t, QResult>::const_iterator i = m_problems.begin();
+			for (; i != m_problems.end(); ++i, ++index)
+				details(index, i->second);
+			m_out.flush();
+
+#ifdef X_OS_WIN32
+			CONSOLE_SCREEN_BUFFER_INFO csbiInfo; 
+			GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbiInfo);
+
+			if (m_error_count + m_failure_count)
+				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 0xf|BACKGROUND_RED);
+			else
+				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 0xf|BACKGROUND_GREEN);
+#endif
+			
+			m_out << m_test_count << " tests, " << m_assertion_count << " assertions, " 
+				<< m_failure_count << " failures, " << m_error_count << " errors";
+			m_out.flush();
+
+#ifdef X_OS_WIN32
+			SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), csbiInfo.wAttributes);
+#endif
+			m_out << "\n";
+			m_out.flush();
+		}
 	};
 
 
@@ -67,6 +344,14 @@ namespace QUnit {
 	{
 		std::string m_testcase;
 		std::string m_test;
+		std::string m_xml;
+		std::string m_log;
+		std::string m_format;
+		std::vector<std::string> m_filters;
+		int m_regex_budget;
+		int m_jobs;
+		bool m_isolate;
+		int m_fuzz;
 		QTests m_tests;
 
 	public:
@@ -78,86 +363,110 @@ namespace QUnit {
 		{
 			m_testcase = testcase_filter;
 			m_test = test_filter;
-			m_tests = tests;
+			m_format = "console";
+			m_regex_budget = QUNIT_REGEX_BUDGET;
+			m_jobs = 1;
+			m_isolate = false;
+			m_fuzz = 0;
+			m_tests = expand(tests);
 		}
 
 		QCUIRunner(
 			int argc, char** argv,
 			const QTests& tests = QModule::inst().tests())
 		{
-			m_tests = tests;
+			m_tests = expand(tests);
 			QCUIOptParser parser(argc - 1, argv + 1);
 			m_test = parser.test;
 			m_testcase = parser.testcase;
+			m_xml = parser.xml;
+			m_log = parser.log;
+			m_format = parser.format;
+			m_filters = parser.filters;
+			m_regex_budget = parser.regex_budget;
+			m_jobs = parser.jobs;
+			m_isolate = parser.isolate;
+			m_fuzz = parser.fuzz;
 		}
 		~QCUIRunner()
 		{
-			QCUIRunnerHost host(m_testcase.c_str(), m_test.c_str());
-			
-			puts("Started");
-			clock_t start_clock = clock();
+			QTally tally;
+			QReporters reporters;
+			reporters.add(&tally);
 
-			run(&host, m_tests);
-
-			printf("\nFinished in %f seconds.\n\n", (clock() - start_clock) / 1000.0 );
+			// the --format reporter owns stdout
+			QReporter* output;
+			if (m_format == "jsonl")
+				output = new QJsonLinesReporter(stdout);
+			else if (m_format == "tap")
+				output = new QTapReporter(stdout);
+			else
+				output = new QConsoleReporter();
+			reporters.add(output);
 
-			int index = 1;
-			int failure_count = 0;
-			int error_count = 0;
-			int assertion_count = 0;
-			QResults::const_iterator i = host.results.begin();
-			for (; i < host.results.end(); ++i)
+			FILE* xml_file = NULL;
+			QNUnitXmlReporter* xml = NULL;
+			if (!m_xml.empty())
 			{
-				std::string test_name;
-				if (i->testcase == "QDefaultCase")
-					test_name = i->name;
+				xml_file = fopen(m_xml.c_str(), "wb");
+				if (xml_file == NULL)
+					printf("can't open %s for writing.\n", m_xml.c_str());
 				else
 				{
-					std::ostringstream o;
-					o << i->name;
-					o << "(";
-					o << i->testcase;
-					o << ")";
-					test_name = o.str();
+					xml = new QNUnitXmlReporter(xml_file);
+					reporters.add(xml);
 				}
+			}
 
-				switch(i->type)
+			FILE* log_file = NULL;
+			QBinaryLogWriter* log = NULL;
+			if (!m_log.empty())
+			{
+				log_file = fopen(m_log.c_str(), "wb");
+				if (log_file == NULL)
+					printf("can't open %s for writing.\n", m_log.c_str());
+				else
 				{
-				case QResult::failure:
-					printf("  %d) Failure:\n", index);
-					printf("%s [%s:%d]:\n%s\n\n", test_name.c_str(),
-						i->fail.file.c_str(), i->fail.line, i->fail.condition.c_str());
-					++failure_count;
-					++index;
-					break;
-				case QResult::error:
-					printf("  %d) Error:\n", index);
-					printf("%s(%s):\n%s\n\n", i->name.c_str(), i->testcase.c_str(), i->msg.c_str());
-					++error_count;
-					++index;
-					break;
+					// unbuffered, so a crash loses no finished result
+					log = new QBinaryLogWriter(log_file, 0);
+					reporters.add(log);
 				}
-				assertion_count += i->assertion_count;
 			}
-			
 
-#ifdef X_OS_WIN32
-			CONSOLE_SCREEN_BUFFER_INFO csbiInfo; 
-			GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbiInfo);
+			CStepBudget::m_nDefaultMaxSteps = m_regex_budget;
 
-			if (error_count + failure_count)
-				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 0xf|BACKGROUND_RED);
+			QAsyncReporter reporter(reporters);
+			QCUIRunnerHost host(m_testcase.c_str(), m_test.c_str(), &reporter, m_filters);
+
+			QTests selected;
+			for (size_t i = 0; i < m_tests.size(); ++i)
+			{
+				if (is_selected(&host, m_tests[i]))
+					selected.push_back(m_tests[i]);
+			}
+
+			QInt64 start = PrivateHelper::now_ns();
+			reporter.begin(selected);
+			if (m_fuzz > 0)
+				fuzz(&host, selected, m_fuzz);
+			else if (m_isolate)
+				run_isolated(&host, selected, m_jobs);
 			else
-				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 0xf|BACKGROUND_GREEN);
-#endif
-			
-			printf("%d tests, %d assertions, %d failures, %d errors\n", 
-				host.results.size(), assertion_count, failure_count, error_count);
+				run(&host, selected, m_jobs);
+			reporter.end(PrivateHelper::now_ns() - start);
 
-#ifdef X_OS_WIN32
-			SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), csbiInfo.wAttributes);
-#endif
-			exit(error_count + failure_count);
+			if (xml_file != NULL)
+			{
+				delete xml;
+				fclose(xml_file);
+			}
+			if (log_file != NULL)
+			{
+				delete log;
+				fclose(log_file);
+			}
+			delete output;
+			exit(tally.errors + tally.failures);
 		}
 
 	};
@@ -0,0 +1,623 @@
+#ifndef __QUNIT_RUNNER_ISOLATE_H__
+#define __QUNIT_RUNNER_ISOLATE_H__
+
+// -------------------------------------------------------------------------
+// Running tests in worker processes.
+//
+// run_isolated() forks `jobs` workers that take tests from a QSchedule
+// in shared memory. Each worker has fd 1 and 2 pointed at its own memfd (a
+// temporary file where there is no memfd) and streams its results back
+// over a pipe in the binary log encoding. After a test the worker looks
+// at the capture file's offset: if nothing was printed that is the only
+// cost; otherwise the output is read back for a failed test and dropped
+// for a passed one. A worker that dies mid-test is reported as an error
+// for that test, with whatever it printed, and replaced while tests
+// remain. Where fork() isn't available run_isolated() is run().
+//
+// The tests of a qzygote testcase run apart from the rest: a zygote
+// process is forked, runs the testcase's setup once and then runs the
+// workers above, each for a single test, so every test starts from a
+// copy-on-write snapshot of the set-up state. The zygote relays the
+// workers' results to the runner over one more pipe.
+
+#include <set>
+
+#ifdef X_OS_UNIX
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace QUnit {
+
+#ifdef X_OS_UNIX
+
+	namespace PrivateHelper
+	{
+		inline
+		int capture_fd()
+		{
+#ifdef MFD_CLOEXEC
+			int fd = memfd_create("qunit-output", MFD_CLOEXEC);
+			if (fd >= 0)
+				return fd;
+#endif
+			FILE* f = tmpfile();
+			return f != NULL ? dup(fileno(f)) : -1;
+		}
+
+		// everything written to fd since the last call, then rewinds it
+		inline
+		std::string take_output(int fd, bool keep)
+		{
+			std::string output;
+			off_t size = lseek(fd, 0, SEEK_CUR);
+			if (size <= 0)
+				return output;
+
+			if (keep)
+			{
+				output.resize((size_t)size);
+				ssize_t n = pread(fd, &output[0], (size_t)size, 0);
+				output.resize(n > 0 ? (size_t)n : 0);
+			}
+			ftruncate(fd, 0);
+			lseek(fd, 0, SEEK_SET);
+			return output;
+		}
+
+		// the host of a worker process
+		class QChildHost : public QRunHost
+		{
+			QBinaryLogWriter& m_writer;
+			int m_capture;
+
+		public:
+			QChildHost(QBinaryLogWriter& writer, int capture)
+				: m_writer(writer), m_capture(capture)
+			{
+			}
+
+			bool is_excluded(const QTest&)
+			{
+				return false;
+			}
+			void started(const QTest& test)
+			{
+				m_writer.test_started(test);
+			}
+			void done(const QResult& result)
+			{
+				fflush(stdout);
+				fflush(stderr);
+				std::string output = take_output(m_capture, result.type != QResult::pass);
+				if (output.empty())
+					m_writer.test_finished(result);
+				else
+				{
+					QResult failed = result;
+					failed.output = output;
+					m_writer.test_finished(failed);
+				}
+			}
+		};
+
+		// the parent's end of one worker: forwards the worker's results
+		// to the real host and remembers which test is in flight
+		class QWorkerSink : public QReporter
+		{
+			QRunHost* m_host;
+			const std::map<std::string, const QTest*>& m_tests;
+
+		public:
+			const QTest* current;
+
+			QWorkerSink(QRunHost* host, const std::map<std::string, const QTest*>& tests)
+				: m_host(host), m_tests(tests)
+			{
+				current = NULL;
+			}
+
+			void test_started(const QTest& test)
+			{
+				std::map<std::string, const QTest*>::const_iterator i =
+					m_tests.find(test.testcase + '\0' + test.name);
+				current = i != m_tests.end() ? i->second : NULL;
+				if (current != NULL)
+					m_host->started(*current);
+			}
+			void test_finished(const QResult& result)
+			{
+				current = NULL;
+				m_host->done(result);
+			}
+		};
+
+		struct QWorkerProcess
+		{
+			pid_t pid;
+			int pipe;
+			int capture;
+			std::string pending;
+			QBinaryLogReader* reader;
+			QWorkerSink* sink;
+			QRecordSite* site;
+		};
+
+		// relays results to the runner, as a zygote does
+		class QForwardHost : public QRunHost
+		{
+			QBinaryLogWriter& m_writer;
+
+		public:
+			QForwardHost(QBinaryLogWriter& writer) : m_writer(writer)
+			{
+			}
+
+			bool is_excluded(const QTest&)
+			{
+				return false;
+			}
+			void started(const QTest& test)
+			{
+				m_writer.test_started(test);
+			}
+			void done(const QResult& result)
+			{
+				m_writer.test_finished(result);
+			}
+		};
+
+		// a worker with fresh set runs one test and exits
+		inline
+		void worker_main(const QTests& tests, QSchedule& schedule,
+			int pipe, int capture, bool fresh, QRecordSite* site)
+		{
+			dup2(capture, 1);
+			dup2(capture, 2);
+			record_site() = site;
+
+			FILE* out = fdopen(pipe, "wb");
+			QBinaryLogWriter writer(out, 0);
+			QChildHost host(writer, capture);
+			for (;;)
+			{
+				size_t i = 0;
+				int next = schedule.take(i);
+				if (next == QSchedule::finished)
+					break;
+				if (next == QSchedule::wait)
+				{
+					sleep_ms(1);
+					continue;
+				}
+				if (site != NULL)
+					site->offset = -1;
+				run_test(&host, tests[i]);
+				schedule.release(i);
+				if (fresh)
+					break;
+			}
+			writer.end(0);
+			_exit(0);
+		}
+
+		inline
+		bool spawn_worker(QWorkerProcess& worker, QRunHost* host,
+			const std::map<std::string, const QTest*>& index,
+			const QTests& tests, QSchedule& schedule, bool fresh)
+		{
+			int fds[2];
+			worker.capture = capture_fd();
+			if (worker.capture < 0)
+				return false;
+			if (::pipe(fds) != 0)
+			{
+				close(worker.capture);
+				return false;
+			}
+
+			void* shared = mmap(NULL, sizeof(QRecordSite), PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+			worker.site = shared != MAP_FAILED ? (QRecordSite*)shared : NULL;
+			if (worker.site != NULL)
+				worker.site->offset = -1;
+
+			fflush(stdout);
+			fflush(stderr);
+			worker.pid = fork();
+			if (worker.pid == 0)
+			{
+				close(fds[0]);
+				worker_main(tests, schedule, fds[1], worker.capture, fresh, worker.site);
+			}
+			close(fds[1]);
+			if (worker.pid < 0)
+			{
+				close(fds[0]);
+				close(worker.capture);
+				if (worker.site != NULL)
+					munmap(worker.site, sizeof(QRecordSite));
+				return false;
+			}
+
+			worker.pipe = fds[0];
+			worker.pending.clear();
+			worker.reader = new QBinaryLogReader();
+			worker.sink = new QWorkerSink(host, index);
+			return true;
+		}
+
+		// reaps a worker whose pipe has closed, giving back the resources
+		// of a test it died in
+		inline
+		void finish_worker(QWorkerProcess& worker, QRunHost* host,
+			const QTests& tests, QSchedule& schedule)
+		{
+			int status = 0;
+			while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR)
+				;
+
+			if (worker.sink->current != NULL)
+			{
+				char msg[64];
+				if (WIFSIGNALED(status))
+					sprintf(msg, "worker process killed by signal %d", WTERMSIG(status));
+				else
+					sprintf(msg, "worker process exited with status %d", WEXITSTATUS(status));
+
+				QResult result(*worker.sink->current);
+				result.type = QResult::error;
+				result.msg = msg;
+				if (worker.site != NULL && worker.site->offset >= 0)
+				{
+					// the data test's record it died in
+					result.msg = std::string(worker.site->path) + "@" + to_s((QInt64)worker.site->offset) + ": " + result.msg;
+				}
+				result.output = take_output(worker.capture, true);
+				host->done(result);
+				schedule.release(worker.sink->current - &tests[0]);
+			}
+
+			close(worker.pipe);
+			close(worker.capture);
+			if (worker.site != NULL)
+				munmap(worker.site, sizeof(QRecordSite));
+			delete worker.reader;
+			delete worker.sink;
+			worker.pid = -1;
+		}
+
+		// runs tests[todo[i]] in up to jobs worker processes; false if
+		// no worker could be started
+		inline
+		bool run_workers(QRunHost* host, const QTests& tests,
+			const std::vector<size_t>& todo, int jobs, bool fresh)
+		{
+			std::map<std::string, const QTest*> index;
+			for (size_t i = 0; i < todo.size(); ++i)
+				index[tests[todo[i]].testcase + '\0' + tests[todo[i]].name] = &tests[todo[i]];
+
+			QSchedule schedule(tests, todo);
+			void* shared = mmap(NULL, schedule.state_size(),
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+			if (shared == MAP_FAILED)
+				return false;
+			schedule.move_state((long*)shared);
+
+			if (jobs < 1)
+				jobs = 1;
+			if (jobs > (int)todo.size())
+				jobs = (int)todo.size();
+
+			std::vector<QWorkerProcess> workers(jobs);
+			int running = 0;
+			for (size_t w = 0; w < workers.size(); ++w)
+			{
+				if (spawn_worker(workers[w], host, index, tests, schedule, fresh))
+					++running;
+				else
+					workers[w].pid = -1;
+			}
+			if (running == 0)
+			{
+				munmap(shared, schedule.state_size());
+				return false;
+			}
+
+			std::vector<struct pollfd> fds;
+			std::vector<size_t> slots;
+			char buf[64 * 1024];
+			while (running > 0)
+			{
+				fds.clear();
+				slots.clear();
+				for (size_t w = 0; w < workers.size(); ++w)
+				{
+					if (workers[w].pid < 0)
+						continue;
+					struct pollfd pfd;
+					pfd.fd = workers[w].pipe;
+					pfd.events = POLLIN;
+					pfd.revents = 0;
+					fds.push_back(pfd);
+					slots.push_back(w);
+				}
+				if (poll(&fds[0], fds.size(), -1) < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					break;
+				}
+
+				for (size_t f = 0; f < fds.size(); ++f)
+				{
+					if (fds[f].revents == 0)
+						continue;
+
+					QWorkerProcess& worker = workers[slots[f]];
+					ssize_t n = read(worker.pipe, buf, sizeof(buf));
+					if (n < 0 && errno == EINTR)
+						continue;
+					if (n > 0)
+					{
+						worker.pending.append(buf, n);
+						size_t used = worker.reader->decode(
+							worker.pending.data(), worker.pending.size(), *worker.sink);
+						worker.pending.erase(0, used);
+						continue;
+					}
+
+					finish_worker(worker, host, tests, schedule);
+					--running;
+					if (schedule.remaining() &&
+						spawn_worker(worker, host, index, tests, schedule, fresh))
+						++running;
+				}
+			}
+
+			munmap(shared, schedule.state_size());
+			return true;
+		}
+
+		// runs setup, reporting what it threw
+		inline
+		std::string zygote_setup(QZygoteSetup setup)
+		{
+			try
+			{
+				setup();
+				return "";
+			}
+			catch (const QFailure& e)
+			{
+				return e.condition;
+			}
+			catch (const std::exception& e)
+			{
+				return e.what();
+			}
+			catch (const char* e)
+			{
+				return e;
+			}
+			catch (const std::string& e)
+			{
+				return e;
+			}
+			catch (...)
+			{
+				return "Unknown exception";
+			}
+		}
+
+		inline
+		void fail_all(QRunHost* host, const QTests& tests,
+			const std::vector<size_t>& todo, const std::string& msg)
+		{
+			for (size_t i = 0; i < todo.size(); ++i)
+			{
+				QResult result(tests[todo[i]]);
+				result.type = QResult::error;
+				result.msg = msg;
+				host->started(tests[todo[i]]);
+				host->done(result);
+			}
+		}
+
+		inline
+		void zygote_main(const QTests& tests, const std::vector<size_t>& todo,
+			int jobs, QZygoteSetup setup, int pipe)
+		{
+			FILE* out = fdopen(pipe, "wb");
+			QBinaryLogWriter writer(out, 0);
+			QForwardHost host(writer);
+
+			std::string error = zygote_setup(setup);
+			if (!error.empty())
+				fail_all(&host, tests, todo, "zygote setup failed: " + error);
+			else if (!run_workers(&host, tests, todo, jobs, true))
+				fail_all(&host, tests, todo, "can't fork test processes");
+			writer.end(0);
+			_exit(0);
+		}
+
+		// the runner's end of a zygote: also notes which tests reported
+		class QZygoteSink : public QWorkerSink
+		{
+		public:
+			std::set<std::string> finished;
+
+			QZygoteSink(QRunHost* host, const std::map<std::string, const QTest*>& tests)
+				: QWorkerSink(host, tests)
+			{
+			}
+
+			void test_finished(const QResult& result)
+			{
+				finished.insert(result.testcase + '\0' + result.name);
+				QWorkerSink::test_finished(result);
+			}
+		};
+
+		inline
+		void run_zygote(QRunHost* host, const QTests& tests,
+			const std::vector<size_t>& todo, int jobs, QZygoteSetup setup) throw()
+		{
+			std::map<std::string, const QTest*> index;
+			for (size_t i = 0; i < todo.size(); ++i)
+				index[tests[todo[i]].testcase + '\0' + tests[todo[i]].name] = &tests[todo[i]];
+
+			int fds[2];
+			pid_t pid = -1;
+			if (::pipe(fds) == 0)
+			{
+				fflush(stdout);
+				fflush(stderr);
+				pid = fork();
+				if (pid == 0)
+				{
+					close(fds[0]);
+					zygote_main(tests, todo, jobs, setup, fds[1]);
+				}
+				close(fds[1]);
+				if (pid < 0)
+					close(fds[0]);
+			}
+			if (pid < 0)
+			{
+				// no snapshots: set up in this process, and the tests share it
+				std::string error = zygote_setup(setup);
+				if (!error.empty())
+					fail_all(host, tests, todo, "zygote setup failed: " + error);
+				else
+				{
+					for (size_t i = 0; i < todo.size(); ++i)
+						run_test(host, tests[todo[i]]);
+				}
+				return;
+			}
+
+			QZygoteSink sink(host, index);
+			QBinaryLogReader reader;
+			std::string pending;
+			char buf[64 * 1024];
+			for (;;)
+			{
+				ssize_t n = read(fds[0], buf, sizeof(buf));
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n <= 0)
+					break;
+				pending.append(buf, n);
+				pending.erase(0, reader.decode(pending.data(), pending.size(), sink));
+			}
+			close(fds[0]);
+
+			int status = 0;
+			while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+				;
+
+			// the zygote died before reporting every test
+			char msg[64];
+			if (WIFSIGNALED(status))
+				sprintf(msg, "zygote process killed by signal %d", WTERMSIG(status));
+			else
+				sprintf(msg, "zygote process exited with status %d", WEXITSTATUS(status));
+			for (size_t i = 0; i < todo.size(); ++i)
+			{
+				const QTest& test = tests[todo[i]];
+				if (sink.finished.count(test.testcase + '\0' + test.name) != 0)
+					continue;
+				if (&test != sink.current)
+					host->started(test);
+				QResult result(test);
+				result.type = QResult::error;
+				result.msg = msg;
+				host->done(result);
+			}
+		}
+	}
+
+	inline
+	void run_isolated(QRunHost* host,
+		const QTests& tests = QModule::inst().tests(), int jobs = 1) throw()
+	{
+		using namespace PrivateHelper;
+
+		QHostBase defHost;
+		if (host == NULL)
+			host = &defHost;
+
+		if (needs_expand(tests))
+		{
+			run_isolated(host, expand(tests), jobs);
+			return;
+		}
+
+		std::vector<size_t> todo;
+		for (size_t i = 0; i < tests.size(); ++i)
+		{
+			if (is_selected(host, tests[i]))
+				todo.push_back(i);
+		}
+
+		std::map<std::string, std::vector<size_t> > zygotes;
+		split_zygotes(tests, todo, zygotes);
+		if (!todo.empty() && !run_workers(host, tests, todo, jobs, false))
+		{
+			run(host, tests, jobs);
+			return;
+		}
+		run_zygotes(host, tests, zygotes, jobs);
+	}
+
+#else
+
+	namespace PrivateHelper
+	{
+		// no snapshots without fork(): set up once, and the tests share it
+		inline
+		void run_zygote(QRunHost* host, const QTests& tests,
+			const std::vector<size_t>& todo, int, QZygoteSetup setup) throw()
+		{
+			try
+			{
+				setup();
+			}
+			catch (...)
+			{
+				for (size_t i = 0; i < todo.size(); ++i)
+				{
+					QResult result(tests[todo[i]]);
+					result.type = QResult::error;
+					result.msg = "zygote setup failed";
+					host->started(tests[todo[i]]);
+					host->done(result);
+				}
+				return;
+			}
+			for (size_t i = 0; i < todo.size(); ++i)
+				run_test(host, tests[todo[i]]);
+		}
+	}
+
+	inline
+	void run_isolated(QRunHost* host,
+		const QTests& tests = QModule::inst().tests(), int jobs = 1) throw()
+	{
+		run(host, tests, jobs);
+	}
+
+#endif
+
+}
+
+// -------------------------------------------------------------------------
+//
+
+#endif /* __QUNIT_RUNNER_ISOLATE_H__ */
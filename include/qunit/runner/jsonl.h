@@ -0,0 +1,74 @@
+#ifndef __QUNIT_RUNNER_JSONL_H__
+#define __QUNIT_RUNNER_JSONL_H__
+
+// -------------------------------------------------------------------------
+namespace QUnit {
+
+	// One JSON object per line and per result, written as tests finish:
+	//
+	// {"testcase":"FooCase","name":"testBar","status":"failure",
+	//  "duration_ns":1250,"assertions":3,"file":"foo.cpp","line":42,
+	//  "message":"..."}
+	//
+	// file and line are only present for failures, message for failures
+	// and errors, output for failures and errors that printed something,
+	// executions and new_inputs for the targets of a fuzzing session.
+	class QJsonLinesReporter : public QReporter
+	{
+		QOutBuffer m_out;
+
+	public:
+		QJsonLinesReporter(FILE* file) : m_out(file)
+		{
+		}
+
+	public:
+		void test_finished(const QResult& result)
+		{
+			m_out << "{\"testcase\":";
+			m_out.quoted(result.testcase);
+			m_out << ",\"name\":";
+			m_out.quoted(result.name);
+			m_out << ",\"status\":\"" << status_name(result) << '"';
+			m_out << ",\"duration_ns\":" << result.duration_ns;
+			m_out << ",\"assertions\":" << result.assertion_count;
+			if (result.executions > 0)
+			{
+				m_out << ",\"executions\":" << result.executions;
+				m_out << ",\"new_inputs\":" << result.new_inputs;
+			}
+
+			if (result.type == QResult::failure)
+			{
+				m_out << ",\"file\":";
+				m_out.quoted(result.fail.file);
+				m_out << ",\"line\":" << result.fail.line;
+				m_out << ",\"message\":";
+				m_out.quoted(result.fail.condition);
+			}
+			else if (result.type == QResult::error)
+			{
+				m_out << ",\"message\":";
+				m_out.quoted(result.msg);
+			}
+			if (!result.output.empty())
+			{
+				m_out << ",\"output\":";
+				m_out.quoted(result.output);
+			}
+			m_out << "}\n";
+			m_out.commit();
+		}
+
+		void end(QInt64)
+		{
+			m_out.flush();
+		}
+	};
+
+}
+
+// -------------------------------------------------------------------------
+//
+
+#endif /* __QUNIT_RUNNER_JSONL_H__ */
@@ -0,0 +1,393 @@
+#ifndef __QUNIT_RUNNER_REPORT_H__
+#define __QUNIT_RUNNER_REPORT_H__
+
+#include <stdio.h>
+
+// Encoding of the text the JSON Lines and TAP reporters are given, as
+// QUNIT_XML_ENCODING is for XML. Their output is always UTF-8: with the
+// UTF-8 default, valid sequences pass through; with any other value every
+// byte from 0x80 up is written as a \u0080-\u00ff escape, so a consumer
+// can take the bytes back and decode them with that encoding.
+#ifndef QUNIT_REPORT_ENCODING
+#define QUNIT_REPORT_ENCODING "UTF-8"
+#endif
+
+// -------------------------------------------------------------------------
+namespace QUnit {
+
+	// Fans every event out to a list of reporters, in the order they
+	// were added. The reporters are not owned.
+	class QReporters : public QReporter
+	{
+		std::vector<QReporter*> m_reporters;
+
+	public:
+		void add(QReporter* reporter)
+		{
+			m_reporters.push_back(reporter);
+		}
+		size_t size() const
+		{
+			return m_reporters.size();
+		}
+
+	public:
+		void begin(const QTests& tests)
+		{
+			for (size_t i = 0; i < m_reporters.size(); ++i)
+				m_reporters[i]->begin(tests);
+		}
+		void test_started(const QTest& test)
+		{
+			for (size_t i = 0; i < m_reporters.size(); ++i)
+				m_reporters[i]->test_started(test);
+		}
+		void test_finished(const QResult& result)
+		{
+			for (size_t i = 0; i < m_reporters.size(); ++i)
+				m_reporters[i]->test_finished(result);
+		}
+		void end(QInt64 duration_ns)
+		{
+			for (size_t i = 0; i < m_reporters.size(); ++i)
+				m_reporters[i]->end(duration_ns);
+		}
+	};
+
+
+	// Counts outcomes; the runner uses it for its exit code whatever
+	// output format was chosen.
+	class QTally : public QReporter
+	{
+	public:
+		int tests;
+		int assertions;
+		int failures;
+		int errors;
+
+		QTally()
+		{
+			tests = assertions = failures = errors = 0;
+		}
+
+		void test_finished(const QResult& result)
+		{
+			++tests;
+			assertions += result.assertion_count;
+			if (result.type == QResult::failure)
+				++failures;
+			else if (result.type == QResult::error)
+				++errors;
+		}
+	};
+
+
+	// Output buffer for the machine-readable reporters. Records are
+	// appended in memory and handed to the FILE in large blocks, so a
+	// run of 100k tests costs a few dozen writes instead of one
+	// formatted write per test. Call flush() at the end of the run.
+	class QOutBuffer
+	{
+		FILE* m_file;
+		std::string m_buf;
+		size_t m_limit;
+		bool m_utf8;
+
+	public:
+		QOutBuffer(FILE* file, size_t limit = 256 * 1024)
+		{
+			m_file = file;
+			m_limit = limit;
+			m_utf8 = strcmp(QUNIT_REPORT_ENCODING, "UTF-8") == 0;
+			m_buf.reserve(limit + 256);
+		}
+		~QOutBuffer()
+		{
+			flush();
+		}
+
+		QOutBuffer& operator<<(const char* s)
+		{
+			m_buf.append(s);
+			return *this;
+		}
+		QOutBuffer& operator<<(const std::string& s)
+		{
+			m_buf.append(s);
+			return *this;
+		}
+		QOutBuffer& operator<<(char c)
+		{
+			m_buf += c;
+			return *this;
+		}
+		QOutBuffer& operator<<(QInt64 value)
+		{
+			char digits[24];
+			int n = 0;
+			if (value < 0)
+			{
+				m_buf += '-';
+				value = -value;
+			}
+			do
+			{
+				digits[n++] = (char)('0' + value % 10);
+				value /= 10;
+			} while (value != 0);
+			while (n > 0)
+				m_buf += digits[--n];
+			return *this;
+		}
+		QOutBuffer& operator<<(int value)
+		{
+			return *this << (QInt64)value;
+		}
+
+		// a JSON string literal, which is also a valid YAML scalar.
+		// High bytes that aren't passed through as UTF-8 are escaped one
+		// by one, so none is lost.
+		void quoted(const std::string& s)
+		{
+			static const char hex[] = "0123456789abcdef";
+			m_buf += '"';
+			const unsigned char* p = (const unsigned char*)s.c_str();
+			const unsigned char* e = p + s.size();
+			while (p < e)
+			{
+				unsigned char c = *p;
+				if (c >= 0x80)
+				{
+					int n = m_utf8 ? PrivateHelper::utf8_length(p, e) : 0;
+					if (n == 0)
+					{
+						m_buf.append("\\u00");
+						m_buf += hex[c >> 4];
+						m_buf += hex[c & 0xf];
+						n = 1;
+					}
+					else
+						m_buf.append((const char*)p, n);
+					p += n;
+					continue;
+				}
+
+				switch (c)
+				{
+				case '"': m_buf.append("\\\""); break;
+				case '\\': m_buf.append("\\\\"); break;
+				case '\n': m_buf.append("\\n"); break;
+				case '\r': m_buf.append("\\r"); break;
+				case '\t': m_buf.append("\\t"); break;
+				default:
+					if (c < 0x20)
+					{
+						m_buf.append("\\u00");
+						m_buf += hex[c >> 4];
+						m_buf += hex[c & 0xf];
+					}
+					else
+						m_buf += (char)c;
+					break;
+				}
+				++p;
+			}
+			m_buf += '"';
+		}
+
+		// hands the buffer to the file once it is past the limit
+		void commit()
+		{
+			if (m_buf.size() >= m_limit)
+				flush();
+		}
+		void flush()
+		{
+			if (!m_buf.empty())
+				fwrite(m_buf.data(), m_buf.size(), 1, m_file);
+			m_buf.clear();
+			fflush(m_file);
+		}
+
+	private:
+		QOutBuffer(const QOutBuffer&);
+		QOutBuffer& operator=(const QOutBuffer&);
+	};
+
+
+	inline
+	const char* status_name(const QResult& result)
+	{
+		switch (result.type)
+		{
+		case QResult::failure:
+			return "failure";
+		case QResult::error:
+			return "error";
+		}
+		return "pass";
+	}
+
+
+	// Moves a reporter onto its own thread. Events are posted to a
+	// lock-free queue and delivered in order by the reporter thread, so
+	// a slow sink (a file on a network share, a compressor) never holds
+	// up the test workers. An idle reporter thread sleeps on an event
+	// that post() sets only while it is asleep. begin() starts the
+	// thread, end() drains the queue and joins it; the tests passed to
+	// begin() must outlive the run.
+	class QAsyncReporter : public QReporter
+	{
+		struct Event
+		{
+			enum {none, begin, started, finished, end};
+
+			int kind;
+			const QTests* tests;
+			QTest* test;
+			QResult* result;
+			QInt64 duration_ns;
+
+			Event(int k = none)
+			{
+				kind = k;
+				tests = NULL;
+				test = NULL;
+				result = NULL;
+				duration_ns = 0;
+			}
+		};
+
+		QReporter& m_sink;
+		PrivateHelper::QMpscQueue<Event> m_queue;
+		PrivateHelper::QEvent m_wakeup;
+		volatile long m_asleep;
+		PrivateHelper::QThread m_thread;
+		PrivateHelper::QMutex m_inline;
+		bool m_running;
+
+		// returns false once the end event has been delivered
+		bool deliver(const Event& e)
+		{
+			switch (e.kind)
+			{
+			case Event::begin:
+				m_sink.begin(*e.tests);
+				break;
+			case Event::started:
+				m_sink.test_started(*e.test);
+				delete e.test;
+				break;
+			case Event::finished:
+				m_sink.test_finished(*e.result);
+				delete e.result;
+				break;
+			case Event::end:
+				m_sink.end(e.duration_ns);
+				return false;
+			}
+			return true;
+		}
+
+		static void loop(void* arg)
+		{
+			QAsyncReporter* self = (QAsyncReporter*)arg;
+			int idle = 0;
+			for (;;)
+			{
+				Event e;
+				if (!self->m_queue.pop(e))
+				{
+					// spin briefly, then sleep until post() wakes us; the
+					// queue is checked again after m_asleep is published, so
+					// a push that didn't see it is still found
+					if (++idle < 64)
+					{
+						PrivateHelper::yield_thread();
+						continue;
+					}
+					self->m_asleep = 1;
+					PrivateHelper::memory_fence();
+					if (!self->m_queue.pop(e))
+						self->m_wakeup.wait();
+					self->m_asleep = 0;
+					if (e.kind == Event::none)
+						continue;
+				}
+				idle = 0;
+
+				if (!self->deliver(e))
+					return;
+			}
+		}
+
+		void post(const Event& e)
+		{
+			m_queue.push(e);
+			if (m_running)
+			{
+				PrivateHelper::memory_fence();
+				if (m_asleep)
+					m_wakeup.set();
+				return;
+			}
+
+			// no reporter thread could be started: deliver synchronously
+			PrivateHelper::QLock lock(m_inline);
+			Event pending;
+			while (m_queue.pop(pending))
+				deliver(pending);
+		}
+
+	public:
+		QAsyncReporter(QReporter& sink) : m_sink(sink)
+		{
+			m_asleep = 0;
+			m_running = false;
+		}
+		~QAsyncReporter()
+		{
+			if (m_running)
+				end(0);
+		}
+
+	public:
+		void begin(const QTests& tests)
+		{
+			m_running = m_thread.start(&QAsyncReporter::loop, this);
+
+			Event e(Event::begin);
+			e.tests = &tests;
+			post(e);
+		}
+		void test_started(const QTest& test)
+		{
+			Event e(Event::started);
+			e.test = new QTest(test);
+			post(e);
+		}
+		void test_finished(const QResult& result)
+		{
+			Event e(Event::finished);
+			e.result = new QResult(result);
+			post(e);
+		}
+		void end(QInt64 duration_ns)
+		{
+			Event e(Event::end);
+			e.duration_ns = duration_ns;
+			post(e);
+			if (m_running)
+			{
+				m_thread.join();
+				m_running = false;
+			}
+		}
+	};
+
+}
+
+// -------------------------------------------------------------------------
+//
+
+#endif /* __QUNIT_RUNNER_REPORT_H__ */
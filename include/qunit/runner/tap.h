@@ -0,0 +1,92 @@
+#ifndef __QUNIT_RUNNER_TAP_H__
+#define __QUNIT_RUNNER_TAP_H__
+
+// -------------------------------------------------------------------------
+namespace QUnit {
+
+	// Test Anything Protocol, version 13. Every result is a test line
+	// followed by a YAML block; the plan comes last since filtered runs
+	// don't know their test count up front.
+	class QTapReporter : public QReporter
+	{
+		QOutBuffer m_out;
+		int m_count;
+
+		void description(const QResult& result)
+		{
+			std::string name = result.testcase == "QDefaultCase" ?
+				result.name : result.testcase + "." + result.name;
+
+			std::string::size_type i = 0;
+			while ((i = name.find('#', i)) != std::string::npos)
+			{
+				name.insert(i, "\\");
+				i += 2;
+			}
+			m_out << name;
+		}
+
+	public:
+		QTapReporter(FILE* file) : m_out(file)
+		{
+			m_count = 0;
+		}
+
+	public:
+		void begin(const QTests&)
+		{
+			m_out << "TAP version 13\n";
+		}
+
+		void test_finished(const QResult& result)
+		{
+			++m_count;
+			m_out << (result.type == QResult::pass ? "ok " : "not ok ") << m_count << " - ";
+			description(result);
+			m_out << "\n  ---\n  status: " << status_name(result);
+
+			char ms[32];
+			sprintf(ms, "%.3f", result.duration_ns / 1e6);
+			m_out << "\n  duration_ms: " << ms;
+			m_out << "\n  assertions: " << result.assertion_count;
+			if (result.executions > 0)
+			{
+				m_out << "\n  executions: " << result.executions;
+				m_out << "\n  new_inputs: " << result.new_inputs;
+			}
+
+			if (result.type == QResult::failure)
+			{
+				m_out << "\n  message: ";
+				m_out.quoted(result.fail.condition);
+				m_out << "\n  at:\n    file: ";
+				m_out.quoted(result.fail.file);
+				m_out << "\n    line: " << result.fail.line;
+			}
+			else if (result.type == QResult::error)
+			{
+				m_out << "\n  message: ";
+				m_out.quoted(result.msg);
+			}
+			if (!result.output.empty())
+			{
+				m_out << "\n  output: ";
+				m_out.quoted(result.output);
+			}
+			m_out << "\n  ...\n";
+			m_out.commit();
+		}
+
+		void end(QInt64)
+		{
+			m_out << "1.." << m_count << "\n";
+			m_out.flush();
+		}
+	};
+
+}
+
+// -------------------------------------------------------------------------
+//
+
+#endif /* __QUNIT_RUNNER_TAP_H__ */
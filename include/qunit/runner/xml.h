@@ -1,183 +1,396 @@
 #ifndef __QUNIT_RUNNER_XML_H__
 #define __QUNIT_RUNNER_XML_H__
 
-#include <iosfwd>
+#include <stdio.h>
+#include <time.h>
+
+// Declared encoding of the report. With the UTF-8 default any byte that
+// doesn't form valid UTF-8 (e.g. GBK literals) is replaced with U+FFFD so
+// the document stays well-formed; any other value passes bytes through.
+#ifndef QUNIT_XML_ENCODING
+#define QUNIT_XML_ENCODING "UTF-8"
+#endif
 
 // -------------------------------------------------------------------------
 namespace QUnit {
 
-#define _A(name, value) #name "=" #value " "
-
 	class XmlWr
 	{
-		FILE* m_wr;
+		std::string m_buf;
+		bool m_utf8;
+
+		enum {in_text, in_attr, in_cdata};
+
 		void _W(const char* s)
 		{
-			fwrite(s, strlen(s), 1, m_wr);
+			m_buf.append(s);
+		}
+		void _E(const std::string& s, int where)
+		{
+			const unsigned char* p = (const unsigned char*)s.c_str();
+			const unsigned char* e = p + s.size();
+			while (p < e)
+			{
+				unsigned char c = *p;
+				if (c < 0x80)
+				{
+					// CDATA keeps markup characters as they are
+					switch (c)
+					{
+					case '&': _W(where == in_cdata ? "&" : "&amp;"); break;
+					case '<': _W(where == in_cdata ? "<" : "&lt;"); break;
+					case '>': _W(where == in_cdata ? ">" : "&gt;"); break;
+					case '"': _W(where == in_attr ? "&quot;" : "\""); break;
+					case '\t': case '\n': case '\r':
+						if (where == in_attr)
+						{
+							char ref[8];
+							sprintf(ref, "&#%d;", c);
+							_W(ref);
+						}
+						else
+							m_buf += (char)c;
+						break;
+					default:
+						m_buf += c < 0x20 ? '?' : (char)c;
+						break;
+					}
+					++p;
+					continue;
+				}
+
+				int n = utf8_length(p, e);
+				if (n > 0)
+				{
+					m_buf.append((const char*)p, n);
+					p += n;
+				}
+				else
+				{
+					_W("\xEF\xBF\xBD");
+					++p;
+				}
+			}
+		}
+
+		int utf8_length(const unsigned char* p, const unsigned char* e) const
+		{
+			// outside UTF-8 mode every high byte is taken as is
+			return m_utf8 ? PrivateHelper::utf8_length(p, e) : 1;
 		}
 
 	public:
-		void putWr(FILE* wr)
+		XmlWr()
+		{
+			m_utf8 = strcmp(QUNIT_XML_ENCODING, "UTF-8") == 0;
+		}
+
+		void putDecl()
 		{
-			m_wr = wr;
-			_W("<?xml version='1.0' encoding='UTF-8'?>");
+			_W("<?xml version=\"1.0\" encoding=\"" QUNIT_XML_ENCODING "\"?>\n");
 		}
-		void beginElem(const char* name, const char* attr = NULL)
+		void beginElem(const char* name)
 		{
 			_W("<");
 			_W(name);
-			if (attr)
-			{
-				_W(" ");
-				_W(attr);
-			}
+		}
+		void addAttr(const char* name, const std::string& value)
+		{
+			_W(" ");
+			_W(name);
+			_W("=\"");
+			_E(value, in_attr);
+			_W("\"");
+		}
+		void addAttr(const char* name, const char* value)
+		{
+			addAttr(name, std::string(value));
+		}
+		void addAttr(const char* name, int value)
+		{
+			char buf[32];
+			sprintf(buf, "%d", value);
+			addAttr(name, std::string(buf));
+		}
+		void addSeconds(const char* name, QInt64 ns)
+		{
+			char buf[32];
+			sprintf(buf, "%.3f", ns / 1e9);
+			addAttr(name, std::string(buf));
+		}
+		void closeStart(bool empty = false)
+		{
+			_W(empty ? " />\n" : ">\n");
+		}
+		void closeInline()
+		{
 			_W(">");
 		}
-		void addText(const char* text)
+		void addText(const std::string& text)
+		{
+			_E(text, in_text);
+		}
+		void addCData(const std::string& text)
 		{
-			_W(text);
+			_W("<![CDATA[");
+			std::string::size_type from = 0, to;
+			while ((to = text.find("]]>", from)) != std::string::npos)
+			{
+				_E(text.substr(from, to + 2 - from), in_cdata);
+				_W("]]><![CDATA[");
+				from = to + 2;
+			}
+			_E(text.substr(from), in_cdata);
+			_W("]]>");
 		}
 		void endElem(const char* name)
 		{
 			_W("</");
 			_W(name);
-			_W(">");
-			_W("\n");
+			_W(">\n");
+		}
+		const std::string& str() const
+		{
+			return m_buf;
 		}
-		void close()
+		void clear()
 		{
-			fclose(m_wr);
+			m_buf.clear();
 		}
 	};
 
 
+	// NUnit 2.x result document, written incrementally. After every test
+	// the file holds a complete, well-formed document: the new test-case
+	// is written over the previous closing tags, the closing tags are
+	// appended again and the fixed-width header is rewritten with the
+	// running totals. On an unseekable stream (a pipe) the header can't
+	// be rewritten, so the elements are held until end() and the whole
+	// document is written then, with its final totals.
 	class QNUnitXmlReporter : public QReporter
 	{
 		FILE* m_file;
+		std::string m_name;
+		bool m_seekable;
+		long m_tail;
+		std::string m_body;
+		size_t m_header_size;
+		std::string m_date;
+		std::string m_time;
+		QInt64 m_started;
+
+		int m_total;
+		int m_failures;
+		int m_errors;
+		int m_asserts;
+
+		XmlWr m_wr;
+
+		static const char* trailer()
+		{
+			return "</results>\n</test-suite>\n</test-results>\n";
+		}
+
+		std::string header(QInt64 elapsed_ns) const
+		{
+			bool success = m_failures + m_errors == 0;
+			XmlWr wr;
+			wr.putDecl();
+			wr.beginElem("test-results");
+			wr.addAttr("name", m_name);
+			wr.addAttr("total", m_total);
+			wr.addAttr("errors", m_errors);
+			wr.addAttr("failures", m_failures);
+			wr.addAttr("not-run", 0);
+			wr.addAttr("inconclusive", 0);
+			wr.addAttr("ignored", 0);
+			wr.addAttr("skipped", 0);
+			wr.addAttr("invalid", 0);
+			wr.addAttr("date", m_date);
+			wr.addAttr("time", m_time);
+			wr.closeStart();
+			wr.beginElem("test-suite");
+			wr.addAttr("type", "TestSuite");
+			wr.addAttr("name", m_name);
+			wr.addAttr("executed", "True");
+			wr.addAttr("result", success ? "Success" : "Failure");
+			wr.addAttr("success", success ? "True" : "False");
+			wr.addSeconds("time", elapsed_ns);
+			wr.addAttr("asserts", m_asserts);
+			wr.closeStart();
+			wr.beginElem("results");
+			wr.closeStart();
+			return wr.str();
+		}
+
+		// trailing blank line keeps the header at a fixed size so later
+		// rewrites fit in place.
+		std::string padded_header(QInt64 elapsed_ns) const
+		{
+			std::string h = header(elapsed_ns);
+			if (h.size() < m_header_size)
+			{
+				h.append(m_header_size - h.size() - 1, ' ');
+				h += '\n';
+			}
+			return h;
+		}
+
+		void rewrite_header(QInt64 elapsed_ns)
+		{
+			std::string h = padded_header(elapsed_ns);
+			if (h.size() > m_header_size)
+				return;
+			fseek(m_file, 0, SEEK_SET);
+			fwrite(h.data(), h.size(), 1, m_file);
+		}
+
+		static std::string full_name(const QResult& result)
+		{
+			if (result.testcase == "QDefaultCase")
+				return result.name;
+			return result.testcase + "." + result.name;
+		}
+
 	public:
-		QNUnitXmlReporter(FILE* file)
+		QNUnitXmlReporter(FILE* file, const char* name = "qunit")
 		{
 			m_file = file;
+			m_name = name;
+			m_seekable = false;
+			m_tail = 0;
+			m_header_size = 0;
+			m_started = 0;
+			m_total = m_failures = m_errors = m_asserts = 0;
 		}
 
 	public:
-		void end(const QResults& results, clock_t duration)
+		void begin(const QTests&)
 		{
-			XmlWr wr;
-			wr.putWr(m_file);
+			char buf[32];
+			time_t now = time(NULL);
+			strftime(buf, sizeof(buf), "%Y-%m-%d", localtime(&now));
+			m_date = buf;
+			strftime(buf, sizeof(buf), "%H:%M:%S", localtime(&now));
+			m_time = buf;
+			m_started = PrivateHelper::now_ns();
+
+			m_seekable = fseek(m_file, 0, SEEK_END) == 0 && ftell(m_file) == 0;
+			if (!m_seekable)
+				return;
+
+			m_header_size = header(0).size() + 128;
+			std::string h = padded_header(0);
+			fwrite(h.data(), h.size(), 1, m_file);
+			m_tail = (long)h.size();
 
+			fputs(trailer(), m_file);
+			fflush(m_file);
+		}
+
+		void test_finished(const QResult& result)
+		{
+			++m_total;
+			m_asserts += result.assertion_count;
+
+			const char* status = "Success";
+			if (result.type == QResult::failure)
 			{
-			std::ostringstream o;
-			o << _A(name,		'');
-			o << _A(total,		'2' );
-			o << _A(failures,	'2' );
-			o << _A(not-run,	'2' );
-			o << _A(date,		'0');
-			o << _A(time,		'0');
-			wr.beginElem("test-results", o.str().c_str());
+				status = "Failure";
+				++m_failures;
 			}
-
+			else if (result.type == QResult::error)
 			{
-			std::ostringstream o;
-			o << _A(name,		''		);
-			o << _A(success,	'True'	);
-			o << _A(asserts,	'0' );
-			wr.beginElem("test-suite", o.str().c_str());
+				status = "Error";
+				++m_errors;
 			}
-			wr.beginElem("results");
 
+			m_wr.clear();
+			m_wr.beginElem("test-case");
+			m_wr.addAttr("name", full_name(result));
+			m_wr.addAttr("executed", "True");
+			m_wr.addAttr("result", status);
+			m_wr.addAttr("success", result.type == QResult::pass ? "True" : "False");
+			m_wr.addSeconds("time", result.duration_ns);
+			m_wr.addAttr("asserts", result.assertion_count);
 
-			printf("\nFinished in %f seconds.\n\n", duration / 1000.0);
+			if (result.type == QResult::pass && result.executions == 0)
+				m_wr.closeStart(true);
+			else
+				m_wr.closeStart();
 
-			int index = 1;
-			int failure_count = 0;
-			int error_count = 0;
-			int assertion_count = 0;
-			QResults::const_iterator i = results.begin();
-			for (; i < results.end(); ++i)
+			if (result.executions > 0)
 			{
-				std::string test_name;
-				if (i->testcase == "QDefaultCase")
-					test_name = i->name;
-				else
-				{
-					std::ostringstream o;
-					o << i->name;
-					o << "(";
-					o << i->testcase;
-					o << ")";
-					test_name = o.str();
-				}
+				m_wr.beginElem("properties");
+				m_wr.closeStart();
+				m_wr.beginElem("property");
+				m_wr.addAttr("name", "executions");
+				m_wr.addAttr("value", PrivateHelper::to_s(result.executions));
+				m_wr.closeStart(true);
+				m_wr.beginElem("property");
+				m_wr.addAttr("name", "new_inputs");
+				m_wr.addAttr("value", PrivateHelper::to_s(result.new_inputs));
+				m_wr.closeStart(true);
+				m_wr.endElem("properties");
+			}
 
-				switch(i->type)
+			if (result.type != QResult::pass)
+			{
+				m_wr.beginElem("failure");
+				m_wr.closeStart();
+				m_wr.beginElem("message");
+				m_wr.closeInline();
+				if (result.type == QResult::failure)
+					m_wr.addCData(result.fail.condition);
+				else
+					m_wr.addCData(result.msg);
+				m_wr.endElem("message");
+				if (result.type == QResult::failure)
 				{
-				case QResult::failure:
-					{
-					std::ostringstream o;
-					o << _A(name,		''		);
-					o << _A(executed,	'True'	);
-					o << _A(success,	'False'	);
-					o << _A(time,		'0'		);
-					o << _A(asserts,	'3'		);
-					wr.beginElem("test-case", o.str().c_str());
-					wr.beginElem("failure", o.str().c_str());
-					wr.beginElem("message", o.str().c_str());
-					wr.addText("<![CDATA[   who am i ? - ]]>");
-					wr.endElem("message");
-					wr.endElem("failure");
-					wr.endElem("test-case");
-					}
-					
-					printf("  %d) Failure:\n", index);
-					printf("%s [%s:%d]:\n%s\n\n", test_name.c_str(),
-						i->fail.file.c_str(), i->fail.line, i->fail.condition.c_str());
-					++failure_count;
-					++index;
-					break;
-				case QResult::error:
-					{
-					std::ostringstream o;
-					o << _A(name,		''		);
-					o << _A(executed,	'True'	);
-					o << _A(success,	'True'	);
-					o << _A(time,		'0'		);
-					o << _A(asserts,	'3'		);
-					wr.beginElem("test-case", o.str().c_str());
-					wr.endElem("test-case");
-					}
-
-					printf("  %d) Error:\n", index);
-					printf("%s(%s):\n%s\n\n", i->name.c_str(), i->testcase.c_str(), i->msg.c_str());
-					++error_count;
-					++index;
-					break;
+					char line[32];
+					sprintf(line, ":%d", result.fail.line);
+					m_wr.beginElem("stack-trace");
+					m_wr.closeInline();
+					m_wr.addCData(result.fail.file + line);
+					m_wr.endElem("stack-trace");
 				}
-				assertion_count += i->assertion_count;
+				m_wr.endElem("failure");
 			}
-			
+			if (result.type != QResult::pass || result.executions > 0)
+				m_wr.endElem("test-case");
 
-			CONSOLE_SCREEN_BUFFER_INFO csbiInfo; 
-			GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbiInfo);
-
-			if (error_count + failure_count)
-				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 0xf|BACKGROUND_RED);
+			const std::string& elem = m_wr.str();
+			if (m_seekable)
+			{
+				fseek(m_file, m_tail, SEEK_SET);
+				fwrite(elem.data(), elem.size(), 1, m_file);
+				fputs(trailer(), m_file);
+				m_tail += (long)elem.size();
+				rewrite_header(PrivateHelper::now_ns() - m_started);
+				fflush(m_file);
+			}
 			else
-				SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), 0xf|BACKGROUND_GREEN);
-			
-			printf("%d tests, %d assertions, %d failures, %d errors\n", 
-				results.size(), assertion_count, failure_count, error_count);
-
-			SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), csbiInfo.wAttributes);
+				m_body += elem;
+		}
 
-			wr.endElem("results");
-			wr.endElem("test-suite");
-			wr.endElem("test-results");
+		void end(QInt64 duration_ns)
+		{
+			if (m_seekable)
+				rewrite_header(duration_ns);
+			else
+			{
+				std::string h = header(duration_ns);
+				fwrite(h.data(), h.size(), 1, m_file);
+				fwrite(m_body.data(), m_body.size(), 1, m_file);
+				fputs(trailer(), m_file);
+			}
+			fflush(m_file);
 		}
 	};
 
 }
 
 // -------------------------------------------------------------------------
-//	
+//
 
 #endif /* __QUNIT_RUNNER_XML_H__ */
@@ -10,15 +10,23 @@
 
 #include "private/platform.h"
 #include "private/helper.h"
+#include "private/thread.h"
 #include "private/deelx.h"
 
 // ----------------------------------------------------------------------------
 namespace QUnit {
 
-	class QRun : public PrivateHelper::QRunCookie
+	class QRun
 	{
 	public:
-		virtual void run() = 0;
+		virtual ~QRun() {}
+		virtual void run(PrivateHelper::QRunCookie* cookie) = 0;
+
+		// number of cases of a parameterized test, -1 for a plain one
+		virtual int cases()
+		{
+			return -1;
+		}
 	};
 	
 	struct QDefaultCase
@@ -43,9 +51,16 @@ namespace QUnit {
 	
 	struct QTest
 	{
+		QTest()
+		{
+			run = NULL;
+			param = -1;
+		}
+
 		std::string testcase;
 		std::string name;
 		QRun* run;
+		int param;		// case of a parameterized test, -1 for a plain one
 	};
 	typedef std::vector<QTest> QTests;
 
@@ -57,11 +72,15 @@ namespace QUnit {
 			name = test.name;
 			type = pass;
 			assertion_count = 0;
+			duration_ns = 0;
+			executions = 0;
+			new_inputs = 0;
 		}
 
 		std::string testcase;
 		std::string name;
 		int assertion_count;
+		QInt64 duration_ns;
 
 		enum {pass, failure, error};
 		int type;
@@ -69,13 +88,24 @@ namespace QUnit {
 		std::string msg;
 		QFailure fail;
 
+		// of a fuzzing session: inputs run, and inputs kept for new coverage
+		QInt64 executions;
+		QInt64 new_inputs;
+
+		// stdout/stderr of a failed test, when the runner captured it
+		std::string output;
 	};
 	typedef std::vector<QResult> QResults;
 	
+	// one-time setup of a testcase whose tests run in forks of a zygote
+	typedef void (*QZygoteSetup)();
 
 	class QModule
 	{
 		QTests m_tests;
+		std::map<std::string, QZygoteSetup> m_zygotes;
+		std::map<std::string, int> m_limits;
+		std::multimap<std::string, std::string> m_uses;	// testcase, or testcase\0test
 	public:
 		void add_test(const char* testcase, const char* name, QRun* run)
 		{
@@ -90,6 +120,57 @@ namespace QUnit {
 			return m_tests;
 		}
 
+		bool add_zygote(const char* testcase, QZygoteSetup setup)
+		{
+			m_zygotes[testcase] = setup;
+			return true;
+		}
+		QZygoteSetup zygote(const std::string& testcase) const
+		{
+			std::map<std::string, QZygoteSetup>::const_iterator i = m_zygotes.find(testcase);
+			return i != m_zygotes.end() ? i->second : NULL;
+		}
+
+		bool add_resource(const char* resource, int limit)
+		{
+			m_limits[resource] = limit > 0 ? limit : 1;
+			return true;
+		}
+		bool add_uses(const std::string& testcase, const char* test, const char* resource)
+		{
+			std::string key = testcase;
+			if (*test != 0)
+				key = key + '\0' + test;
+			m_uses.insert(std::make_pair(key, std::string(resource)));
+			return true;
+		}
+		// an undeclared resource admits one test at a time
+		int resource_limit(const std::string& resource) const
+		{
+			std::map<std::string, int>::const_iterator i = m_limits.find(resource);
+			return i != m_limits.end() ? i->second : 1;
+		}
+		// the resources of its testcase and its own; a case of a
+		// parameterized or typed test has those of the test
+		std::vector<std::string> resources(const QTest& test) const
+		{
+			std::vector<std::string> found;
+			if (m_uses.empty())
+				return found;
+			std::string name = test.name.substr(0, test.name.find_first_of("/<"));
+			std::string keys[2] = {test.testcase, test.testcase + '\0' + name};
+			for (int k = 0; k < 2; ++k)
+			{
+				std::multimap<std::string, std::string>::const_iterator i;
+				for (i = m_uses.lower_bound(keys[k]); i != m_uses.upper_bound(keys[k]); ++i)
+				{
+					if (std::find(found.begin(), found.end(), i->second) == found.end())
+						found.push_back(i->second);
+				}
+			}
+			return found;
+		}
+
 	public:
 		static inline 
 		QModule& inst();
@@ -102,86 +183,423 @@ namespace QUnit {
 		return module;
 	}
 
+	// started()/done() are called from the worker threads when run()
+	// is asked for more than one job.
 	struct QRunHost
 	{
 		virtual bool is_excluded(const QTest& test) = 0;
+		virtual void started(const QTest&) {}
 		virtual void done(const QResult& result) = 0;
 	};
 
+	// Receives the progress of a run. The runner delivers the events of
+	// all its reporters from one reporter thread, in the order they were
+	// posted, so implementations need no locking of their own.
+	struct QReporter
+	{
+		virtual ~QReporter() {}
+		virtual void begin(const QTests&) {}
+		virtual void test_started(const QTest&) {}
+		virtual void test_finished(const QResult& result) = 0;
+		virtual void end(QInt64) {}
+	};
+
 	struct QHostBase : QRunHost
 	{
 		QResults results;
+		PrivateHelper::QMutex results_lock;
 
-		bool is_excluded(const QTest& test)
+		bool is_excluded(const QTest&)
 		{
 			return false;
 		}
 		void done(const QResult& result)
 		{
+			PrivateHelper::QLock lock(results_lock);
 			results.push_back(result);
 		}
 	};
 
-	inline 
-	void run(QRunHost* host = NULL, 
-		const QTests& tests = QModule::inst().tests()) throw()
+	// Replaces every parameterized test with one entry per case, named
+	// name/index. Only the entries are created here; a case's parameter
+	// is generated when the case runs.
+	inline
+	QTests expand(const QTests& tests)
 	{
-		using namespace QUnit;
+		QTests all;
+		all.reserve(tests.size());
+		for (size_t i = 0; i < tests.size(); ++i)
+		{
+			int cases = tests[i].param < 0 && tests[i].run != NULL ? 
+				tests[i].run->cases() : -1;
+			if (cases < 0)
+			{
+				all.push_back(tests[i]);
+				continue;
+			}
+			for (int c = 0; c < cases; ++c)
+			{
+				char index[16];
+				sprintf(index, "/%d", c);
+				all.push_back(tests[i]);
+				all.back().name += index;
+				all.back().param = c;
+			}
+		}
+		return all;
+	}
 
-		QHostBase defHost;
-		if (host == NULL)
-			host = &defHost;
+	inline
+	bool needs_expand(const QTests& tests)
+	{
+		for (size_t i = 0; i < tests.size(); ++i)
+		{
+			if (tests[i].param < 0 && tests[i].run != NULL && tests[i].run->cases() >= 0)
+				return true;
+		}
+		return false;
+	}
+
+	inline
+	bool is_selected(QRunHost* host, const QTest& test)
+	{
+		if (strncmp("test", test.name.c_str(), 4) != 0)
+			return false;
+		return !host->is_excluded(test);
+	}
+
+	inline
+	void run_test(QRunHost* host, const QTest& test) throw()
+	{
+		host->started(test);
 
-		QTests::const_iterator i = tests.begin();
-		for (;i != tests.end(); ++i)
+		QResult result(test);
+		PrivateHelper::QRunCookie cookie(test.param);
+		QInt64 start = PrivateHelper::now_ns();
+
+		try
 		{
-			if (strncmp("test", i->name.c_str(), 4) != 0)
-				continue;
-			if (host->is_excluded(*i))
-				continue;
+			test.run->run(&cookie);
+		}
+		catch (const QFailure& e)
+		{
+			result.type = QResult::failure;
+			result.fail = e;
+			result.msg = "";
+		}
+		catch (const std::exception& e)
+		{
+			result.type = QResult::error;
+			result.msg = e.what();
+		}
+		catch (const char* e)
+		{
+			result.type = QResult::error;
+			result.msg = e;
+		}
+		catch (const std::string& e)
+		{
+			result.type = QResult::error;
+			result.msg = e;
+		}
+		catch (...)
+		{
+			result.type = QResult::error;
+			result.msg = "Unknown exception";
+		}
+
+		result.duration_ns = PrivateHelper::now_ns() - start;
+		result.assertion_count = cookie.__assertion_counter;
+		host->done(result);
+	}
+
+	namespace PrivateHelper
+	{
+		// for qassert_match: one context per thread, so the buffers that
+		// matching grows are reused by the next assertion
+		inline
+		CContext* match_context()
+		{
+			static QThreadLocal<CContext> contexts;
+			return &contexts.get();
+		}
+
+		// runs tests[todo[i]] in forks of a process that has run setup;
+		// defined with run_isolated()
+		void run_zygote(QRunHost* host, const QTests& tests,
+			const std::vector<size_t>& todo, int jobs, QZygoteSetup setup) throw();
+
+		// moves the tests of zygote testcases out of todo, by testcase
+		inline
+		void split_zygotes(const QTests& tests, std::vector<size_t>& todo,
+			std::map<std::string, std::vector<size_t> >& zygotes)
+		{
+			size_t kept = 0;
+			for (size_t i = 0; i < todo.size(); ++i)
+			{
+				const QTest& test = tests[todo[i]];
+				if (QModule::inst().zygote(test.testcase) != NULL)
+					zygotes[test.testcase].push_back(todo[i]);
+				else
+					todo[kept++] = todo[i];
+			}
+			todo.resize(kept);
+		}
+
+		inline
+		void run_zygotes(QRunHost* host, const QTests& tests,
+			const std::map<std::string, std::vector<size_t> >& zygotes, int jobs)
+		{
+			std::map<std::string, std::vector<size_t> >::const_iterator i;
+			for (i = zygotes.begin(); i != zygotes.end(); ++i)
+				run_zygote(host, tests, i->second, jobs, QModule::inst().zygote(i->first));
+		}
+
+		// Hands tests out to the workers of run() and run_isolated(). No
+		// more tests using a resource run at once than its limit allows.
+		// Tests with resources are handed out first whenever they fit and
+		// the rest fill the other workers, so the constrained tests don't
+		// end up queued behind everything else.
+		//
+		// What changes as tests are handed out is one block of longs, which
+		// run_isolated() moves into memory shared with its workers.
+		class QSchedule
+		{
+			enum {lock_word, next_plain, first_tagged, handed_out, header};
 
-			QResult result(*i);
-			i->run->__initialize_cookie();
+			std::vector<size_t> m_plain;
+			std::vector<size_t> m_tagged;
+			std::vector<std::vector<int> > m_uses;		// of m_tagged[i]
+			std::map<size_t, size_t> m_tag_of;
+			std::vector<long> m_limits;
+			std::vector<long> m_heap;
+			long* m_state;
+
+			void lock()
+			{
+				while (atomic_increment(&m_state[lock_word]) != 1)
+				{
+					atomic_decrement(&m_state[lock_word]);
+					yield_thread();
+				}
+			}
+			void unlock()
+			{
+				atomic_decrement(&m_state[lock_word]);
+			}
 
-			try
+			long* in_use()
 			{
-				i->run->run();
+				return m_state + header;
 			}
-			catch (const QFailure& e)
+			long* taken()
 			{
-				result.type = QResult::failure;
-				result.fail = e;
-				result.msg = "";
+				return m_state + header + m_limits.size();
 			}
-			catch (const std::exception& e)
+
+			bool fits(size_t t)
 			{
-				result.type = QResult::error;
-				result.msg = e.what();
+				for (size_t r = 0; r < m_uses[t].size(); ++r)
+				{
+					if (in_use()[m_uses[t][r]] >= m_limits[m_uses[t][r]])
+						return false;
+				}
+				return true;
 			}
-			catch (const char* e)
+
+		public:
+			enum {run, wait, finished};
+
+			QSchedule(const QTests& tests, const std::vector<size_t>& todo)
 			{
-				result.type = QResult::error;
-				result.msg = e;
+				std::map<std::string, int> ids;
+				for (size_t i = 0; i < todo.size(); ++i)
+				{
+					std::vector<std::string> names = QModule::inst().resources(tests[todo[i]]);
+					if (names.empty())
+					{
+						m_plain.push_back(todo[i]);
+						continue;
+					}
+
+					std::vector<int> uses;
+					for (size_t n = 0; n < names.size(); ++n)
+					{
+						if (ids.find(names[n]) == ids.end())
+						{
+							ids[names[n]] = (int)m_limits.size();
+							m_limits.push_back(QModule::inst().resource_limit(names[n]));
+						}
+						uses.push_back(ids[names[n]]);
+					}
+					m_tag_of[todo[i]] = m_tagged.size();
+					m_tagged.push_back(todo[i]);
+					m_uses.push_back(uses);
+				}
+
+				m_heap.resize(state_size() / sizeof(long), 0);
+				m_state = &m_heap[0];
 			}
-			catch (const std::string& e)
+
+			size_t state_size() const
 			{
-				result.type = QResult::error;
-				result.msg = e;
+				return (header + m_limits.size() + m_tagged.size()) * sizeof(long);
 			}
-			catch (...)
+			// from now on the state is at memory, e.g. shared with workers
+			void move_state(long* memory)
 			{
-				result.type = QResult::error;
-				result.msg = "Unknown exception";
+				memcpy(memory, m_state, state_size());
+				m_state = memory;
 			}
 
-			result.assertion_count = i->run->__assertion_counter;
-			host->done(result);
+			// run, with test set; wait, while tests remain that can't run
+			// yet; or finished
+			int take(size_t& test)
+			{
+				lock();
+				int outcome = finished;
+				while (m_state[first_tagged] < (long)m_tagged.size() &&
+					taken()[m_state[first_tagged]])
+					++m_state[first_tagged];
+				for (size_t t = m_state[first_tagged]; t < m_tagged.size(); ++t)
+				{
+					if (taken()[t])
+						continue;
+					if (!fits(t))
+					{
+						outcome = wait;
+						continue;
+					}
+					for (size_t r = 0; r < m_uses[t].size(); ++r)
+						++in_use()[m_uses[t][r]];
+					taken()[t] = 1;
+					test = m_tagged[t];
+					outcome = run;
+					break;
+				}
+				if (outcome != run && m_state[next_plain] < (long)m_plain.size())
+				{
+					test = m_plain[m_state[next_plain]++];
+					outcome = run;
+				}
+				if (outcome == run)
+					++m_state[handed_out];
+				unlock();
+				return outcome;
+			}
+
+			void release(size_t test)
+			{
+				std::map<size_t, size_t>::const_iterator i = m_tag_of.find(test);
+				if (i == m_tag_of.end())
+					return;
+				lock();
+				for (size_t r = 0; r < m_uses[i->second].size(); ++r)
+					--in_use()[m_uses[i->second][r]];
+				unlock();
+			}
+
+			bool remaining()
+			{
+				lock();
+				bool more = m_state[handed_out] < (long)(m_plain.size() + m_tagged.size());
+				unlock();
+				return more;
+			}
+		};
+
+		struct QWorkers
+		{
+			QRunHost* host;
+			const QTests* tests;
+			QSchedule* schedule;
+
+			static void work(void* arg)
+			{
+				QWorkers* self = (QWorkers*)arg;
+				for (;;)
+				{
+					size_t i = 0;
+					int next = self->schedule->take(i);
+					if (next == QSchedule::finished)
+						break;
+					if (next == QSchedule::wait)
+					{
+						sleep_ms(1);
+						continue;
+					}
+					run_test(self->host, (*self->tests)[i]);
+					self->schedule->release(i);
+				}
+			}
+		};
+	}
+
+	inline 
+	void run(QRunHost* host = NULL, 
+		const QTests& tests = QModule::inst().tests(), int jobs = 1) throw()
+	{
+		using namespace QUnit;
+
+		QHostBase defHost;
+		if (host == NULL)
+			host = &defHost;
+
+		if (needs_expand(tests))
+		{
+			run(host, expand(tests), jobs);
+			return;
+		}
+
+		std::vector<size_t> todo;
+		for (size_t i = 0; i < tests.size(); ++i)
+		{
+			if (is_selected(host, tests[i]))
+				todo.push_back(i);
 		}
+
+		std::map<std::string, std::vector<size_t> > zygotes;
+		PrivateHelper::split_zygotes(tests, todo, zygotes);
+
+		PrivateHelper::QSchedule schedule(tests, todo);
+		PrivateHelper::QWorkers workers;
+		workers.host = host;
+		workers.tests = &tests;
+		workers.schedule = &schedule;
+
+		int zygote_jobs = jobs;
+		if (jobs > (int)todo.size())
+			jobs = (int)todo.size();
+
+		// the calling thread is worker #0; contexts are made before the others start
+		PrivateHelper::match_context();
+		std::vector<PrivateHelper::QThread> threads(jobs > 1 ? jobs - 1 : 0);
+		for (size_t t = 0; t < threads.size(); ++t)
+			threads[t].start(&PrivateHelper::QWorkers::work, &workers);
+
+		PrivateHelper::QWorkers::work(&workers);
+
+		for (size_t t = 0; t < threads.size(); ++t)
+			threads[t].join();
+
+		PrivateHelper::run_zygotes(host, tests, zygotes, zygote_jobs);
 	}
 
 
 }
 
+#include "private/param.h"
+#include "private/data.h"
+#include "private/typed.h"
+#include "private/property.h"
+#include "private/fuzz.h"
+#include "private/death.h"
+#include "runner/report.h"
+#include "runner/xml.h"
+#include "runner/jsonl.h"
+#include "runner/tap.h"
+#include "runner/binlog.h"
+#include "runner/isolate.h"
 #include "runner/cui.h"
 
 
@@ -190,7 +608,7 @@ namespace QUnit {
 	class __qhelper_gen_name(test, testcase, test) : public testcase		\
 	{																		\
 	public:																	\
-		void run(QUnit::QRun* __qunit_runner_inst);							\
+		void run(QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst);	\
 		virtual ~__qhelper_gen_name(test, testcase, test)()					\
 		{																	\
 		}																	\
@@ -201,15 +619,15 @@ namespace QUnit {
 		{																	\
 			QUnit::QModule::inst().add_test(#testcase, #test, this);		\
 		}																	\
-		void run()															\
+		void run(QUnit::PrivateHelper::QRunCookie* cookie)					\
 		{																	\
 			__qhelper_gen_name(test, testcase, test) inst;					\
-			inst.run(this);													\
+			inst.run(cookie);												\
 		}																	\
 	}  __qhelper_gen_name(test, testcase, runner_inst);						\
 																			\
 	inline void __qhelper_gen_name(test, testcase, test)::run(				\
-		QUnit::QRun* __qunit_runner_inst)
+		QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst)
 
 
 // ----------------------------------------------------------------------------
@@ -225,6 +643,174 @@ using QUnit::QDefaultCase;
 /*2*/#define qcase(test) qtest(test, QDefaultCase)
 
 
+// ----------------------------------------------------------------------------
+// ԣgeneratorṩsize()at(i)QUnit::range(0, 100)
+// QUnit::values(table)ÿһΪtest/i
+// ֻڸʱɣparamʡ
+/*12*/#define qtest_p(test, testcase, generator)								\
+	class __qhelper_gen_name(test, testcase, test) : public testcase		\
+	{																		\
+	public:																	\
+		template<class P>													\
+		void run(QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,		\
+			const P& param);												\
+		virtual ~__qhelper_gen_name(test, testcase, test)()					\
+		{																	\
+		}																	\
+	};																		\
+	static QUnit::QRun* __qhelper_gen_name(test, testcase, runner_inst) =	\
+		QUnit::PrivateHelper::add_param_test<								\
+			__qhelper_gen_name(test, testcase, test)>(						\
+				#testcase, #test, generator);								\
+																			\
+	template<class P>														\
+	inline void __qhelper_gen_name(test, testcase, test)::run(				\
+		QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,				\
+		const P& param)
+
+
+// ----------------------------------------------------------------------------
+// ԣpathɼ¼ɵļÿ¼Ϊ4ֽС˳ȼݡ
+// ļӳ䵽ڴ棬recorddatasizeoffset͵طÿ¼
+// ¼Ϊʧʱ¼ļеƫơ
+/*13*/#define qtest_data(test, testcase, path)									\
+	class __qhelper_gen_name(test, testcase, test) : public testcase		\
+	{																		\
+	public:																	\
+		void run(QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,		\
+			const QUnit::QRecord& record);									\
+		virtual ~__qhelper_gen_name(test, testcase, test)()					\
+		{																	\
+		}																	\
+	};																		\
+	static QUnit::QRun* __qhelper_gen_name(test, testcase, runner_inst) =	\
+		QUnit::PrivateHelper::add_data_test<								\
+			__qhelper_gen_name(test, testcase, test)>(#testcase, #test, path);	\
+																			\
+	inline void __qhelper_gen_name(test, testcase, test)::run(				\
+		QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,				\
+		const QUnit::QRecord& record)
+
+
+// ----------------------------------------------------------------------------
+// ͻԣtypesΪQUnit::Types<...>ʱtypedefÿעΪ
+// һĲԣΪtest<>ģ壬TypeParamõǰ͡
+/*14*/#define qtest_t(test, testcase, types)									\
+	template<class TypeParam>												\
+	class __qhelper_gen_name(test, testcase, test) : public testcase		\
+	{																		\
+	public:																	\
+		void run(QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst);	\
+		virtual ~__qhelper_gen_name(test, testcase, test)()					\
+		{																	\
+		}																	\
+	};																		\
+	static bool __qhelper_gen_name(test, testcase, runner_inst) =			\
+		QUnit::PrivateHelper::add_typed_tests<								\
+			__qhelper_gen_name(test, testcase, test), types>(#testcase, #test);	\
+																			\
+	template<class TypeParam>												\
+	inline void __qhelper_gen_name(test, testcase, test)<TypeParam>::run(	\
+		QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst)
+
+
+// ----------------------------------------------------------------------------
+// ʲԣgeneratorcases루ĬQUNIT_PROPERTY_CASES
+// paramʡʧʱѷСͬһ𱨸棬
+// ûQUNIT_SEEDֿ֣鲢ִС
+// ֻһgeneratorQUnit::pairs(a, b)ϣǶף
+// param.firstparam.secondʣʱԷֱ
+/*15*/#define qproperty_n(test, testcase, generator, cases)						\
+	class __qhelper_gen_name(test, testcase, test) : public testcase		\
+	{																		\
+	public:																	\
+		template<class P>													\
+		void run(QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,		\
+			const P& param);												\
+		virtual ~__qhelper_gen_name(test, testcase, test)()					\
+		{																	\
+		}																	\
+	};																		\
+	static QUnit::QRun* __qhelper_gen_name(test, testcase, runner_inst) =	\
+		QUnit::PrivateHelper::add_property<									\
+			__qhelper_gen_name(test, testcase, test)>(						\
+				#testcase, #test, generator, cases);						\
+																			\
+	template<class P>														\
+	inline void __qhelper_gen_name(test, testcase, test)::run(				\
+		QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,				\
+		const P& param)
+
+/*16*/#define qproperty(test, testcase, generator)								\
+	qproperty_n(test, testcase, generator, QUNIT_PROPERTY_CASES)
+
+
+// ----------------------------------------------------------------------------
+// ģĿ꣺datasize룬ӿlibFuzzer
+// LLVMFuzzerTestOneInputһ¡ƽʱطĿ¼еÿ룬
+// --fuzz=ʱϲ浼ʧܵ룻QUNIT_LIBFUZZER
+// ֱLLVMFuzzerTestOneInputlibFuzzerӡ
+#ifndef QUNIT_LIBFUZZER
+/*17*/#define qfuzz(test)														\
+	class __qhelper_gen_name(test, QDefaultCase, test)						\
+	{																		\
+	public:																	\
+		static void run(QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,	\
+			const unsigned char* data, size_t size);						\
+	};																		\
+	static QUnit::QRun* __qhelper_gen_name(test, QDefaultCase, runner_inst) =	\
+		QUnit::PrivateHelper::add_fuzz_target<								\
+			__qhelper_gen_name(test, QDefaultCase, test)>("QDefaultCase", #test);	\
+																			\
+	inline void __qhelper_gen_name(test, QDefaultCase, test)::run(			\
+		QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,				\
+		const unsigned char* data, size_t size)
+#else
+/*17*/#define qfuzz(test)														\
+	static void __qhelper_gen_name(test, QDefaultCase, test)(				\
+		QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,				\
+		const unsigned char* data, size_t size);							\
+	extern "C" int LLVMFuzzerTestOneInput(const unsigned char* data, size_t size)	\
+	{																		\
+		return QUnit::PrivateHelper::fuzz_one(								\
+			&__qhelper_gen_name(test, QDefaultCase, test), data, size);		\
+	}																		\
+	static void __qhelper_gen_name(test, QDefaultCase, test)(				\
+		QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,				\
+		const unsigned char* data, size_t size)
+#endif
+
+
+// ----------------------------------------------------------------------------
+// ԤоߣtestcaseĲԸzygote̵forkСzygoteִֻһ
+// ĺ壨ش̬ԱÿԵõsetupɺ״̬
+// һдʱƸ޸ĻӰ죻ԾQRunHost::done㱨
+/*19*/#define qzygote(testcase)													\
+	static void __qhelper_gen_name(testcase, testcase, zygote)();				\
+	static bool __qhelper_gen_name(testcase, testcase, zygote_registered) =		\
+		QUnit::QModule::inst().add_zygote(#testcase,							\
+			&__qhelper_gen_name(testcase, testcase, zygote));					\
+																			\
+	static void __qhelper_gen_name(testcase, testcase, zygote)()
+
+
+// ----------------------------------------------------------------------------
+// ԴƣԴ䲢ޣδԴΪ1qusesʹtestcase
+// вռԴquses_testֻһԡʱռͬһԴ
+// ͬʱеĸޣճworker
+/*20*/#define qresource(resource, limit)										\
+	static bool __qhelper_gen_name(resource, resource, resource_limit) =	\
+		QUnit::QModule::inst().add_resource(#resource, limit)
+
+/*21*/#define quses(testcase, resource)											\
+	static bool __qhelper_gen_name(testcase, testcase, uses_##resource) =	\
+		QUnit::QModule::inst().add_uses(#testcase, "", #resource)
+
+/*22*/#define quses_test(test, testcase, resource)								\
+	static bool __qhelper_gen_name(test, testcase, uses_##resource) =		\
+		QUnit::QModule::inst().add_uses(#testcase, #test, #resource)
+
+
 
 // ----------------------------------------------------------------------------
 /*3*/#define qassert(exp)														\
@@ -241,7 +827,7 @@ using QUnit::QDefaultCase;
 		if (!equal(expect, exp))												\
 		{																		\
 			char msg[1024];														\
-			sprintf(msg, #exp "" #expect ", ֵ%s%s",		\
+			sprintf(msg, "%s, ֵ%s%s", #exp "" #expect,	\
 				to_s(expect).c_str(), to_s(exp).c_str());						\
 			throw QUnit::QFailure(__FILE__, __LINE__, msg);						\
 		}																		\
@@ -254,7 +840,7 @@ using QUnit::QDefaultCase;
 		if (equal(expect, exp))													\
 		{																		\
 			char msg[1024];														\
-			sprintf(msg, #exp "" #expect ", %s֮",	\
+			sprintf(msg, "%s, %s֮", #exp "" #expect,	\
 				to_s(expect).c_str(), to_s(exp).c_str());						\
 			throw QUnit::QFailure(__FILE__, __LINE__, msg);						\
 		}																		\
@@ -290,9 +876,15 @@ using QUnit::QDefaultCase;
 /*9*/#define qassert_match(regex, exp)											\
 	do {																		\
 		__qhelper_assertion_called();											\
-		CRegexpT<char> rx(regex);												\
-		MatchResult result = rx.Match(exp);										\
-		if (!result.IsMatched())												\
+		CRegexpT<char> rx(regex, MEMOIZE);										\
+		CContext* __qcontext = QUnit::PrivateHelper::match_context();			\
+		bool __qmatched = rx.IsMatch(exp, __qcontext) != 0;						\
+		if (__qcontext->m_bOverBudget)											\
+		{																		\
+			throw QUnit::QFailure(__FILE__, __LINE__,							\
+				#exp "ƥ" #regex "ʱݲԤ (regex budget exceeded)");	\
+		}																		\
+		if (!__qmatched)														\
 		{																		\
 			throw QUnit::QFailure(__FILE__, __LINE__, #exp "Ӧƥ" #regex);	\
 		}																		\
@@ -301,18 +893,67 @@ using QUnit::QDefaultCase;
 /*10*/#define qassert_not_match(regex, exp)										\
 	do {																		\
 		__qhelper_assertion_called();											\
-		CRegexpT<char> rx(regex);												\
-		MatchResult result = rx.Match(exp);										\
-		if (result.IsMatched())													\
+		CRegexpT<char> rx(regex, MEMOIZE);										\
+		CContext* __qcontext = QUnit::PrivateHelper::match_context();			\
+		bool __qmatched = rx.IsMatch(exp, __qcontext) != 0;						\
+		if (__qcontext->m_bOverBudget)											\
+		{																		\
+			throw QUnit::QFailure(__FILE__, __LINE__,							\
+				#exp "ƥ" #regex "ʱݲԤ (regex budget exceeded)");	\
+		}																		\
+		if (__qmatched)															\
+		{																		\
+			throw QUnit::QFailure(__FILE__, __LINE__, #exp "Ӧòƥ" #regex);	\
+		}																		\
+	} while(0)
+
+/*11*/#define qassert_faster_than(budget_ns, exp)								\
+	do {																		\
+		__qhelper_assertion_called();											\
+		QUnit::PrivateHelper::QLatencyMeter __qmeter(budget_ns);				\
+		while (__qmeter.next_batch())											\
+		{																		\
+			QUnit::QInt64 __qstart = QUnit::PrivateHelper::now_ns();			\
+			for (int __qi = __qmeter.batch(); __qi > 0; --__qi)					\
+			{																	\
+				exp;															\
+				QUnit::PrivateHelper::compiler_barrier();						\
+			}																	\
+			__qmeter.record(QUnit::PrivateHelper::now_ns() - __qstart);			\
+		}																		\
+		if (!__qmeter.passed())													\
+		{																		\
+			std::string msg = #exp "Ӧ" #budget_ns "ns, ʵ";			\
+			msg += __qmeter.distribution();										\
+			throw QUnit::QFailure(__FILE__, __LINE__, msg.c_str());				\
+		}																		\
+	} while(0)
+
+// statementӦʹֹźɱԷ0״̬˳stderrƥregex
+// statementforkӽִУӰ쵱ǰ
+/*18*/#define qassert_death(statement, regex)									\
+	do {																		\
+		__qhelper_assertion_called();											\
+		QUnit::PrivateHelper::QDeathTest __qdeath;								\
+		if (__qdeath.in_child())												\
+		{																		\
+			bool __qthrew = false;												\
+			try { statement; } catch (...) { __qthrew = true; }					\
+			__qdeath.survived(__qthrew);										\
+		}																		\
+		std::string __qwhy;														\
+		if (!__qdeath.died(regex, __qwhy))										\
 		{																		\
-			throw QUnit::QFailure(__FILE__, __LINE__, #exp "Ӧòƥ" #regex);\
+			std::string msg = #statement "Ӧʹֹstderrƥ" #regex ", ʵ: ";	\
+			msg += __qwhy;														\
+			throw QUnit::QFailure(__FILE__, __LINE__, msg.c_str());				\
 		}																		\
 	} while(0)
 
 
 // ----------------------------------------------------------------------------
 // QUNIT_ANYTIMEڷ_DEBUGʱ
-#if !defined(_DEBUG) && !defined(QUNIT_ANYTIME)
+#if !defined(_DEBUG) && !defined(QUNIT_ANYTIME) && !defined(QUNIT_LIBFUZZER)
 
 /*1*/ #undef qtest
 /*2*/ #undef qcase
@@ -324,6 +965,18 @@ using QUnit::QDefaultCase;
 /*8*/ #undef qassert_not_null
 /*9*/ #undef qassert_match
 /*10*/#undef qassert_not_match
+/*11*/#undef qassert_faster_than
+/*12*/#undef qtest_p
+/*13*/#undef qtest_data
+/*14*/#undef qtest_t
+/*15*/#undef qproperty_n
+/*16*/#undef qproperty
+/*17*/#undef qfuzz
+/*18*/#undef qassert_death
+/*19*/#undef qzygote
+/*20*/#undef qresource
+/*21*/#undef quses
+/*22*/#undef quses_test
 
 /*1*/ #define qtest(test, testcase) template<class T> static void __qhelper_gen_name(test, testcase, null)()
 /*2*/ #define qcase(test) qtest(test, QDefaultCase)
@@ -335,6 +988,18 @@ using QUnit::QDefaultCase;
 /*8*/ #define qassert_not_null(x) qassert(0)
 /*9*/ #define qassert_match(x, y) qassert(0)
 /*10*/#define qassert_not_match(x, y) qassert(0)
+/*11*/#define qassert_faster_than(x, y) qassert(0)
+/*12*/#define qtest_p(test, testcase, generator) template<class P> static void __qhelper_gen_name(test, testcase, null)(const P& param)
+/*13*/#define qtest_data(test, testcase, path) template<class T> static void __qhelper_gen_name(test, testcase, null)(const QUnit::QRecord& record)
+/*14*/#define qtest_t(test, testcase, types) template<class TypeParam> static void __qhelper_gen_name(test, testcase, null)()
+/*15*/#define qproperty_n(test, testcase, generator, cases) qtest_p(test, testcase, generator)
+/*16*/#define qproperty(test, testcase, generator) qtest_p(test, testcase, generator)
+/*17*/#define qfuzz(test) template<class T> static void __qhelper_gen_name(test, QDefaultCase, null)(const unsigned char* data, size_t size)
+/*18*/#define qassert_death(x, y) qassert(0)
+/*19*/#define qzygote(testcase) template<class T> static void __qhelper_gen_name(testcase, testcase, zygote_null)()
+/*20*/#define qresource(resource, limit) typedef int __qhelper_gen_name(resource, resource, resource_null)
+/*21*/#define quses(testcase, resource) typedef int __qhelper_gen_name(testcase, testcase, uses_##resource##_null)
+/*22*/#define quses_test(test, testcase, resource) typedef int __qhelper_gen_name(test, testcase, uses_##resource##_null)
 
 #endif
 
@@ -0,0 +1,75 @@
+#pragma warning(disable: 4786)
+
+#include <qunit.h>
+#include <string>
+
+
+int main(int argc, char** argv)
+{
+	std::string format = "console";
+	std::string out;
+	std::vector<const char*> logs;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "--format=", 9) == 0)
+			format = argv[i] + 9;
+		else if (strncmp(argv[i], "--out=", 6) == 0)
+			out = argv[i] + 6;
+		else
+			logs.push_back(argv[i]);
+	}
+
+	if (logs.empty())
+	{
+		puts("usage: qlog [--format=console|jsonl|tap|xml|qlog] [--out=file] log...");
+		return 0;
+	}
+
+	FILE* file = stdout;
+	if (!out.empty())
+	{
+		file = fopen(out.c_str(), "wb");
+		if (file == NULL)
+		{
+			printf("can't open %s for writing.\n", out.c_str());
+			return 1;
+		}
+	}
+
+	QUnit::QReporter* output;
+	if (format == "jsonl")
+		output = new QUnit::QJsonLinesReporter(file);
+	else if (format == "tap")
+		output = new QUnit::QTapReporter(file);
+	else if (format == "xml")
+		output = new QUnit::QNUnitXmlReporter(file);
+	else if (format == "qlog")
+		output = new QUnit::QBinaryLogWriter(file);
+	else
+		output = new QUnit::QConsoleReporter(file);
+
+	// shards ran side by side, so the merged run took as long as the
+	// slowest of them
+	int status = 0;
+	QUnit::QInt64 duration_ns = 0;
+	output->begin(QUnit::QTests());
+	for (size_t i = 0; i < logs.size(); ++i)
+	{
+		QUnit::PrivateHelper::QMappedFile log(logs[i]);
+		QUnit::QBinaryLogReader reader;
+		if (!reader.read(log.data(), log.size(), *output))
+		{
+			fprintf(stderr, "%s: incomplete or not a qunit result log\n", logs[i]);
+			status = 1;
+		}
+		if (reader.duration_ns() > duration_ns)
+			duration_ns = reader.duration_ns();
+	}
+	output->end(duration_ns);
+
+	delete output;
+	if (file != stdout)
+		fclose(file);
+	return status;
+}
@@ -54,7 +54,7 @@ int main(int argc, char** argv)
 
 	if (argc == 1)
 	{
-		puts("usage: qrun module [test] [fixture]");
+		puts("usage: qrun module [test] [fixture] [--xml=file] [--jobs=N] [--isolate] [--fuzz=seconds] [--format=console|jsonl|tap] [--log=file] [--filter=[-]regex ...] [--regex-budget=steps]");
 		return 0;
 	}
 	if (!load_module(argv[1], tests))
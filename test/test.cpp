@@ -45,6 +45,320 @@ qtest(testMatch2, FooCase)
 	qassert_not_match("AB+", "ABB");
 }
 
+enum {by_elx_tree, by_pike_vm, by_bytecode_backtracking};
+
+// every match of pattern in text, by the given engine
+static std::string regex_matches(const char* pattern, const char* text, int engine, int flags = 0)
+{
+	CRegexpT<char> rx(pattern, flags);
+	if (engine == by_elx_tree)
+		rx.m_automaton.Clear();
+	if (engine == by_pike_vm)
+		rx.m_automaton.m_nMaxVisited = 0;
+
+	std::ostringstream o;
+	CContext* context = rx.PrepareMatch(text);
+	for (;;)
+	{
+		MatchResult m = rx.Match(context);
+		if (!m.IsMatched())
+			break;
+		o << m.GetStart() << '-' << m.GetEnd();
+		for (int i = 1; i <= m.MaxGroupNumber(); ++i)
+			o << ' ' << m.GetGroupStart(i) << ',' << m.GetGroupEnd(i);
+		o << ';';
+	}
+	CRegexpT<char>::ReleaseContext(context);
+	return o.str();
+}
+
+qcase(testRegexAutomatonAgreesWithBacktracking)
+{
+	static const char* cases[][2] = {
+		{"(a|ab)(c|bcd)(d*)", "abcd"},
+		{"^(?:a|ab)*c", "abac"},
+		{"(a|ab)*c", "ababac abc c"},
+		{"x(a|b)*?y", "xababy xy"},
+		{"(\\w+)\\s(\\w+)", "hello big world"},
+		{"a{2,3}", "aaaaaaa"},
+		{"\\bfoo\\b", "foo food foo"},
+		{"(?i)AB[c-d]", "xabD abc"},
+		{"([0-9]+)-([0-9]+)?", "12-34 5-"},
+		{"(?<x>a+)(?<x>b)", "aab ab"},
+		{"[[:digit:]]+|$", "x12y"},
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+	{
+		qassert(CRegexpT<char>(cases[i][0]).m_automaton.IsCompiled());
+		qassert_equal(regex_matches(cases[i][0], cases[i][1], by_elx_tree), regex_matches(cases[i][0], cases[i][1], by_pike_vm));
+	}
+
+	// backreferences and lookaround stay with backtracking
+	qassert(!CRegexpT<char>("(a)\\1").m_automaton.IsCompiled());
+	qassert(!CRegexpT<char>("a(?=b)").m_automaton.IsCompiled());
+	qassert_equal("1-3 1,2;", regex_matches("(a)\\1", "baab", by_pike_vm));
+}
+
+qcase(testRegexBytecodeAgreesWithElxTree)
+{
+	static const char* patterns[] = {
+		"(a|ab)(c|bcd)(d*)", "(a|ab)*c", "x(a|b)*?y", "(\\w+)\\s(\\w+)", "a{2,3}",
+		"\\bfoo\\b", "(?i)AB[c-d]", "([0-9]+)-([0-9]+)?", "[[:digit:]]+|$",
+		"(a+)+b", "(?:a|b)*?(b+)", "([^ab]|a(b))+", "^(\\w+@)?\\w+(\\.\\w+)*$",
+	};
+	static const char* texts[] = {
+		"", "abcd", "ababac abc c", "xababy xy", "hello big world", "aaaaaaa",
+		"foo food foo", "xabD abc", "12-34 5-", "aaab abb", "a@b.c", "cab abba",
+	};
+	for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p)
+	{
+		qassert(CRegexpT<char>(patterns[p]).m_automaton.IsCompiled());
+		for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); ++t)
+		{
+			std::string expected = regex_matches(patterns[p], texts[t], by_elx_tree);
+			qassert_equal(expected, regex_matches(patterns[p], texts[t], by_bytecode_backtracking));
+			qassert_equal(expected, regex_matches(patterns[p], texts[t], by_pike_vm));
+		}
+	}
+}
+
+qcase(testRegexSkipsToCandidates)
+{
+	CRegexpT<char> literal("ERROR: .*timeout");
+	const CBufferT<char>& prefix = literal.m_builder.m_prefix;
+	qassert_equal("ERROR: ", std::string(prefix.GetBuffer(), prefix.GetSize()));
+
+	std::string log(100000, '.');
+	log += "ERROR: disk timeout";
+	qassert_equal(100000, literal.Match(log.c_str()).GetStart());
+
+	// no common prefix, but a set of first chars
+	CRegexpT<char> either("(ERROR|FATAL): ");
+	qassert_equal(0, either.m_builder.m_prefix.GetSize());
+	qassert_equal(4, either.m_builder.FindCandidate("xxxxFATAL: ", 11, 0));
+	qassert_equal(-1, either.m_builder.FindCandidate("xxxx", 4, 0));
+
+	// may match empty, so anywhere
+	qassert(CRegexpT<char>("a*").m_builder.m_bFirstAny);
+}
+
+qcase(testRegexClassesUseBitmapAndSortedRanges)
+{
+	CRegexpT<char> rx("^[A-Za-z0-9_\\-.\\s]+$");
+	qassert(rx.Match("user.name-42 \tx_").IsMatched());
+	qassert(!rx.Match("user@host").IsMatched());
+	qassert(!rx.Match("caf\xe9").IsMatched());
+
+	// wide chars past 256 are looked up in the sorted ranges
+	const unsigned short pattern[] = {'[', 0x4e00, '-', 0x9fa5, 'a', 0x3042, 'b', '-', 'd', ']', 0};
+	const unsigned short han[] = {0x4e2d, 0}, hiragana[] = {0x3042, 0}, other[] = {0x3043, 'e', 0};
+	CRegexpT<unsigned short> wide(pattern);
+	qassert(wide.Match(han).IsMatched());
+	qassert(wide.Match(hiragana).IsMatched());
+	qassert(!wide.Match(other).IsMatched());
+}
+
+qcase(testRegexReusedContextStopsReallocating)
+{
+	CRegexpT<char> rx("([\\w.]+)@(\\w+)\\.com");
+	CContext context;
+	qassert(rx.IsMatch("mail bob@example.com now", &context));
+
+	const void* buffers[] = {context.m_stack.GetBuffer(), context.m_visited.GetBuffer(),
+		context.m_best.GetBuffer(), context.m_capturestack.GetBuffer()};
+	for (int i = 0; i < 100; ++i)
+	{
+		qassert(rx.IsMatch("mail amy@example.com now", &context));
+		qassert(!rx.IsMatch("mail amy at example.com", &context));
+	}
+	qassert_equal(buffers[0], (const void*)context.m_stack.GetBuffer());
+	qassert_equal(buffers[1], (const void*)context.m_visited.GetBuffer());
+	qassert_equal(buffers[2], (const void*)context.m_best.GetBuffer());
+	qassert_equal(buffers[3], (const void*)context.m_capturestack.GetBuffer());
+
+	qassert_match("b+@", "mail bob@example.com");
+	qassert_not_match("^b+@", "mail bob@example.com");
+}
+
+qcase(testRegexSetReportsEveryMatchingPattern)
+{
+	static const char* patterns[] = {"ERROR: (disk|net)", "^WARN", "(\\w)\\1{2}", "(?i)timeout", "\\d+ms$", "z"};
+	static const char* texts[] = {"", "WARN ERROR: net TIMEOUT", "x ERROR: disk aaa", "took 15ms", "WARNING: 3 ms"};
+
+	CRegexSetT<char> set;
+	for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p)
+		qassert_equal((int)p, set.Add(patterns[p]));
+	qassert(set.m_combined.IsCompiled());
+
+	CBufferT<int> matched;
+	for (size_t t = 0; t < sizeof(texts) / sizeof(texts[0]); ++t)
+	{
+		int expected = 0;
+		int found = set.Match(texts[t], matched);
+		for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); ++p)
+		{
+			int alone = CRegexpT<char>(patterns[p]).IsMatch(texts[t]);
+			qassert_equal(alone, matched[(int)p]);
+			expected += alone;
+		}
+		qassert_equal(expected, found);
+	}
+}
+
+qcase(testRunnerFiltersWithManyPatterns)
+{
+	std::vector<std::string> filters;
+	filters.push_back("Codec");
+	filters.push_back("Parser\\.testNumbers");
+	filters.push_back("-Slow");
+	QUnit::QCUIRunnerHost host(".*", ".*", NULL, filters);
+
+	QUnit::QTest test;
+	test.testcase = "CodecCase";
+	test.name = "testRoundTrip";
+	qassert(!host.is_excluded(test));
+	test.name = "testSlowRoundTrip";
+	qassert(host.is_excluded(test));
+	test.testcase = "Parser";
+	test.name = "testNumbers";
+	qassert(!host.is_excluded(test));
+	test.name = "testStrings";
+	qassert(host.is_excluded(test));
+}
+
+qcase(testRegexStepBudgetStopsRunawayBacktracking)
+{
+	// the backreference keeps it off the automaton
+	std::string text(40, 'a');
+	CRegexpT<char> rx("(a|aa)*(b)\\2");
+	qassert(!rx.m_automaton.IsCompiled());
+	rx.m_nMaxSteps = 10000;
+
+	CContext context;
+	qassert(!rx.IsMatch(text.c_str(), &context));
+	qassert(context.m_bOverBudget);
+	qassert(!rx.MatchExact(text.c_str(), &context).IsMatched());
+	qassert(context.m_bOverBudget);
+
+	// within budget nothing changes
+	qassert(rx.IsMatch("aaabb", &context));
+	qassert(!context.m_bOverBudget);
+	qassert(!rx.IsMatch("aaab", &context));
+	qassert(!context.m_bOverBudget);
+}
+
+qcase(testRegexMemoizeRemembersFailedRepeats)
+{
+	// the backreference keeps it off the automaton, and comes before
+	// the repeat, so it can't tell two ways to the same pos apart
+	std::string text = "\"\"" + std::string(40, 'a');
+	CRegexpT<char> rx("([\"'])\\1(a|aa)*c", MEMOIZE);
+	qassert(!rx.m_automaton.IsCompiled());
+	qassert_equal(1, rx.m_builder.m_nMemoCount);
+	rx.m_nMaxSteps = 10000;
+
+	CContext context;
+	qassert(!rx.IsMatch(text.c_str(), &context));
+	qassert(!context.m_bOverBudget);
+	qassert(!rx.MatchExact(text.c_str(), &context).IsMatched());
+	qassert(!context.m_bOverBudget);
+	qassert(rx.IsMatch("x''aaac", &context));
+	qassert_equal(5, rx.Match("x''aaac").GetGroupStart(2));
+
+	// a backreference after the repeat may read what it captured
+	CRegexpT<char> after("(a|aa)*(b)\\2", MEMOIZE);
+	qassert_equal(0, after.m_builder.m_nMemoCount);
+
+	// assertions memoize, so this stays far within the step budget
+	qassert_not_match("^(\\w+\\s?)*(?<=x)$", "aaaaaaaaaaaaaaa aaaaaaaaaaaaaaa!");
+}
+
+qcase(testRegexOptimizerRewritesTheTree)
+{
+	// literals join across a group
+	CRegexpT<char> joined("a(?:b)c");
+	qassert(dynamic_cast<CStringElxT<char>*>(joined.m_builder.m_pTopElx) != 0);
+
+	// a shared prefix, then one class for the single chars left
+	CRegexpT<char> factored("abc|abd|abe|x");
+	CAlternativeElx* top = dynamic_cast<CAlternativeElx*>(factored.m_builder.m_pTopElx);
+	qassert(top != 0);
+	qassert_equal(2, top->m_elxlist.GetSize());
+	CListElx* shared = dynamic_cast<CListElx*>(top->m_elxlist[0]);
+	qassert(shared != 0);
+	qassert(dynamic_cast<CRangeElxT<char>*>(shared->m_elxlist[1]) != 0);
+	qassert_equal(2, factored.Match("zzabd").GetStart());
+	qassert(!factored.IsMatch("abf"));
+
+	// branches keep their order, so the first of two still wins
+	CRegexpT<char> ordered("(get|set|getx)");
+	qassert_equal(3, ordered.Match("getx").GetGroupEnd(1));
+
+	// nothing \d+ gives back could be an x
+	CRegexpT<char> digits("\\d+x");
+	CListElx* list = dynamic_cast<CListElx*>(digits.m_builder.m_pTopElx);
+	CPossessiveElx* possessive = dynamic_cast<CPossessiveElx*>(list->m_elxlist[0]);
+	qassert(possessive != 0 && possessive->m_bimplied);
+	qassert(digits.m_automaton.IsCompiled());
+	qassert(!digits.IsMatch("12345"));
+
+	CRegexpT<char> words("\\w+x");
+	list = dynamic_cast<CListElx*>(words.m_builder.m_pTopElx);
+	qassert(dynamic_cast<CPossessiveElx*>(list->m_elxlist[0]) == 0);
+	qassert(words.IsMatch("abcx"));
+}
+
+qcase(testRegexAnchorsAndLengthsPruneStarts)
+{
+	// \A and ^ without MULTILINE only match at 0
+	CRegexpT<char> anchored("^(?:ab|c)+");
+	qassert(anchored.m_builder.m_bAnchored);
+	qassert_equal(-1, anchored.m_builder.FindCandidate("xab", 3, 1));
+	qassert(!anchored.IsMatch("xab"));
+	qassert(!CRegexpT<char>("^a", MULTILINE).m_builder.m_bAnchored);
+	qassert(!CRegexpT<char>("^a|b").m_builder.m_bAnchored);
+
+	// no start within the last two chars can fit a match
+	CRegexpT<char> bounded("[a-c]\\d{2}(?:x|yz)?");
+	qassert_equal(3, bounded.m_builder.m_nMinLength);
+	qassert_equal(5, bounded.m_builder.m_nMaxLength);
+	qassert_equal(-1, bounded.m_builder.FindCandidate("zzzzzb1", 7, 0));
+	qassert_equal(4, bounded.Match("zzzzb12").GetStart());
+	qassert(!bounded.MatchExact("b1").IsMatched());
+	qassert(!bounded.MatchExact("b12yzz").IsMatched());
+	qassert(bounded.MatchExact("b12yz").IsMatched());
+
+	// a backref may be any length
+	qassert_equal(INT_MAX, CRegexpT<char>("(a)\\1").m_builder.m_nMaxLength);
+}
+
+qcase(testRegexBacktrackingKeepsEmptyLastIterations)
+{
+	// repeats that may match empty stay with backtracking; offsets as in PCRE
+	static const char* cases[][3] = {
+		{"(.?){0,2}x", "bx", "0-2 1,1;"},
+		{"\\d?(.?){0,2}x", " 11 a1bx", "5-8 7,7;"},
+		{".(c*){1,3}...", "xcccc", "0-5 2,2;"},
+		{"(a?b?)*(b)", "abab", "0-4 3,3 3,4;"},
+		{"^(?:a?|ab)*c", "abac", "0-4;"},
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+	{
+		qassert(!CRegexpT<char>(cases[i][0]).m_automaton.IsCompiled());
+		qassert_equal(cases[i][2], regex_matches(cases[i][0], cases[i][1], by_elx_tree));
+		qassert_equal(cases[i][2], regex_matches(cases[i][0], cases[i][1], by_elx_tree, MEMOIZE));
+	}
+}
+
+qcase(testRegexAutomatonRunsInLinearTime)
+{
+	// exponential for backtracking
+	std::string text(10000, 'a');
+	CRegexpT<char> rx("(a|aa)*c");
+	qassert(!rx.Match(text.c_str()).IsMatched());
+	qassert(!rx.MatchExact(text.c_str()).IsMatched());
+}
+
 
 qcase(testToS)
 {
@@ -62,6 +376,672 @@ qcase(testEqual)
 	qassert(equal(L"ABC", L"ABC"));
 }
 
+static volatile int spin_sink;
+static void spin(int n)
+{
+	for (int i = 0; i < n; ++i)
+		spin_sink = spin_sink + i;
+}
+
+qcase(testFasterThan)
+{
+	qassert_faster_than(10000000, spin(10));
+}
+
+qcase(testFasterThanReportsDistribution)
+{
+	std::string msg;
+	try
+	{
+		qassert_faster_than(1, spin(1000));
+	}
+	catch (const QUnit::QFailure& e)
+	{
+		msg = e.condition;
+	}
+	qassert_match("median [0-9.]+ns.*samples", msg.c_str());
+}
+
+#ifdef X_OS_UNIX
+static void check_invariant(bool holds)
+{
+	if (!holds)
+	{
+		fprintf(stderr, "invariant violated\n");
+		abort();
+	}
+}
+
+qcase(testDeath)
+{
+	qassert_death(check_invariant(false), "invariant violated");
+	qassert_death(exit(3), "");
+}
+
+qcase(testDeathReportsSurvivors)
+{
+	std::string returned, unmatched;
+	try
+	{
+		qassert_death(check_invariant(true), "invariant");
+	}
+	catch (const QUnit::QFailure& e)
+	{
+		returned = e.condition;
+	}
+	try
+	{
+		qassert_death(check_invariant(false), "^segfault");
+	}
+	catch (const QUnit::QFailure& e)
+	{
+		unmatched = e.condition;
+	}
+	qassert_match("it returned$", returned.c_str());
+	qassert_match("killed by signal \\d+, stderr was \"invariant violated", unmatched.c_str());
+}
+#endif
+
+#ifdef X_OS_UNIX
+class IndexCase
+{
+public:
+	static std::vector<int>* index;
+	static int setups;
+};
+std::vector<int>* IndexCase::index = NULL;
+int IndexCase::setups = 0;
+
+qzygote(IndexCase)
+{
+	IndexCase::index = new std::vector<int>(100000, 7);
+	++IndexCase::setups;
+}
+
+qtest(testZygoteSnapshotIsPristine, IndexCase)
+{
+	qassert_equal(1, IndexCase::setups);
+	qassert_equal(7, (*IndexCase::index)[0]);
+	(*IndexCase::index)[0] = 0;
+}
+
+qtest(testZygoteSnapshotIsPristineAgain, IndexCase)
+{
+	qassert_equal(1, IndexCase::setups);
+	qassert_equal(7, (*IndexCase::index)[0]);
+	(*IndexCase::index)[0] = 0;
+}
+
+qcase(testZygoteSetupStaysOutOfRunner)
+{
+	qassert_equal(0, IndexCase::setups);
+}
+#endif
+
+static std::string read_all(FILE* f)
+{
+	std::string content;
+	char buf[4096];
+	size_t n;
+	rewind(f);
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		content.append(buf, n);
+	return content;
+}
+
+qcase(testXmlReporterStreamsCompleteDocument)
+{
+	FILE* f = tmpfile();
+	QUnit::QNUnitXmlReporter xml(f, "suite");
+	xml.begin(QUnit::QTests());
+
+	QUnit::QTest test;
+	test.testcase = "FooCase";
+	test.name = "testEscape";
+	QUnit::QResult result(test);
+	result.type = QUnit::QResult::failure;
+	result.fail = QUnit::QFailure("a.cpp", 7, "x < y && \"]]>\"");
+	result.assertion_count = 3;
+	xml.test_finished(result);
+
+	std::string content = read_all(f);
+	qassert_match("total=\"1\" errors=\"0\" failures=\"1\"", content.c_str());
+	qassert_match("name=\"FooCase.testEscape\".*asserts=\"3\"", content.c_str());
+	qassert_match("\\]\\]\\]\\]><!\\[CDATA\\[>", content.c_str());
+	qassert_match("a\\.cpp:7", content.c_str());
+	qassert_match("</test-results>\\n$", content.c_str());
+
+	xml.end(0);
+	fclose(f);
+}
+
+qcase(testXmlReporterKeepsLineBreaksInCData)
+{
+	FILE* f = tmpfile();
+	QUnit::QNUnitXmlReporter xml(f, "suite");
+	xml.begin(QUnit::QTests());
+
+	QUnit::QTest test;
+	test.testcase = "FooCase";
+	test.name = "testLines";
+	QUnit::QResult result(test);
+	result.type = QUnit::QResult::failure;
+	result.fail = QUnit::QFailure("a.cpp", 7, "first & <line>\n\tsecond\r\nthird\x01");
+	xml.test_finished(result);
+
+	std::string content = read_all(f);
+	qassert(content.find("first & <line>\n\tsecond\r\nthird?") != std::string::npos);
+
+	xml.end(0);
+	fclose(f);
+}
+
+#ifdef X_OS_UNIX
+qcase(testXmlReporterOnPipeWritesFinalTotals)
+{
+	int fds[2];
+	qassert_equal(0, pipe(fds));
+	FILE* w = fdopen(fds[1], "wb");
+	QUnit::QNUnitXmlReporter xml(w, "suite");
+	xml.begin(QUnit::QTests());
+
+	QUnit::QTest test;
+	test.testcase = "FooCase";
+	test.name = "testFail";
+	QUnit::QResult result(test);
+	result.type = QUnit::QResult::failure;
+	xml.test_finished(result);
+	xml.end(2500000000LL);
+	fclose(w);
+
+	FILE* r = fdopen(fds[0], "rb");
+	std::string content;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), r)) > 0)
+		content.append(buf, n);
+	fclose(r);
+
+	qassert_match("total=\"1\" errors=\"0\" failures=\"1\"", content.c_str());
+	qassert_match("result=\"Failure\" success=\"False\" time=\"2\\.500\"", content.c_str());
+	qassert_match("name=\"FooCase\\.testFail\"", content.c_str());
+}
+#endif
+
+qcase(testJsonLinesReporterWritesOneRecordPerResult)
+{
+	FILE* f = tmpfile();
+	QUnit::QJsonLinesReporter jsonl(f);
+
+	QUnit::QTest test;
+	test.testcase = "FooCase";
+	test.name = "testQuote";
+	QUnit::QResult result(test);
+	result.type = QUnit::QResult::failure;
+	result.fail = QUnit::QFailure("a.cpp", 7, "\"x\"\n\xff\xc6\xda");
+	result.duration_ns = 1500;
+	jsonl.test_finished(result);
+	jsonl.test_finished(QUnit::QResult(test));
+	jsonl.end(0);
+
+	std::string content = read_all(f);
+	qassert_match("^\\{\"testcase\":\"FooCase\",\"name\":\"testQuote\",\"status\":\"failure\",\"duration_ns\":1500,", content.c_str());
+	qassert_match("\"file\":\"a\\.cpp\",\"line\":7,\"message\":\"\\\\\"x\\\\\"\\\\n\\\\u00ff\\\\u00c6\\\\u00da\"\\}\\n", content.c_str());
+	qassert_match("\\n\\{[^\\n]*\"status\":\"pass\"[^\\n]*\\}\\n$", content.c_str());
+	fclose(f);
+}
+
+struct Conversion
+{
+	int celsius;
+	int fahrenheit;
+};
+
+static const Conversion conversions[] = {
+	{-40, -40}, {0, 32}, {37, 98}, {100, 212}
+};
+
+qtest_p(testConversionTable, QDefaultCase, QUnit::values(conversions))
+{
+	qassert_equal(param.fahrenheit, param.celsius * 9 / 5 + 32);
+}
+
+qtest_p(testEvenNumbers, QDefaultCase, QUnit::range(0, 1000, 2))
+{
+	qassert_equal(0, param % 2);
+}
+
+qcase(testParameterizedTestsExpandIntoCases)
+{
+	QUnit::QTests tests = QUnit::expand(QUnit::QModule::inst().tests());
+	int conversion_cases = 0, even_cases = 0;
+	for (size_t i = 0; i < tests.size(); ++i)
+	{
+		if (tests[i].name.compare(0, 20, "testConversionTable/") == 0)
+			++conversion_cases;
+		if (tests[i].name.compare(0, 16, "testEvenNumbers/") == 0)
+			++even_cases;
+	}
+	qassert_equal(4, conversion_cases);
+	qassert_equal(500, even_cases);
+}
+
+struct RecordSizeCheck
+{
+	void run(QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst, const QUnit::QRecord& record)
+	{
+		qassert(record.size < 3);
+	}
+};
+
+struct RecordSizeThrow
+{
+	void run(QUnit::PrivateHelper::QRunCookie*, const QUnit::QRecord& record)
+	{
+		if (record.size >= 2)
+			throw std::runtime_error("too long");
+	}
+};
+
+qcase(testDataRunReportsFailuresByRecordOffset)
+{
+	const char* path = "qunit_corpus.tmp";
+	FILE* f = fopen(path, "wb");
+	fwrite("\1\0\0\0a\2\0\0\0bc\3\0\0\0def", 1, 18, f);
+	fclose(f);
+
+	{
+		QUnit::PrivateHelper::QDataRun<RecordSizeCheck> run(path);
+		qassert_equal(1, run.cases());
+
+		QUnit::PrivateHelper::QRunCookie cookie(0);
+		std::string failure;
+		try
+		{
+			run.run(&cookie);
+		}
+		catch (const QUnit::QFailure& e)
+		{
+			failure = e.condition;
+		}
+		qassert_equal(3, cookie.__assertion_counter);
+		qassert_match("^qunit_corpus\\.tmp@11: ", failure.c_str());
+	}
+	{
+		// other exceptions, and the site a crashed worker is blamed on
+		QUnit::PrivateHelper::QRecordSite site;
+		site.offset = -1;
+		QUnit::PrivateHelper::record_site() = &site;
+		QUnit::PrivateHelper::QDataRun<RecordSizeThrow> run(path);
+		run.cases();
+
+		QUnit::PrivateHelper::QRunCookie cookie(0);
+		std::string error;
+		try
+		{
+			run.run(&cookie);
+		}
+		catch (const std::string& e)
+		{
+			error = e;
+		}
+		QUnit::PrivateHelper::record_site() = NULL;
+		qassert_equal("qunit_corpus.tmp@5: too long", error);
+		qassert_equal(5, (int)site.offset);
+		qassert_equal("qunit_corpus.tmp", std::string(site.path));
+	}
+	remove(path);
+
+	QUnit::PrivateHelper::QDataRun<RecordSizeCheck> missing(path);
+	qassert_equal(1, missing.cases());
+}
+
+typedef QUnit::Types<int, double, std::string> ValueTypes;
+
+qtest_t(testDefaultConstructedCopiesCompareEqual, QDefaultCase, ValueTypes)
+{
+	TypeParam value = TypeParam();
+	std::vector<TypeParam> copies(3, value);
+	qassert(copies[2] == value);
+}
+
+qcase(testTypedTestsRegisterOneTestPerType)
+{
+	const QUnit::QTests& tests = QUnit::QModule::inst().tests();
+	std::string names;
+	for (size_t i = 0; i < tests.size(); ++i)
+	{
+		if (tests[i].name.compare(0, 41, "testDefaultConstructedCopiesCompareEqual<") == 0)
+			names += tests[i].name.substr(40) + " ";
+	}
+	qassert_match("^<int> <double> <std::.*string.*> $", names.c_str());
+}
+
+qproperty(testReverseTwiceIsIdentity, QDefaultCase, QUnit::vectors(QUnit::ints(-100, 100)))
+{
+	std::vector<int> reversed(param.rbegin(), param.rend());
+	std::reverse(reversed.begin(), reversed.end());
+	qassert(reversed == param);
+}
+
+qproperty(testAdditionCommutes, QDefaultCase, QUnit::pairs(QUnit::ints(-1000, 1000), QUnit::ints(-1000, 1000)))
+{
+	qassert_equal(param.first + param.second, param.second + param.first);
+}
+
+struct SumBelowLimit
+{
+	template<class P>
+	void run(QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst, const P& param)
+	{
+		int sum = 0;
+		for (size_t i = 0; i < param.size(); ++i)
+			sum += param[i];
+		qassert(sum < 100);
+	}
+};
+
+qcase(testPropertyShrinksCounterexample)
+{
+	QUnit::PrivateHelper::QPropertyRun<SumBelowLimit, QUnit::QVectorGen<QUnit::QIntGen<int> > >
+		run(QUnit::vectors(QUnit::ints(0, 1000)), 500);
+	qassert_equal(1, run.cases());
+
+	QUnit::PrivateHelper::QRunCookie cookie(0);
+	std::string failure;
+	try
+	{
+		run.run(&cookie);
+	}
+	catch (const QUnit::QFailure& e)
+	{
+		failure = e.condition;
+	}
+	qassert_match("^falsified by \\[100\\] \\(case \\d+, \\d+ shrinks; replay with QUNIT_SEED=\\d+\\): sum < 100", failure.c_str());
+}
+
+qfuzz(testUtf8LengthStaysInsideInput)
+{
+	for (const unsigned char* p = data; p < data + size; ++p)
+	{
+		int n = QUnit::PrivateHelper::utf8_length(p, data + size);
+		qassert(n >= 0 && n <= data + size - p);
+	}
+}
+
+#ifdef X_OS_UNIX
+static void rejectBad(QUnit::PrivateHelper::QRunCookie* __qunit_runner_inst,
+	const unsigned char* data, size_t size)
+{
+	qassert(size < 3 || memcmp(data, "bad", 3) != 0);
+}
+
+qcase(testFuzzTargetReplaysCorpus)
+{
+	setenv("QUNIT_CORPUS", "/tmp/qunit-fuzz-test", 1);
+	QUnit::PrivateHelper::QFuzzRun run("replay", &rejectBad);
+	std::string dir = run.corpus();
+	std::string good = QUnit::PrivateHelper::save_input(dir, "", (const unsigned char*)"good", 4);
+	std::string bad = QUnit::PrivateHelper::save_input(dir, "crash-", (const unsigned char*)"bad!", 4);
+	qassert_equal(3, run.cases());
+
+	std::string failure;
+	for (int i = 0; i < 3; ++i)
+	{
+		QUnit::PrivateHelper::QRunCookie cookie(i);
+		try
+		{
+			run.run(&cookie);
+		}
+		catch (const QUnit::QFailure& e)
+		{
+			failure += e.condition;
+		}
+	}
+	unsetenv("QUNIT_CORPUS");
+	remove(good.c_str());
+	remove(bad.c_str());
+	qassert_equal(0, (int)failure.find(bad + ": size < 3 || memcmp(data, \"bad\", 3) != 0"));
+}
+#endif
+
+
+struct RecordingReporter : QUnit::QReporter
+{
+	std::string events;
+
+	void begin(const QUnit::QTests&) { events += "b"; }
+	void test_started(const QUnit::QTest&) { events += "s"; }
+	void test_finished(const QUnit::QResult& result) { events += result.name; }
+	void end(QUnit::QInt64) { events += "e"; }
+};
+
+qcase(testAsyncReporterDeliversInOrder)
+{
+	RecordingReporter first, second;
+	QUnit::QReporters fanout;
+	fanout.add(&first);
+	fanout.add(&second);
+
+	QUnit::QTests tests(3);
+	tests[0].name = "1";
+	tests[1].name = "2";
+	tests[2].name = "3";
+
+	QUnit::QAsyncReporter reporter(fanout);
+	reporter.begin(tests);
+	for (size_t i = 0; i < tests.size(); ++i)
+	{
+		reporter.test_started(tests[i]);
+		reporter.test_finished(QUnit::QResult(tests[i]));
+	}
+	reporter.end(0);
+
+	qassert_equal("bs1s2s3e", first.events);
+	qassert_equal(first.events, second.events);
+}
+
+qcase(testConsoleReporterListsFailuresInRegistrationOrder)
+{
+	QUnit::QTests tests(2);
+	tests[0].testcase = tests[1].testcase = "QDefaultCase";
+	tests[0].name = "testFirst";
+	tests[1].name = "testSecond";
+
+	FILE* f = tmpfile();
+	{
+		QUnit::QConsoleReporter console(f);
+		console.begin(tests);
+		QUnit::QResult second(tests[1]), first(tests[0]);
+		second.type = first.type = QUnit::QResult::failure;
+		console.test_finished(second);
+		console.test_finished(first);
+		console.end(0);
+	}
+
+	std::string content = read_all(f);
+	qassert_match("1\\) Failure:\\ntestFirst [\\s\\S]*2\\) Failure:\\ntestSecond ", content.c_str());
+	qassert_match("2 tests, 0 assertions, 2 failures, 0 errors\\n$", content.c_str());
+	fclose(f);
+}
+
+
+struct CollectingReporter : QUnit::QReporter
+{
+	QUnit::QResults results;
+
+	void test_finished(const QUnit::QResult& result) { results.push_back(result); }
+};
+
+qcase(testBinaryLogRoundTrip)
+{
+	FILE* f = tmpfile();
+	QUnit::QBinaryLogWriter writer(f);
+	writer.begin(QUnit::QTests());
+
+	QUnit::QTest test;
+	test.testcase = "FooCase";
+	test.name = "testBar";
+	QUnit::QResult failed(test);
+	failed.type = QUnit::QResult::failure;
+	failed.fail = QUnit::QFailure("a.cpp", 300, "x");
+	failed.duration_ns = 1234567;
+	failed.assertion_count = 2;
+	failed.executions = 5000;
+	failed.new_inputs = 3;
+	writer.test_finished(failed);
+	writer.test_finished(QUnit::QResult(test));
+	writer.end(99);
+
+	std::string log = read_all(f);
+	fclose(f);
+
+	CollectingReporter all;
+	QUnit::QBinaryLogReader reader;
+	qassert(reader.read(log.data(), log.size(), all));
+	qassert_equal(2, (int)all.results.size());
+	qassert_equal("FooCase", all.results[1].testcase);
+	qassert_equal(300, all.results[0].fail.line);
+	qassert_equal(1234567, (int)all.results[0].duration_ns);
+	qassert_equal(5000, (int)all.results[0].executions);
+	qassert_equal(3, (int)all.results[0].new_inputs);
+	qassert_equal(0, (int)all.results[1].executions);
+	qassert_equal(99, (int)reader.duration_ns());
+
+	// a log cut off mid-record keeps the results written before it
+	CollectingReporter partial;
+	QUnit::QBinaryLogReader truncated;
+	qassert_not(truncated.read(log.data(), log.size() - 3, partial));
+	qassert_equal(1, (int)partial.results.size());
+}
+
+struct Gauge
+{
+	QUnit::PrivateHelper::QMutex lock;
+	int running;
+	int peak;
+
+	Gauge() : running(0), peak(0) {}
+	void enter()
+	{
+		QUnit::PrivateHelper::QLock hold(lock);
+		if (++running > peak)
+			peak = running;
+	}
+	void leave()
+	{
+		QUnit::PrivateHelper::QLock hold(lock);
+		--running;
+	}
+};
+
+struct BusyRun : QUnit::QRun
+{
+	Gauge* all;
+	Gauge* tagged;
+	BusyRun(Gauge* a, Gauge* t) : all(a), tagged(t) {}
+	void run(QUnit::PrivateHelper::QRunCookie*)
+	{
+		all->enter();
+		if (tagged != NULL)
+			tagged->enter();
+		QUnit::PrivateHelper::sleep_ms(20);
+		if (tagged != NULL)
+			tagged->leave();
+		all->leave();
+	}
+};
+
+qcase(testResourceLimitsConcurrency)
+{
+	Gauge all, tagged;
+	BusyRun codec(&all, &tagged), plain(&all, NULL);
+	QUnit::QModule::inst().add_uses("CodecCase", "", "test_codec");
+
+	QUnit::QTests tests(8);
+	for (int i = 0; i < 8; ++i)
+	{
+		tests[i].testcase = i < 4 ? "CodecCase" : "PlainCase";
+		tests[i].name = "test" + QUnit::PrivateHelper::to_s(i);
+		tests[i].run = i < 4 ? &codec : &plain;
+	}
+
+	QUnit::QHostBase host;
+	QUnit::run(&host, tests, 4);
+	qassert_equal(8, (int)host.results.size());
+	qassert_equal(1, tagged.peak);
+	qassert(all.peak >= 2);
+}
+
+qresource(scratch_dir, 2);
+quses_test(testFasterThan, QDefaultCase, scratch_dir);
+
+qcase(testResourceTagsAreRegistered)
+{
+	QUnit::QTest test;
+	test.testcase = "QDefaultCase";
+	test.name = "testFasterThan";
+	std::vector<std::string> resources = QUnit::QModule::inst().resources(test);
+	qassert_equal(1, (int)resources.size());
+	qassert_equal("scratch_dir", resources[0]);
+	qassert_equal(2, QUnit::QModule::inst().resource_limit("scratch_dir"));
+	qassert_equal(1, QUnit::QModule::inst().resource_limit("undeclared"));
+}
+
+#ifdef X_OS_UNIX
+struct NoisyRun : QUnit::QRun
+{
+	bool fail;
+	NoisyRun(bool f) : fail(f) {}
+	void run(QUnit::PrivateHelper::QRunCookie*)
+	{
+		printf("noise from %s", fail ? "failing" : "passing");
+		if (fail)
+			throw "failed";
+	}
+};
+
+struct CrashingRun : QUnit::QRun
+{
+	void run(QUnit::PrivateHelper::QRunCookie*)
+	{
+		fputs("last words", stderr);
+		abort();
+	}
+};
+
+qcase(testIsolatedRunCapturesOutputOfFailedTests)
+{
+	NoisyRun passing(false), failing(true);
+	CrashingRun crashing;
+	QUnit::QTests tests(4);
+	tests[0].name = "testPass";
+	tests[0].run = &passing;
+	tests[1].name = "testFail";
+	tests[1].run = &failing;
+	tests[2].name = "testCrash";
+	tests[2].run = &crashing;
+	tests[3].name = "testAfterCrash";
+	tests[3].run = &passing;
+
+	QUnit::QHostBase host;
+	QUnit::run_isolated(&host, tests, 2);
+	qassert_equal(4, (int)host.results.size());
+
+	std::map<std::string, QUnit::QResult*> byname;
+	for (size_t i = 0; i < host.results.size(); ++i)
+		byname[host.results[i].name] = &host.results[i];
+
+	qassert_equal(QUnit::QResult::pass, byname["testPass"]->type);
+	qassert_equal("", byname["testPass"]->output);
+	qassert_equal("noise from failing", byname["testFail"]->output);
+	qassert_equal(QUnit::QResult::error, byname["testCrash"]->type);
+	qassert_match("signal", byname["testCrash"]->msg.c_str());
+	qassert_equal("last words", byname["testCrash"]->output);
+	qassert_equal(QUnit::QResult::pass, byname["testAfterCrash"]->type);
+}
+#endif
+
 
 void testRunAll()
 {